@@ -69,6 +69,10 @@ namespace farm::config
         constexpr const char* COMMAND_SUFFIX = "/command";    // Суффикс для топика команд
         constexpr const char* LOG_SUFFIX     = "/log";         // Суффикс для топика логов
 
+        // Поля, добавляемые к данным при публикации: по ним сервер отбрасывает повторы retained-сообщения
+        constexpr const char* DATA_TIMESTAMP_KEY = "timestamp";  // Время снятия показаний (NTP, Unix)
+        constexpr const char* DATA_SEQUENCE_KEY  = "seq";        // Номер публикации с момента запуска
+
         // Константы для работы с MQTT подключением
         constexpr unsigned long CHECK_INTERVAL = 5000;           // 5 секунд между проверками соединения
         constexpr uint8_t MAX_RECONNECT_ATTEMPTS = 1;           // Максимальное количество попыток переподключения
@@ -37,6 +37,9 @@ namespace farm::net
         // Время последней проверки соединения с MQTT брокером
         unsigned long lastCheckTime = 0;
         
+        // Номер последней публикации данных
+        uint32_t dataSequence = 0;
+
         bool isConnecting = false;
         bool isConnected = false;
         bool isInitialized = false;
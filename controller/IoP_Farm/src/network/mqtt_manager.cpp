@@ -1,6 +1,7 @@
 #include "network/mqtt_manager.h"
 #include "logic/actuators_manager.h"
 #include <WiFi.h>
+#include <GyverNTP.h>
 
 namespace farm::net
 {
@@ -520,7 +521,19 @@ namespace farm::net
         
         String dataTopic = getMqttTopic(ConfigType::Data);
         
-        String jsonData = configManager->getConfigJson(ConfigType::Data);
+        JsonDocument dataDoc;
+        deserializeJson(dataDoc, configManager->getConfigJson(ConfigType::Data));
+        
+        // Время снятия и номер публикации: повтор retained-сообщения после переподключения
+        // сервер узнаёт по ним. Без NTP время не передаётся, сервер ставит своё.
+        if (NTP.online())
+        {
+            dataDoc[DATA_TIMESTAMP_KEY] = NTP.getUnix();
+        }
+        dataDoc[DATA_SEQUENCE_KEY] = ++dataSequence;
+        
+        String jsonData;
+        serializeJson(dataDoc, jsonData);
         
         // Публикуем данные (QoS=1, retain=true)
         uint16_t packetId = mqttClient.publish(dataTopic.c_str(), qos, retain, jsonData.c_str());
@@ -0,0 +1,10 @@
+g++ -std=c++17 -O2 -o INGEST_BENCH ingest_bench.cpp     -lsqlite3    -lpthread
+g++ -std=c++17 -O2 -pthread -o PHONE_LOAD phone_load.cpp -I/usr/include/boost -lboost_system -llz4 -lzstd
+g++ -std=c++17 -O2 -o QUERY_BENCH query_bench.cpp     -lsqlite3    -lpthread
+g++ -std=c++17 -O2 -o WIRE_BENCH wire_bench.cpp      -lsqlite3    -llz4 -lzstd
+g++ -std=c++17 -O2 -pthread -o PUSH_BENCH push_bench.cpp -I/usr/include/boost -lboost_system
+g++ -std=c++17 -O2 -o JSON_BENCH json_bench.cpp      -lsqlite3
+g++ -std=c++17 -O2 -pthread -o PUBLISH_BENCH publish_bench.cpp -I/usr/include/boost -lboost_system -lpaho-mqttpp3 -lpaho-mqtt3as
+g++ -std=c++17 -O2 -pthread -o FARM_LOAD farm_load.cpp -I/usr/include/boost -lboost_system -llz4 -lzstd -lpaho-mqttpp3 -lpaho-mqtt3as
+g++ -std=c++17 -O2 -o PARSE_BENCH parse_bench.cpp     -lsqlite3    -lpthread
+g++ -std=c++17 -O2 -pthread -o RECORD_CHECK record_check.cpp -I/usr/include/boost -lboost_system -lsqlite3 -llz4 -lzstd
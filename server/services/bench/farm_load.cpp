@@ -0,0 +1,547 @@
+// Сквозная нагрузка на весь сервер на одной машине: farms контроллеров публикуют в локальный
+// брокер /farmNNN/data (JSON как у прошивки, с "timestamp" и "seq") и /farmNNN/log (пачки до
+// 50 строк "[LEVEL] [MODULE] ...") с заданной частотой, а phones телефонов в это время
+// без пауз (или с --think-ms) шлют запросы вперемешку: история на 1488 (сутки v1, неделя с
+// max_points, сутки v2-zstd), конфиги на 1489 и команды на 1490.
+// Печатает по каждому виду запросов число, ошибки, запросов в секунду и p50/p99/max
+// задержки со стороны клиента; для MQTT - задержку до PUBACK. Если запущены data.service и
+// farm_logger, из их /metrics (common/metrics.h) берутся строки/с записи, задержка устройство ->
+// коммит и время записи пачки в SQLite.
+//
+//   ./FARM_LOAD [--farms 20] [--data-rate 1] [--log-rate 0.2] [--phones 16] [--think-ms 0]
+//               [--duration 30] [--mix history_v1=40,history_points=20,history_v2=20,config=10,command=10]
+//               [--broker tcp://localhost:1883] [--host 127.0.0.1] [--save file] [--baseline file] [--tolerance 20]
+//
+// Частоты - сообщений в секунду на ферму. --save пишет итог (вид, в секунду, p99) в файл,
+// --baseline сравнивает с ним: падение частоты или рост p99 больше чем на tolerance %
+// (p99 - плюс 1 мс на шум) или любые ошибки - код возврата 1. Так прогон служит проверкой
+// перед выкладкой.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <map>
+#include <memory>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <mqtt/async_client.h>
+#include <nlohmann/json.hpp>
+#include "../common/latency_histogram.h"
+#include "phone_client.h"
+
+namespace asio = boost::asio;
+using boost::asio::ip::tcp;
+using json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+const int DATA_METRICS_PORT = 9100;    // Как в data.cpp
+const int LOGGER_METRICS_PORT = 9101;  // Как в farm_logger/logger.cpp
+const int MAX_LOG_LINES = 50;          // MAX_PACKET_SIZE прошивки
+const std::chrono::seconds DRAIN_TIMEOUT{5};
+const double P99_SLACK_US = 1000;
+
+struct Result {
+    std::atomic<uint64_t> ok{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> records{0};
+    LatencyHistogram latency;
+};
+
+struct Summary {
+    double rate;
+    double p99_us;
+    uint64_t errors;
+};
+
+struct Options {
+    size_t farms = 20;
+    double data_rate = 1;
+    double log_rate = 0.2;
+    size_t phones = 16;
+    int think_ms = 0;
+    int duration = 30;
+    std::string mix = "history_v1=40,history_points=20,history_v2=20,config=10,command=10";
+    std::string broker = "tcp://localhost:1883";
+    std::string host = "127.0.0.1";
+    std::string save;
+    std::string baseline;
+    double tolerance = 20;
+};
+
+std::string farm_id(size_t index) {
+    char id[32];
+    std::snprintf(id, sizeof(id), "farm%03zu", index + 1);
+    return id;
+}
+
+int64_t unix_now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Контроллеры: своё соединение с брокером у каждой фермы, публикации из одного потока
+class FarmSimulator {
+    class Ack : public virtual mqtt::iaction_listener {
+        Result& result;
+        std::atomic<size_t>& in_flight;
+        bench_clock::time_point started;
+
+    public:
+        Ack(Result& r, std::atomic<size_t>& pending) : result(r), in_flight(pending), started(bench_clock::now()) {}
+
+        void on_success(const mqtt::token&) override {
+            result.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - started));
+            ++result.ok;
+            --in_flight;
+            delete this;
+        }
+
+        void on_failure(const mqtt::token&) override {
+            ++result.errors;
+            --in_flight;
+            delete this;
+        }
+    };
+
+    struct Farm {
+        std::string id;
+        std::unique_ptr<mqtt::async_client> client;
+        int64_t sequence;
+        bench_clock::time_point next_data;
+        bench_clock::time_point next_log;
+    };
+
+    std::vector<Farm> farms;
+    std::atomic<size_t> in_flight{0};
+    std::mt19937 random{42};
+
+    void publish(Farm& farm, const std::string& suffix, const std::string& payload, Result& result) {
+        auto msg = mqtt::make_message("/" + farm.id + suffix, payload);
+        msg->set_qos(1);
+        ++in_flight;
+        Ack* ack = new Ack(result, in_flight);
+        try {
+            farm.client->publish(msg, nullptr, *ack);
+        }
+        catch(const std::exception&) {
+            ++result.errors;
+            --in_flight;
+            delete ack;
+        }
+    }
+
+    std::string data_payload(Farm& farm) {
+        std::uniform_real_distribution<double> value(10, 90);
+        json j;
+        j["temperature_DHT22"] = value(random) / 3;
+        j["temperature_DS18B20"] = value(random) / 3;
+        j["humidity"] = value(random);
+        j["water_level"] = value(random);
+        j["soil_moisture"] = value(random);
+        j["light_intensity"] = value(random) * 10;
+        j["timestamp"] = unix_now();
+        j["seq"] = farm.sequence++;
+        return j.dump();
+    }
+
+    std::string log_payload() {
+        static const char* levels[] = {"[INFO]  ", "[DEBUG] ", "[FARM]  ", "[WARN]  ", "[ERROR] "};
+        static const char* modules[] = {"[MQTT] ", "[WiFi] ", "[Config] ", "[ActuatorsManager] ", "[pump] "};
+        int lines = std::uniform_int_distribution<int>(1, MAX_LOG_LINES)(random);
+        std::string payload;
+        for(int i = 0; i < lines; ++i) {
+            unsigned roll = random() % 100;
+            payload += levels[roll < 60 ? 0 : roll < 85 ? 1 : roll < 95 ? 2 : roll < 99 ? 3 : 4];
+            payload += modules[random() % 5];
+            payload += "heap=" + std::to_string(random() % 200000) + " rssi=-" + std::to_string(40 + random() % 50) + "\n";
+        }
+        return payload;
+    }
+
+    static bench_clock::duration period(double rate) {
+        return std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    }
+
+    // Частота 0 - никогда
+    bench_clock::duration first_offset(double rate) {
+        if(rate <= 0) {
+            return std::chrono::hours(24 * 365);
+        }
+        return period(rate) * static_cast<int>(random() % 1000) / 1000;
+    }
+
+public:
+    Result data;
+    Result logs;
+
+    FarmSimulator(const std::string& broker, size_t count) {
+        // Номер публикации от времени запуска: повторный прогон не даёт дублей
+        int64_t first_sequence = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        for(size_t i = 0; i < count; ++i) {
+            Farm farm;
+            farm.id = farm_id(i);
+            farm.client = std::make_unique<mqtt::async_client>(broker, "farm_load_" + farm.id);
+            auto options = mqtt::connect_options_builder()
+                .clean_session(true)
+                .max_inflight(1000)
+                .finalize();
+            farm.client->connect(options)->wait();
+            farm.sequence = first_sequence;
+            farms.push_back(std::move(farm));
+        }
+    }
+
+    // Фермы стартуют вразброс по периоду, как реальные контроллеры
+    void run(double data_rate, double log_rate, const std::atomic<bool>& stop) {
+        auto now = bench_clock::now();
+        for(auto& farm : farms) {
+            farm.next_data = now + first_offset(data_rate);
+            farm.next_log = now + first_offset(log_rate);
+        }
+        while(!stop) {
+            now = bench_clock::now();
+            for(auto& farm : farms) {
+                while(farm.next_data <= now) {
+                    publish(farm, "/data", data_payload(farm), data);
+                    farm.next_data += period(data_rate);
+                }
+                while(farm.next_log <= now) {
+                    publish(farm, "/log", log_payload(), logs);
+                    farm.next_log += period(log_rate);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // Дождаться PUBACK уже отправленных
+    void drain() {
+        auto deadline = bench_clock::now() + DRAIN_TIMEOUT;
+        while(in_flight > 0 && bench_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        for(auto& farm : farms) {
+            try {
+                farm.client->disconnect()->wait();
+            }
+            catch(const std::exception&) {
+            }
+        }
+    }
+};
+
+// Телефоны: запрос - соединение, как у приложения
+class PhoneSimulator {
+public:
+    struct Kind {
+        std::string name;
+        int port;
+        unsigned weight;
+        Result result;
+    };
+
+    std::vector<std::unique_ptr<Kind>> kinds;
+
+    explicit PhoneSimulator(const std::string& mix) {
+        std::map<std::string, int> ports = {{"history_v1", 1488}, {"history_points", 1488}, {"history_v2", 1488},
+                                            {"config", 1489}, {"command", 1490}};
+        std::stringstream parts(mix);
+        std::string part;
+        while(std::getline(parts, part, ',')) {
+            size_t eq = part.find('=');
+            std::string name = part.substr(0, eq);
+            if(!ports.count(name) || eq == std::string::npos) {
+                throw std::runtime_error("Unknown mix entry: " + part);
+            }
+            auto kind = std::make_unique<Kind>();
+            kind->name = name;
+            kind->port = ports[name];
+            kind->weight = static_cast<unsigned>(std::stoul(part.substr(eq + 1)));
+            if(kind->weight > 0) {
+                kinds.push_back(std::move(kind));
+            }
+        }
+        if(kinds.empty()) {
+            throw std::runtime_error("Empty request mix");
+        }
+    }
+
+    void run(const std::string& host, size_t farms, int think_ms, unsigned seed, const std::atomic<bool>& stop) {
+        asio::io_context io;
+        tcp::resolver resolver(io);
+        std::map<int, tcp::resolver::results_type> endpoints;
+        for(const auto& kind : kinds) {
+            endpoints[kind->port] = resolver.resolve(host, std::to_string(kind->port));
+        }
+        unsigned total_weight = 0;
+        for(const auto& kind : kinds) {
+            total_weight += kind->weight;
+        }
+        std::mt19937 random(seed);
+        std::vector<char> body;
+        while(!stop) {
+            unsigned roll = random() % total_weight;
+            Kind* kind = kinds.front().get();
+            for(const auto& k : kinds) {
+                if(roll < k->weight) {
+                    kind = k.get();
+                    break;
+                }
+                roll -= k->weight;
+            }
+            int64_t now = unix_now();
+            json j;
+            if(kind->port == 1488) {
+                j["device_id"] = farm_id(random() % farms);
+                j["unix_time_from"] = now - (kind->name == "history_points" ? 7 * 86400 : 86400);
+                j["unix_time_to"] = now;
+                if(kind->name == "history_points") {
+                    j["max_points"] = 500;
+                    j["mode"] = "lttb";
+                }
+                if(kind->name == "history_v2") {
+                    j["format"] = 2;
+                    j["compression"] = "zstd";
+                }
+            }
+            else if(kind->port == 1489) {
+                j["target_humidity"] = 40 + random() % 30;
+            }
+            else {
+                j["pump"] = random() % 2;
+            }
+            std::string request = j.dump() + "\n";
+            auto started = bench_clock::now();
+            try {
+                if(kind->port == 1488) {
+                    kind->result.records += kind->name == "history_v2" ? request_v2(io, endpoints[1488], request, body)
+                                                                       : request_once(io, endpoints[1488], request, body);
+                }
+                else {
+                    json reply = json::parse(request_line(io, endpoints[kind->port], request));
+                    if(reply.value("status", "") != "delivered") {
+                        throw std::runtime_error("Publish " + reply.value("status", "?"));
+                    }
+                }
+                kind->result.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    bench_clock::now() - started));
+                ++kind->result.ok;
+            }
+            catch(const std::exception&) {
+                ++kind->result.errors;
+            }
+            if(think_ms > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(think_ms));
+            }
+        }
+    }
+};
+
+// /metrics сервиса: имя с метками -> значение; пусто, если сервис не отвечает
+std::map<std::string, double> scrape(const std::string& host, int port) {
+    std::map<std::string, double> values;
+    try {
+        asio::io_context io;
+        tcp::socket socket(io);
+        tcp::resolver resolver(io);
+        asio::connect(socket, resolver.resolve(host, std::to_string(port)));
+        std::string request = "GET /metrics HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+        asio::write(socket, asio::buffer(request));
+        asio::streambuf response;
+        boost::system::error_code ec;
+        asio::read(socket, response, ec);
+        std::istream is(&response);
+        std::string line;
+        while(std::getline(is, line)) {
+            if(line.empty() || line[0] == '#' || line.compare(0, 4, "iop_") != 0) {
+                continue;
+            }
+            size_t space = line.rfind(' ');
+            values[line.substr(0, space)] = std::stod(line.substr(space + 1));
+        }
+    }
+    catch(const std::exception&) {
+        values.clear();
+    }
+    return values;
+}
+
+// Сумма по всем меткам (шардам) разницы счётчика между двумя опросами
+double delta(const std::map<std::string, double>& before, const std::map<std::string, double>& after,
+             const std::string& name) {
+    double sum = 0;
+    for(const auto& entry : after) {
+        if(entry.first == name || entry.first.compare(0, name.size() + 1, name + "{") == 0) {
+            auto old = before.find(entry.first);
+            sum += entry.second - (old == before.end() ? 0 : old->second);
+        }
+    }
+    return sum;
+}
+
+// Перцентиль гистограммы за время прогона по корзинам le всех шардов, в микросекундах
+double histogram_percentile(const std::map<std::string, double>& before, const std::map<std::string, double>& after,
+                            const std::string& name, double q) {
+    std::map<double, double> buckets;
+    std::string prefix = name + "_bucket{";
+    for(const auto& entry : after) {
+        if(entry.first.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        size_t le = entry.first.find("le=\"");
+        std::string bound = entry.first.substr(le + 4, entry.first.find('"', le + 4) - le - 4);
+        auto old = before.find(entry.first);
+        buckets[bound == "+Inf" ? 1e300 : std::stod(bound)] += entry.second - (old == before.end() ? 0 : old->second);
+    }
+    if(buckets.empty() || buckets.rbegin()->second <= 0) {
+        return 0;
+    }
+    double rank = q * buckets.rbegin()->second;
+    for(const auto& bucket : buckets) {
+        if(bucket.second >= rank) {
+            return bucket.first * 1e6;
+        }
+    }
+    return 0;
+}
+
+Summary report(const std::string& name, const Result& result, double seconds) {
+    auto s = result.latency.snapshot();
+    Summary summary{result.ok / seconds, static_cast<double>(s.p99_us), result.errors.load()};
+    std::cout << "  " << name << " ok=" << result.ok << " errors=" << result.errors
+              << " per_sec=" << static_cast<uint64_t>(summary.rate)
+              << " p50_us=" << s.p50_us << " p99_us=" << s.p99_us << " max_us=" << s.max_us;
+    if(result.records) {
+        std::cout << " records=" << result.records;
+    }
+    std::cout << std::endl;
+    return summary;
+}
+
+bool check_baseline(const std::string& path, const std::map<std::string, Summary>& results, double tolerance) {
+    std::ifstream in(path);
+    if(!in) {
+        throw std::runtime_error("Cannot read baseline " + path);
+    }
+    bool passed = true;
+    std::string name;
+    double rate, p99;
+    while(in >> name >> rate >> p99) {
+        auto it = results.find(name);
+        if(it == results.end()) {
+            continue;
+        }
+        if(it->second.rate < rate * (1 - tolerance / 100)) {
+            std::cout << "REGRESSION " << name << ": " << it->second.rate << "/s, baseline " << rate << "/s" << std::endl;
+            passed = false;
+        }
+        if(it->second.p99_us > p99 * (1 + tolerance / 100) + P99_SLACK_US) {
+            std::cout << "REGRESSION " << name << ": p99 " << it->second.p99_us << " us, baseline " << p99 << " us" << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    Options o;
+    try {
+        for(int i = 1; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            std::string value = argv[i + 1];
+            if(arg == "--farms") o.farms = std::stoul(value);
+            else if(arg == "--data-rate") o.data_rate = std::stod(value);
+            else if(arg == "--log-rate") o.log_rate = std::stod(value);
+            else if(arg == "--phones") o.phones = std::stoul(value);
+            else if(arg == "--think-ms") o.think_ms = std::stoi(value);
+            else if(arg == "--duration") o.duration = std::stoi(value);
+            else if(arg == "--mix") o.mix = value;
+            else if(arg == "--broker") o.broker = value;
+            else if(arg == "--host") o.host = value;
+            else if(arg == "--save") o.save = value;
+            else if(arg == "--baseline") o.baseline = value;
+            else if(arg == "--tolerance") o.tolerance = std::stod(value);
+            else throw std::runtime_error("Unknown option: " + arg);
+        }
+        if(argc % 2 == 0) {
+            throw std::runtime_error(std::string("Missing value for ") + argv[argc - 1]);
+        }
+
+        std::cout << "Farms: " << o.farms << " (data " << o.data_rate << "/s, log " << o.log_rate
+                  << "/s each), phones: " << o.phones << ", " << o.duration << " s" << std::endl;
+        FarmSimulator farms(o.broker, o.farms);
+        PhoneSimulator phones(o.mix);
+        auto data_before = scrape(o.host, DATA_METRICS_PORT);
+        auto logger_before = scrape(o.host, LOGGER_METRICS_PORT);
+
+        std::atomic<bool> stop{false};
+        auto started = bench_clock::now();
+        std::vector<std::thread> threads;
+        threads.emplace_back([&]() { farms.run(o.data_rate, o.log_rate, stop); });
+        for(size_t i = 0; i < o.phones; ++i) {
+            threads.emplace_back([&, i]() { phones.run(o.host, o.farms, o.think_ms, static_cast<unsigned>(i + 1), stop); });
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(o.duration));
+        stop = true;
+        for(auto& t : threads) {
+            t.join();
+        }
+        double seconds = std::chrono::duration<double>(bench_clock::now() - started).count();
+        farms.drain();
+        // Писатели сервисов дописывают пачки не сразу
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto data_after = scrape(o.host, DATA_METRICS_PORT);
+        auto logger_after = scrape(o.host, LOGGER_METRICS_PORT);
+
+        std::map<std::string, Summary> results;
+        std::cout << "MQTT (to PUBACK):" << std::endl;
+        results["mqtt_data"] = report("mqtt_data", farms.data, seconds);
+        results["mqtt_log"] = report("mqtt_log", farms.logs, seconds);
+        std::cout << "Phones:" << std::endl;
+        for(const auto& kind : phones.kinds) {
+            results[kind->name] = report(kind->name + ":" + std::to_string(kind->port), kind->result, seconds);
+        }
+        if(!data_after.empty()) {
+            double rows = delta(data_before, data_after, "iop_ingest_committed_rows_total");
+            std::cout << "  ingest rows=" << rows << " per_sec=" << static_cast<uint64_t>(rows / seconds)
+                      << " dropped=" << delta(data_before, data_after, "iop_ingest_dropped_total")
+                      << " lag_p50_us<=" << static_cast<uint64_t>(histogram_percentile(data_before, data_after, "iop_ingest_lag_seconds", 0.5))
+                      << " lag_p99_us<=" << static_cast<uint64_t>(histogram_percentile(data_before, data_after, "iop_ingest_lag_seconds", 0.99))
+                      << " commit_p99_us<=" << static_cast<uint64_t>(histogram_percentile(data_before, data_after, "iop_sqlite_batch_commit_seconds", 0.99))
+                      << std::endl;
+            results["ingest"] = {rows / seconds, histogram_percentile(data_before, data_after, "iop_ingest_lag_seconds", 0.99), 0};
+        }
+        if(!logger_after.empty()) {
+            double records = delta(logger_before, logger_after, "iop_log_records_total");
+            std::cout << "  log_store records=" << records << " per_sec=" << static_cast<uint64_t>(records / seconds) << std::endl;
+        }
+
+        if(!o.save.empty()) {
+            std::ofstream out(o.save);
+            for(const auto& r : results) {
+                out << r.first << " " << r.second.rate << " " << r.second.p99_us << "\n";
+            }
+        }
+        uint64_t errors = 0;
+        for(const auto& r : results) {
+            errors += r.second.errors;
+        }
+        bool passed = errors == 0;
+        if(!o.baseline.empty()) {
+            passed = check_baseline(o.baseline, results, o.tolerance) && passed;
+        }
+        std::cout << (passed ? "PASSED" : "FAILED") << " errors=" << errors << std::endl;
+        return passed ? 0 : 1;
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,154 @@
+// Пропускная способность записи показаний (строк/с): старый путь
+// "prepare + autocommit на каждое сообщение" против IngestPipeline.
+// Вместо брокера - поток, который, как колбэк Paho, по очереди отдаёт JSON-сообщения.
+//
+// Конвейер гоняется и в мультиферменном режиме: показания farms устройств
+// раскладываются по шардам (свой файл и поток-писатель на шард), а в конце -
+// повтор тех же показаний, который должен отсекаться как дубликаты.
+//
+//   ./INGEST_BENCH [rows] [db_dir]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <sqlite3.h>
+#include <nlohmann/json.hpp>
+#include "../common/ingest_pipeline.h"
+
+using json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+int64_t now_unix() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::vector<std::string> make_payloads(size_t count) {
+    std::vector<std::string> payloads;
+    payloads.reserve(count);
+    for(size_t i = 0; i < count; ++i) {
+        json j;
+        j["temperature_DHT22"] = 20.0 + (i % 100) * 0.1;
+        j["temperature_DS18B20"] = 18.0 + (i % 70) * 0.1;
+        j["humidity"] = 40.0 + (i % 300) * 0.1;
+        j["water_level"] = 75.0 - (i % 50);
+        j["soil_moisture"] = 33.0 + (i % 20);
+        j["light_intensity"] = 500.0 + (i % 400);
+        j["timestamp"] = 1700000000 + static_cast<int64_t>(i);
+        j["seq"] = i;
+        payloads.push_back(j.dump());
+    }
+    return payloads;
+}
+
+// Повторяет прежний MQTTListener::message_arrived
+double run_legacy(const std::string& path, const std::vector<std::string>& payloads) {
+    sqlite3* db;
+    if(sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        throw std::runtime_error(sqlite3_errmsg(db));
+    }
+    exec_sql(db,
+        "CREATE TABLE IF NOT EXISTS sensor_data ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, timestamp_unix INTEGER,"
+        "temperature_DHT22 REAL, temperature_DS18B20 REAL, humidity REAL,"
+        "water_level REAL, soil_moisture REAL, light_intensity REAL);");
+
+    auto start = bench_clock::now();
+    int64_t received_at = now_unix();
+    for(const auto& payload : payloads) {
+        int64_t sequence;
+        std::string extra;
+        SensorData row = parse_sensor_payload(payload, received_at, sequence, extra);
+        sqlite3_stmt* stmt;
+        const char* sql = "INSERT INTO sensor_data (timestamp_unix, "
+            "temperature_DHT22, temperature_DS18B20, humidity, "
+            "water_level, soil_moisture, light_intensity) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?);";
+        if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+        sqlite3_bind_int64(stmt, 1, row.timestamp_unix);
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            sqlite3_bind_double(stmt, static_cast<int>(i) + 2, sensor_field(row, i));
+        }
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    sqlite3_close(db);
+    return payloads.size() / elapsed.count();
+}
+
+void remove_db(const std::string& path) {
+    for(int month : list_partitions(path)) {
+        drop_partition(partition_path(path, month));
+    }
+    drop_partition(path);
+}
+
+// fresh = false: те же показания повторно, как retained-сообщения после переподключения
+double run_pipeline(const std::string& path, const std::vector<std::string>& payloads,
+                    const IngestOptions& options, size_t shards, size_t farms, bool fresh = true) {
+    for(size_t i = 0; fresh && i < shards; ++i) {
+        remove_db(shard_db_path(path, i));
+    }
+    std::vector<std::string> devices;
+    for(size_t i = 0; i < farms; ++i) {
+        devices.push_back("farm" + std::to_string(1000 + i));
+    }
+
+    DeviceDirectory directory(path, shards);
+    ShardedIngest ingest(path, directory, options);
+    auto start = bench_clock::now();
+    int64_t received_at = now_unix();
+    for(size_t i = 0; i < payloads.size(); ++i) {
+        int64_t sequence;
+        std::string extra;
+        SensorData row = parse_sensor_payload(payloads[i], received_at, sequence, extra);
+        ingest.submit(devices[i % farms], row, sequence, received_at, std::move(extra));
+    }
+    ingest.stop();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    IngestStats stats = ingest.stats();
+    std::cout << "    " << stats << std::endl;
+    return (stats.committed_rows + stats.duplicates) / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t rows = argc > 1 ? std::stoul(argv[1]) : 20000;
+    std::string dir = argc > 2 ? argv[2] : "/tmp";
+
+    auto payloads = make_payloads(rows);
+    std::cout << "Rows per run: " << rows << std::endl;
+
+    std::string legacy_path = dir + "/ingest_bench_legacy.db";
+    std::remove(legacy_path.c_str());
+    // Старый путь медленный (fsync на строку), поэтому гоняем его на части данных
+    std::vector<std::string> legacy_payloads(payloads.begin(),
+        payloads.begin() + std::min<size_t>(rows, 2000));
+    std::cout << "legacy (autocommit, " << legacy_payloads.size() << " rows): "
+              << run_legacy(legacy_path, legacy_payloads) << " rows/s" << std::endl;
+
+    std::string path = dir + "/ingest_bench_pipeline.db";
+    for(size_t batch_rows : {64, 512, 4096}) {
+        IngestOptions options;
+        options.batch_rows = batch_rows;
+        std::cout << "pipeline (batch " << batch_rows << ", 1 shard, 1 farm):" << std::endl;
+        double rate = run_pipeline(path, payloads, options, 1, 1);
+        std::cout << "    " << rate << " rows/s" << std::endl;
+    }
+
+    for(size_t shards : {1, 4}) {
+        std::cout << "pipeline (batch 512, " << shards << " shards, 200 farms):" << std::endl;
+        double rate = run_pipeline(path, payloads, IngestOptions{}, shards, 200);
+        std::cout << "    " << rate << " rows/s" << std::endl;
+    }
+
+    // Все показания уже в базе: каждое стоит поиска по уникальному индексу, без записи строки
+    std::cout << "pipeline replay of the same readings (batch 512, 4 shards, 200 farms):" << std::endl;
+    double rate = run_pipeline(path, payloads, IngestOptions{}, 4, 200, false);
+    std::cout << "    " << rate << " rows/s" << std::endl;
+    return 0;
+}
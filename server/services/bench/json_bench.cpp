@@ -0,0 +1,149 @@
+// Ответ reserve_logs.cpp в JSON: прежний путь (nlohmann::json на каждую запись, массив,
+// обёртка и dump() в строку) против потоковой записи common/json_stream.h в буфер.
+// Показания берутся из sensor_data реальной базы или генерируются; вывод обоих путей
+// сравнивается побайтно.
+//
+//   ./JSON_BENCH [rows] [data.db]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <limits>
+#include <sqlite3.h>
+#include <nlohmann/json.hpp>
+#include "../common/sensor_data.h"
+#include "../common/json_stream.h"
+
+using json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+std::vector<SensorData> load_rows(const std::string& path, size_t limit) {
+    std::vector<SensorData> rows;
+    sqlite3* db;
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT timestamp_unix, temperature_DHT22, temperature_DS18B20, humidity, "
+                      "water_level, soil_moisture, light_intensity FROM sensor_data "
+                      "ORDER BY timestamp_unix LIMIT ?;";
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        throw std::runtime_error(std::string("Cannot read sensor_data: ") + sqlite3_errmsg(db));
+    }
+    sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(limit));
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        SensorData row{};
+        row.timestamp_unix = sqlite3_column_int64(stmt, 0);
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            set_sensor_field(row, i, sqlite3_column_double(stmt, static_cast<int>(i) + 1));
+        }
+        rows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return rows;
+}
+
+// Как у фермы, плюс несколько значений на краях форматирования чисел
+std::vector<SensorData> make_rows(size_t count) {
+    std::vector<SensorData> rows(count);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> jitter(-1, 1);
+    std::uniform_int_distribution<int> adc(0, 4095);
+    std::uniform_real_distribution<double> any(-1e6, 1e6);
+    int64_t ts = 1746000000;
+    for(size_t i = 0; i < count; ++i) {
+        ts += 10 + jitter(rng);
+        double phase = static_cast<double>(i) / 8640 * 2 * M_PI;
+        rows[i].timestamp_unix = ts;
+        rows[i].temperature_DHT22 = std::round((24 + 3 * std::sin(phase)) * 10) / 10;
+        rows[i].temperature_DS18B20 = std::round((23 + 3 * std::sin(phase)) * 16) / 16;
+        rows[i].humidity = std::round((40 + 10 * std::cos(phase)) * 10) / 10;
+        rows[i].water_level = adc(rng) * 0.0412;
+        rows[i].soil_moisture = std::round(60 - 20 * std::sin(phase / 7));
+        rows[i].light_intensity = i % 100 == 0 ? any(rng) : adc(rng) * 0.018315;
+    }
+    const double edges[] = {0.0, -0.0, 1e-5, 1.5e-7, 1e15, 1e16, 123456789012345678.0, -3.25,
+                            std::numeric_limits<double>::min(), std::numeric_limits<double>::max(),
+                            std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity()};
+    for(size_t i = 0; i < std::size(edges) && i < count; ++i) {
+        rows[i].water_level = edges[i];
+    }
+    return rows;
+}
+
+// Прежний reserve_logs.cpp: get_data + send_json_data
+std::string dump_dom(const std::vector<SensorData>& rows) {
+    json result = json::array();
+    for(const auto& row : rows) {
+        json record;
+        record["timestamp"] = row.timestamp_unix;
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            record[SENSOR_FIELDS[i]] = sensor_field(row, i);
+        }
+        result.push_back(record);
+    }
+    json response;
+    response["count"] = result.size();
+    response["data"] = result;
+    return response.dump() + "\n";
+}
+
+template <typename F>
+double ns_per_row(size_t rows, int repeats, F&& body) {
+    auto begin = bench_clock::now();
+    for(int i = 0; i < repeats; ++i) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - begin;
+    return elapsed.count() / repeats / rows;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::vector<SensorData> rows = argc > 2 ? load_rows(argv[2], count) : make_rows(count);
+    if(rows.empty()) {
+        std::cerr << "No rows" << std::endl;
+        return 1;
+    }
+    const int repeats = 3;
+    std::cout << "Rows: " << rows.size() << (argc > 2 ? " from " + std::string(argv[2]) : " generated") << std::endl;
+
+    std::string before;
+    double dom_ns = ns_per_row(rows.size(), repeats, [&]() { before = dump_dom(rows); });
+
+    // Как в сокет: буфер уходит целиком, здесь - в одну строку для сравнения
+    std::string after;
+    size_t sent = 0;
+    double stream_ns = ns_per_row(rows.size(), repeats, [&]() {
+        after.clear();
+        auto sink = [&after](const char* data, size_t size) { after.append(data, size); };
+        JsonRowStream<decltype(sink)> out(sink);
+        out.begin(rows.size());
+        for(const auto& row : rows) {
+            out.add(row);
+        }
+        out.finish();
+    });
+    double socket_ns = ns_per_row(rows.size(), repeats, [&]() {
+        auto sink = [&sent](const char*, size_t size) { sent += size; };
+        JsonRowStream<decltype(sink)> out(sink);
+        out.begin(rows.size());
+        for(const auto& row : rows) {
+            out.add(row);
+        }
+        out.finish();
+    });
+
+    bool same = before == after;
+    std::cout << "  response   " << before.size() / 1e6 << " MB" << std::endl;
+    std::cout << "  dom+dump   ns/row=" << dom_ns << std::endl;
+    std::cout << "  stream     ns/row=" << stream_ns << " (into one string), " << socket_ns
+              << " (64 KB buffer, as sent to the socket)" << std::endl;
+    std::cout << "  speedup    x" << dom_ns / socket_ns << (same ? ", output identical" : ", OUTPUT DIFFERS") << std::endl;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+// Разбор показаний в data.cpp: прежний путь (nlohmann::json::parse в DOM и поиск шести
+// ключей) против однопроходного сканера common/sensor_parser.h.
+// Сообщения строятся по controller/IoP_Farm/data/data.json так, как их шлёт прошивка
+// ("timestamp", "seq"), часть - с пропавшей метрикой (датчик не ответил) и с лишними
+// ключами. Прежний путь такие показания теряет целиком; на остальных значения обоих
+// путей сверяются побитно.
+//
+//   ./PARSE_BENCH [messages] [data.json]
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <nlohmann/json.hpp>
+#include "../common/ingest_pipeline.h"
+
+using json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+// Прежний parse_sensor_payload
+SensorData parse_dom(const std::string& payload, int64_t received_at, int64_t& sequence) {
+    auto j = json::parse(payload);
+    SensorData row{};
+    row.timestamp_unix = received_at;
+    sequence = -1;
+    auto ts = j.find("timestamp");
+    auto seq = j.find("seq");
+    if(ts != j.end() && ts->is_number_integer() && seq != j.end() && seq->is_number_integer()) {
+        int64_t device_time = ts->get<int64_t>();
+        if(device_time > 0 && device_time <= received_at + MAX_DEVICE_CLOCK_SKEW_SEC) {
+            row.timestamp_unix = device_time;
+            sequence = seq->get<int64_t>();
+        }
+    }
+    for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+        set_sensor_field(row, i, j[SENSOR_FIELDS[i]].get<double>());
+    }
+    return row;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    if(!in) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    return buffer.str();
+}
+
+// Каждое 50-е без одной метрики, каждое 20-е - с лишними ключами
+std::vector<std::string> make_payloads(const json& sample, size_t count) {
+    std::vector<std::string> payloads;
+    payloads.reserve(count);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> adc(0, 4095);
+    std::uniform_int_distribution<int> rssi(-90, -40);
+    int64_t ts = 1746000000;
+    for(size_t i = 0; i < count; ++i) {
+        double phase = static_cast<double>(i) / 8640 * 2 * M_PI;
+        json j = sample;
+        j["temperature_DHT22"] = std::round((24 + 3 * std::sin(phase)) * 10) / 10;
+        j["temperature_DS18B20"] = std::round((23 + 3 * std::sin(phase)) * 16) / 16;
+        j["humidity"] = std::round((40 + 10 * std::cos(phase)) * 10) / 10;
+        j["water_level"] = adc(rng) * 0.0412;
+        j["soil_moisture"] = static_cast<int>(std::round(60 - 20 * std::sin(phase / 7)));
+        j["light_intensity"] = adc(rng) * 0.018315;
+        j["timestamp"] = ts + static_cast<int64_t>(i) * 10;
+        j["seq"] = i;
+        if(i % 50 == 7) {
+            j.erase(SENSOR_FIELDS[i / 50 % SENSOR_FIELDS_COUNT]);
+        }
+        if(i % 20 == 3) {
+            j["rssi"] = rssi(rng);
+            j["fw"] = "1.4.2";
+        }
+        payloads.push_back(j.dump());
+    }
+    return payloads;
+}
+
+bool is_known_key(const std::string& key) {
+    for(const char* field : SENSOR_FIELDS) {
+        if(key == field) {
+            return true;
+        }
+    }
+    return key == "timestamp" || key == "seq";
+}
+
+bool same_bits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+template <typename F>
+double ns_per_message(size_t messages, int repeats, F&& body) {
+    auto begin = bench_clock::now();
+    for(int i = 0; i < repeats; ++i) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - begin;
+    return elapsed.count() / repeats / messages;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    std::string sample_path = argc > 2 ? argv[2] : "../../../controller/IoP_Farm/data/data.json";
+    std::string sample_text = read_file(sample_path);
+    std::vector<std::string> payloads = make_payloads(json::parse(sample_text), count);
+    // Первым - сам файл как есть, с отступами и без времени устройства
+    payloads[0] = sample_text;
+    double bytes = 0;
+    for(const auto& payload : payloads) {
+        bytes += payload.size();
+    }
+    bytes /= payloads.size();
+    const int repeats = 5;
+    const int64_t received_at = 1746000000 + static_cast<int64_t>(count) * 10;
+    std::cout << "Messages: " << payloads.size() << ", " << bytes << " bytes avg, sample "
+              << sample_path << std::endl;
+
+    std::vector<SensorData> dom_rows(payloads.size());
+    std::vector<int64_t> dom_seq(payloads.size());
+    std::vector<char> dom_ok(payloads.size());
+    size_t dom_lost = 0;
+    double dom_ns = ns_per_message(payloads.size(), repeats, [&]() {
+        dom_lost = 0;
+        for(size_t i = 0; i < payloads.size(); ++i) {
+            try {
+                dom_rows[i] = parse_dom(payloads[i], received_at, dom_seq[i]);
+                dom_ok[i] = 1;
+            }
+            catch(const std::exception&) {
+                dom_ok[i] = 0;
+                ++dom_lost;
+            }
+        }
+    });
+
+    std::vector<SensorData> rows(payloads.size());
+    std::vector<int64_t> seq(payloads.size());
+    std::vector<std::string> extra(payloads.size());
+    size_t missing = 0;
+    double scan_ns = ns_per_message(payloads.size(), repeats, [&]() {
+        for(size_t i = 0; i < payloads.size(); ++i) {
+            rows[i] = parse_sensor_payload(payloads[i], received_at, seq[i], extra[i]);
+        }
+    });
+
+    size_t mismatches = 0;
+    size_t with_extra = 0;
+    for(size_t i = 0; i < payloads.size(); ++i) {
+        with_extra += !extra[i].empty();
+        bool row_missing = false;
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            row_missing = row_missing || sensor_missing(sensor_field(rows[i], f));
+        }
+        missing += row_missing;
+        // Лишние ключи сохранены как пришли
+        json payload = json::parse(payloads[i]);
+        json expected = json::object();
+        for(const auto& item : payload.items()) {
+            if(!is_known_key(item.key())) {
+                expected[item.key()] = item.value();
+            }
+        }
+        if((extra[i].empty() ? json::object() : json::parse(extra[i])) != expected) {
+            ++mismatches;
+        }
+        if(!dom_ok[i]) {
+            mismatches += !row_missing;
+            continue;
+        }
+        bool same = rows[i].timestamp_unix == dom_rows[i].timestamp_unix && seq[i] == dom_seq[i];
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            same = same && same_bits(sensor_field(rows[i], f), sensor_field(dom_rows[i], f));
+        }
+        mismatches += !same;
+    }
+
+    std::cout << "  dom        ns/msg=" << dom_ns << ", MB/s=" << bytes / dom_ns * 1e3
+              << ", lost " << dom_lost << " readings" << std::endl;
+    std::cout << "  scan       ns/msg=" << scan_ns << ", MB/s=" << bytes / scan_ns * 1e3
+              << ", " << missing << " readings with NULL metrics, " << with_extra << " with extra keys" << std::endl;
+    std::cout << "  speedup    x" << dom_ns / scan_ns
+              << (mismatches == 0 ? ", values identical" : ", " + std::to_string(mismatches) + " MISMATCHES") << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <boost/asio.hpp>
+#include "../common/wire_format.h"
+
+// Клиент протоколов телефона для нагрузочных программ: один запрос на соединение,
+// ответ дочитывается и проверяется. Возвращают число записей.
+
+const size_t PHONE_RECORD_SIZE = 7 * sizeof(uint64_t);
+
+// Один запрос; возвращает число записей в ответе
+inline size_t request_once(boost::asio::io_context& io, const boost::asio::ip::tcp::resolver::results_type& endpoints,
+                           const std::string& request, std::vector<char>& body) {
+    boost::asio::ip::tcp::socket socket(io);
+    boost::asio::connect(socket, endpoints);
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    uint32_t count;
+    boost::asio::read(socket, boost::asio::buffer(&count, sizeof(count)));
+    count = ntohl(count);
+    body.resize(count * PHONE_RECORD_SIZE);
+    if(!body.empty()) {
+        boost::asio::read(socket, boost::asio::buffer(body));
+    }
+    return count;
+}
+
+// Ответ без счётчика впереди: записи читаются, пока не встретится метка конца
+inline size_t request_stream(boost::asio::io_context& io, const boost::asio::ip::tcp::resolver::results_type& endpoints,
+                             const std::string& request, std::vector<char>& body) {
+    boost::asio::ip::tcp::socket socket(io);
+    boost::asio::connect(socket, endpoints);
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    const uint64_t end_marker = ~0ull;
+    const size_t trailer_size = sizeof(uint64_t) + sizeof(uint32_t);
+    body.resize(64 * 1024);
+    size_t pending = 0;
+    size_t records = 0;
+    while(true) {
+        size_t pos = 0;
+        while(pending - pos >= sizeof(uint64_t)) {
+            if(std::memcmp(body.data() + pos, &end_marker, sizeof(uint64_t)) == 0) {
+                if(pending - pos < trailer_size) {
+                    break;
+                }
+                uint32_t count;
+                std::memcpy(&count, body.data() + pos + sizeof(uint64_t), sizeof(count));
+                if(ntohl(count) != records) {
+                    throw std::runtime_error("Trailer count mismatch");
+                }
+                return records;
+            }
+            if(pending - pos < PHONE_RECORD_SIZE) {
+                break;
+            }
+            pos += PHONE_RECORD_SIZE;
+            ++records;
+        }
+        std::memmove(body.data(), body.data() + pos, pending - pos);
+        pending -= pos;
+        pending += socket.read_some(boost::asio::buffer(body.data() + pending, body.size() - pending));
+    }
+}
+
+// Ответ формата 2: заголовок, кадры до нулевого raw_size, затем число показаний
+inline size_t request_v2(boost::asio::io_context& io, const boost::asio::ip::tcp::resolver::results_type& endpoints,
+                         const std::string& request, std::vector<char>& body) {
+    boost::asio::ip::tcp::socket socket(io);
+    boost::asio::connect(socket, endpoints);
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    uint8_t header[WIRE_HEADER_SIZE];
+    boost::asio::read(socket, boost::asio::buffer(header));
+    if(std::memcmp(header, WIRE_MAGIC, sizeof(WIRE_MAGIC)) != 0 || header[sizeof(WIRE_MAGIC)] != WIRE_VERSION) {
+        throw std::runtime_error("Not a format 2 response");
+    }
+    WireDecoder decoder;
+    std::vector<SensorData> rows;
+    size_t records = 0;
+    while(true) {
+        uint8_t frame[WIRE_FRAME_HEADER];
+        boost::asio::read(socket, boost::asio::buffer(frame, sizeof(uint32_t)));
+        uint32_t raw_size = get_uint32(frame);
+        if(raw_size == 0) {
+            break;
+        }
+        boost::asio::read(socket, boost::asio::buffer(frame + sizeof(uint32_t), WIRE_FRAME_HEADER - sizeof(uint32_t)));
+        uint32_t stored_size = get_uint32(frame + sizeof(uint32_t));
+        body.resize(stored_size);
+        boost::asio::read(socket, boost::asio::buffer(body));
+        rows.clear();
+        decoder.decode(reinterpret_cast<const uint8_t*>(body.data()), stored_size, raw_size,
+                       static_cast<WireCodec>(frame[2 * sizeof(uint32_t)]), rows);
+        records += rows.size();
+    }
+    uint8_t trailer[sizeof(uint32_t)];
+    boost::asio::read(socket, boost::asio::buffer(trailer));
+    if(get_uint32(trailer) != records) {
+        throw std::runtime_error("Trailer count mismatch");
+    }
+    return records;
+}
+
+// Команда или конфиг (1489/1490): строка JSON, ответ - строка JSON со "status"
+inline std::string request_line(boost::asio::io_context& io, const boost::asio::ip::tcp::resolver::results_type& endpoints,
+                                const std::string& request) {
+    boost::asio::ip::tcp::socket socket(io);
+    boost::asio::connect(socket, endpoints);
+    boost::asio::write(socket, boost::asio::buffer(request));
+    boost::asio::streambuf reply;
+    boost::asio::read_until(socket, reply, '\n');
+    std::string line(boost::asio::buffers_begin(reply.data()), boost::asio::buffers_begin(reply.data()) + reply.size());
+    return line.substr(0, line.find('\n'));
+}
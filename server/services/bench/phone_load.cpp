@@ -0,0 +1,101 @@
+// Нагрузка на logs_to_phone как от множества телефонов: clients потоков, каждый
+// requests раз подключается, отправляет JSON-запрос диапазона и дочитывает ответ
+// (uint32 count + count * 56 байт; с stream - записи до метки конца и count после неё;
+// v2, v2-lz4, v2-zstd - кадры формата 2 с проверкой итогового числа).
+// Печатает пропускную способность и p50/p99/max задержки со стороны клиента, а также число ошибок.
+//
+//   ./PHONE_LOAD [clients] [requests] [range_sec] [host] [port] [device_id] [stream|v2|v2-lz4|v2-zstd]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include "phone_client.h"
+
+namespace asio = boost::asio;
+using boost::asio::ip::tcp;
+using json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+int main(int argc, char* argv[]) {
+    size_t clients = argc > 1 ? std::stoul(argv[1]) : 64;
+    size_t requests = argc > 2 ? std::stoul(argv[2]) : 50;
+    int64_t range_sec = argc > 3 ? std::stoll(argv[3]) : 86400;
+    std::string host = argc > 4 ? argv[4] : "127.0.0.1";
+    std::string port = argc > 5 ? argv[5] : "1488";
+    std::string device = argc > 6 ? argv[6] : "farm001";
+    std::string mode = argc > 7 ? argv[7] : "";
+    bool stream = mode == "stream";
+    bool v2 = mode.compare(0, 2, "v2") == 0;
+
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    json j;
+    j["device_id"] = device;
+    j["unix_time_from"] = now - range_sec;
+    j["unix_time_to"] = now;
+    if(stream) {
+        j["stream"] = true;
+    }
+    if(v2) {
+        j["format"] = 2;
+        j["compression"] = mode.size() > 3 ? mode.substr(3) : "none";
+    }
+    std::string request = j.dump() + "\n";
+
+    std::vector<std::vector<int64_t>> latencies(clients);
+    std::atomic<size_t> errors{0};
+    std::atomic<size_t> records{0};
+
+    auto start = bench_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c]() {
+            asio::io_context io;
+            tcp::resolver resolver(io);
+            auto endpoints = resolver.resolve(host, port);
+            std::vector<char> body;
+            latencies[c].reserve(requests);
+            for(size_t i = 0; i < requests; ++i) {
+                auto begin = bench_clock::now();
+                try {
+                    records += v2 ? request_v2(io, endpoints, request, body)
+                             : stream ? request_stream(io, endpoints, request, body)
+                                      : request_once(io, endpoints, request, body);
+                    latencies[c].push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                        bench_clock::now() - begin).count());
+                }
+                catch(const std::exception&) {
+                    ++errors;
+                }
+            }
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+
+    std::vector<int64_t> all;
+    for(const auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto pct = [&all](double q) -> int64_t {
+        return all.empty() ? 0 : all[std::min(all.size() - 1, static_cast<size_t>(q * all.size()))];
+    };
+
+    std::cout << "clients=" << clients << " requests=" << all.size() << " errors=" << errors
+              << " records=" << records << std::endl;
+    std::cout << "throughput=" << all.size() / elapsed.count() << " req/s"
+              << " p50_us=" << pct(0.50) << " p99_us=" << pct(0.99)
+              << " max_us=" << (all.empty() ? 0 : all.back()) << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// Публикация команд в брокер: прежний MqttSender (publish()->wait() в потоке каждого
+// соединения) против окна асинхронных публикаций common/phone_publish.h. Каждый вариант
+// отправляет messages сообщений QoS 1 в topic и печатает сообщений в секунду и задержку
+// до PUBACK p50/p99/max. Нужен запущенный брокер (например, mosquitto на 1883).
+//
+//   ./PUBLISH_BENCH [messages] [broker] [topic]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <mqtt/async_client.h>
+#include "../common/latency_histogram.h"
+#include "../common/phone_publish.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+const std::string PAYLOAD = "{\"pump\":1,\"light\":0,\"target_humidity\":55}";
+
+void report(const std::string& name, size_t messages, bench_clock::duration elapsed, const LatencyHistogram& latency) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "  " << name << " msg/s=" << static_cast<uint64_t>(messages / seconds)
+              << " " << latency.snapshot() << std::endl;
+}
+
+// Прежний путь: threads "соединений", каждое ждёт PUBACK своего сообщения
+void bench_wait(const std::string& broker, const std::string& topic, size_t messages, size_t threads) {
+    mqtt::async_client client(broker, "publish_bench_wait");
+    client.connect()->wait();
+    LatencyHistogram latency;
+    std::atomic<size_t> next{0};
+    auto begin = bench_clock::now();
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            while(next++ < messages) {
+                auto started = bench_clock::now();
+                auto msg = mqtt::make_message(topic, PAYLOAD);
+                msg->set_qos(1);
+                client.publish(msg)->wait();
+                latency.record(std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - started));
+            }
+        });
+    }
+    for(auto& w : workers) {
+        w.join();
+    }
+    report("wait, " + std::to_string(threads) + " threads", messages, bench_clock::now() - begin, latency);
+    client.disconnect()->wait();
+}
+
+// Окно: один поток отдаёт сообщения, не дожидаясь подтверждений
+void bench_window(const std::string& broker, const std::string& topic, size_t messages, size_t window) {
+    MqttPublisher publisher(broker, "publish_bench_window", window);
+    LatencyHistogram latency;
+    std::mutex mutex;
+    std::condition_variable all_done;
+    size_t done = 0, failed = 0;
+    auto begin = bench_clock::now();
+    for(size_t i = 0; i < messages; ++i) {
+        publisher.publish_async(topic, PAYLOAD, [&](const PublishResult& result) {
+            if(result.delivered) {
+                latency.record(result.latency);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            failed += !result.delivered;
+            if(++done == messages) {
+                all_done.notify_one();
+            }
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [&]() { return done == messages; });
+    }
+    report("window " + std::to_string(window) + (failed ? ", failed=" + std::to_string(failed) : ""),
+           messages, bench_clock::now() - begin, latency);
+}
+
+int main(int argc, char* argv[]) {
+    size_t messages = argc > 1 ? std::stoul(argv[1]) : 20000;
+    std::string broker = argc > 2 ? argv[2] : "tcp://localhost:1883";
+    std::string topic = argc > 3 ? argv[3] : "/bench/command";
+    try {
+        std::cout << "Messages: " << messages << " to " << broker << " " << topic << std::endl;
+        for(size_t threads : {1, 16}) {
+            bench_wait(broker, topic, messages, threads);
+        }
+        for(size_t window : {1, 8, 64, 256}) {
+            bench_window(broker, topic, messages, window);
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Подписки logs_to_phone: subscribers соединений подписываются на ферму device_id, бенчмарк
+// сам пишет в кольцо свежих показаний (как data_server_farm) rate строк в секунду в течение
+// seconds секунд и измеряет задержку от записи строки в кольцо до её получения каждым
+// подписчиком. В light_intensity строки - время записи в мкс.
+// Печатает p50/p99/max задержки доставки, сколько строк потеряно и сколько подписчиков отключено.
+// Подписчиков на ядро - наибольшее subscribers, при котором p99 остаётся меньше секунды
+// (у LOGS один поток ввода-вывода).
+//
+// Пишет в кольцо /iop_farm_hot_ring сам: запускать при остановленном data.service.
+//
+//   ./PUSH_BENCH [subscribers] [rate] [seconds] [host] [port] [device_id]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <arpa/inet.h>
+#include "../common/sensor_data.h"
+#include "../common/hot_ring.h"
+#include "../common/latency_histogram.h"
+
+namespace asio = boost::asio;
+using boost::asio::ip::tcp;
+
+const size_t RECORD_SIZE = 7 * sizeof(uint64_t);
+const size_t HEADER_SIZE = 5;
+const size_t CONNECTING = 64;  // Подписок в процессе подключения: больше отклонит очередь сервера
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint64_t ntohll(uint64_t value) {
+    return (static_cast<uint64_t>(ntohl(value & 0xFFFFFFFF)) << 32) | ntohl(value >> 32);
+}
+
+struct Counters {
+    std::function<void()> next;   // Подключить следующего подписчика
+    std::atomic<size_t> ready{0};
+    std::atomic<size_t> closed{0};
+    std::atomic<uint64_t> rows{0};
+    LatencyHistogram latency;
+};
+
+class Subscriber : public std::enable_shared_from_this<Subscriber> {
+    tcp::socket socket;
+    Counters& counters;
+    std::string request;
+    std::vector<char> buffer = std::vector<char>(64 * RECORD_SIZE);
+    size_t pending = 0;
+    bool subscribed = false;
+
+    void fail() {
+        ++counters.closed;
+        if(!subscribed) {
+            counters.next();
+        }
+    }
+
+    void read() {
+        socket.async_read_some(asio::buffer(buffer.data() + pending, buffer.size() - pending),
+            [self = shared_from_this()](const boost::system::error_code& ec, size_t n) {
+                if(ec) {
+                    self->fail();
+                    return;
+                }
+                self->parse(n);
+                self->read();
+            });
+    }
+
+    void parse(size_t n) {
+        pending += n;
+        int64_t received = now_us();
+        size_t pos = 0;
+        for(; pos + RECORD_SIZE <= pending; pos += RECORD_SIZE) {
+            uint64_t field;
+            memcpy(&field, buffer.data() + pos + 6 * sizeof(uint64_t), sizeof(field));
+            field = ntohll(field);
+            double published;
+            memcpy(&published, &field, sizeof(published));
+            counters.latency.record(std::chrono::microseconds(received - static_cast<int64_t>(published)));
+            ++counters.rows;
+        }
+        memmove(buffer.data(), buffer.data() + pos, pending - pos);
+        pending -= pos;
+    }
+
+public:
+    Subscriber(asio::io_context& io, Counters& c, const std::string& device)
+        : socket(io), counters(c), request("{\"subscribe\": true, \"device_id\": \"" + device + "\"}\n") {}
+
+    void start(const tcp::resolver::results_type& endpoints) {
+        asio::async_connect(socket, endpoints,
+            [self = shared_from_this()](const boost::system::error_code& ec, const tcp::endpoint&) {
+                if(ec) {
+                    self->fail();
+                    return;
+                }
+                asio::async_write(self->socket, asio::buffer(self->request),
+                    [self](const boost::system::error_code& ec, size_t) {
+                        if(ec) {
+                            self->fail();
+                            return;
+                        }
+                        asio::async_read(self->socket, asio::buffer(self->buffer.data(), HEADER_SIZE),
+                            [self](const boost::system::error_code& ec, size_t) {
+                                if(ec || memcmp(self->buffer.data(), "IOPS", 4) != 0) {
+                                    self->fail();
+                                    return;
+                                }
+                                self->subscribed = true;
+                                ++self->counters.ready;
+                                self->counters.next();
+                                self->read();
+                            });
+                    });
+            });
+    }
+};
+
+int main(int argc, char* argv[]) {
+    size_t subscribers = argc > 1 ? std::stoul(argv[1]) : 1000;
+    size_t rate = argc > 2 ? std::stoul(argv[2]) : 100;
+    int seconds = argc > 3 ? std::stoi(argv[3]) : 10;
+    std::string host = argc > 4 ? argv[4] : "127.0.0.1";
+    std::string port = argc > 5 ? argv[5] : "1488";
+    std::string device = argc > 6 ? argv[6] : "bench001";
+
+    HotRingWriter ring;
+    asio::io_context io;
+    auto work = asio::make_work_guard(io);
+    std::thread io_thread([&io]() { io.run(); });
+
+    Counters counters;
+    tcp::resolver resolver(io);
+    auto endpoints = resolver.resolve(host, port);
+    size_t launched = 0;
+    counters.next = [&]() {
+        if(launched < subscribers) {
+            ++launched;
+            std::make_shared<Subscriber>(io, counters, device)->start(endpoints);
+        }
+    };
+    asio::post(io, [&]() {
+        for(size_t i = 0; i < CONNECTING; ++i) {
+            counters.next();
+        }
+    });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while(counters.ready + counters.closed < subscribers && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    size_t ready = counters.ready;
+    std::cout << "Subscribed: " << ready << "/" << subscribers << std::endl;
+    // LOGS проверяет, жив ли писатель кольца, раз в секунду
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+    size_t total = rate * static_cast<size_t>(seconds);
+    auto started = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < total; ++i) {
+        std::this_thread::sleep_until(started + std::chrono::microseconds(i * 1000000 / rate));
+        SensorData row{};
+        row.timestamp_unix = now_us() / 1000000;
+        row.light_intensity = static_cast<double>(now_us());
+        ring.publish(device.c_str(), row);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    uint64_t expected = static_cast<uint64_t>(total) * ready;
+    LatencyHistogram::Snapshot latency = counters.latency.snapshot();
+    std::cout << "Rows published: " << total << " (" << rate << "/s), delivered: " << counters.rows
+              << "/" << expected << ", lost: " << expected - std::min<uint64_t>(expected, counters.rows)
+              << ", disconnected: " << counters.closed << std::endl;
+    std::cout << "Fan-out: " << static_cast<double>(counters.rows) / seconds << " rows/s, "
+              << "p50=" << latency.p50_us / 1000.0 << "ms p99=" << latency.p99_us / 1000.0
+              << "ms max=" << latency.max_us / 1000.0 << "ms" << std::endl;
+
+    io.stop();
+    io_thread.join();
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Параллельные диапазонные запросы (как у logs_to_phone) во время записи показаний.
+// Сначала база заполняется историей farms ферм, затем readers потоков seconds секунд
+// запрашивают случайный час случайной фермы, пока конвейер дописывает новые строки.
+// Пул из одного соединения на шард повторяет прежний общий sqlite3*.
+//
+//   ./QUERY_BENCH [rows] [readers] [seconds] [db_dir]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <random>
+#include <cstdio>
+#include "../common/ingest_pipeline.h"
+#include "../common/sensor_history.h"
+#include "../common/latency_histogram.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+const size_t FARMS = 20;
+const size_t SHARDS = 4;
+const int64_t INTERVAL_SEC = 10;        // Как часто ферма присылает показания
+const size_t INGEST_ROWS_PER_SEC = 2000;
+
+int64_t now_unix() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string farm_name(size_t i) {
+    return "farm" + std::to_string(100 + i);
+}
+
+SensorData make_row(int64_t ts, size_t i) {
+    SensorData row{};
+    row.timestamp_unix = ts;
+    for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+        set_sensor_field(row, f, 20.0 + (i + f) % 50 * 0.5);
+    }
+    return row;
+}
+
+void remove_db(const std::string& path) {
+    for(int month : list_partitions(path)) {
+        drop_partition(partition_path(path, month));
+    }
+    drop_partition(path);
+}
+
+// Хвост, который дописывает конвейер во время замеров, продолжается между прогонами
+int64_t tail_ts = 0;
+int64_t tail_seq = 0;
+
+void run(const std::string& path, int64_t history_from, int64_t history_to, size_t readers,
+         int seconds, size_t connections_per_shard) {
+    DeviceDirectory directory(path, SHARDS);
+    ShardedIngest ingest(path, directory);
+    SensorHistory history(path, SHARDS, path + ".blocks", connections_per_shard);
+
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> rows_read{0};
+    LatencyHistogram latency;
+    uint64_t committed_before = ingest.stats().committed_rows;
+
+    // Запись продолжается в хвост истории с постоянной скоростью
+    std::thread writer([&]() {
+        int64_t& ts = tail_ts;
+        while(running) {
+            auto tick = bench_clock::now();
+            for(size_t i = 0; i < INGEST_ROWS_PER_SEC / 10; ++i) {
+                ingest.submit(farm_name(i % FARMS), make_row(ts, i), tail_seq++, ts);
+                if(i % FARMS == FARMS - 1) {
+                    ts += INTERVAL_SEC;
+                }
+            }
+            std::this_thread::sleep_until(tick + std::chrono::milliseconds(100));
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for(size_t r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r]() {
+            std::mt19937_64 rng(r);
+            std::uniform_int_distribution<size_t> farm(0, FARMS - 1);
+            std::uniform_int_distribution<int64_t> start(history_from, history_to - 3600);
+            while(running) {
+                int64_t from = start(rng);
+                auto begin = bench_clock::now();
+                size_t count = 0;
+                history.scan(farm_name(farm(rng)), from, from + 3600, [&count](const SensorData&) {
+                    ++count;
+                    return true;
+                });
+                latency.record(std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - begin));
+                ++queries;
+                rows_read += count;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for(auto& t : threads) {
+        t.join();
+    }
+    writer.join();
+    ingest.stop();
+
+    LatencyHistogram::Snapshot s = latency.snapshot();
+    std::cout << "  connections/shard=" << connections_per_shard
+              << " queries/s=" << queries / seconds
+              << " rows/s=" << rows_read / seconds
+              << " p50_us=" << s.p50_us << " p99_us=" << s.p99_us
+              << " ingest rows/s=" << (ingest.stats().committed_rows - committed_before) / seconds
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t rows = argc > 1 ? std::stoul(argv[1]) : 200000;
+    size_t readers = argc > 2 ? std::stoul(argv[2]) : 8;
+    int seconds = argc > 3 ? std::stoi(argv[3]) : 5;
+    std::string dir = argc > 4 ? argv[4] : "/tmp";
+    std::string path = dir + "/query_bench.db";
+
+    for(size_t i = 0; i < SHARDS; ++i) {
+        remove_db(shard_db_path(path, i));
+    }
+
+    // История: rows строк, по FARMS фермам с шагом INTERVAL_SEC, заканчивается час назад
+    int64_t history_to = now_unix() - 3600;
+    int64_t history_from = history_to - static_cast<int64_t>(rows / FARMS) * INTERVAL_SEC;
+    {
+        DeviceDirectory directory(path, SHARDS);
+        ShardedIngest ingest(path, directory);
+        for(size_t i = 0; i < rows; ++i) {
+            int64_t ts = history_from + static_cast<int64_t>(i / FARMS) * INTERVAL_SEC;
+            while(!ingest.submit(farm_name(i % FARMS), make_row(ts, i), static_cast<int64_t>(i), ts)) {}
+        }
+        ingest.stop();
+    }
+    std::cout << "History: " << rows << " rows, " << FARMS << " farms, " << SHARDS << " shards; "
+              << readers << " readers, ingest " << INGEST_ROWS_PER_SEC << " rows/s" << std::endl;
+
+    tail_ts = history_to;
+    tail_seq = static_cast<int64_t>(rows);
+    run(path, history_from, history_to, readers, seconds, 1);
+    run(path, history_from, history_to, readers, seconds, READ_POOL_SIZE);
+    return 0;
+}
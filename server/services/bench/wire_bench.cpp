@@ -0,0 +1,161 @@
+// Размер и стоимость кодирования ответа logs_to_phone: v1 (56 байт на показание)
+// против v2 (common/wire_format.h) без сжатия, с LZ4 и с zstd. Показания берутся из
+// sensor_data реальной базы или генерируются (шаг 10 с, значения с датчиков фермы).
+// Декодированный ответ v2 сверяется с исходными показаниями побитно.
+//
+//   ./WIRE_BENCH [rows] [data.db]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <sqlite3.h>
+#include "../common/sensor_data.h"
+#include "../common/wire_format.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+const size_t RECORD_SIZE = 7 * sizeof(uint64_t);
+
+std::vector<SensorData> load_rows(const std::string& path, size_t limit) {
+    std::vector<SensorData> rows;
+    sqlite3* db;
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT timestamp_unix, temperature_DHT22, temperature_DS18B20, humidity, "
+                      "water_level, soil_moisture, light_intensity FROM sensor_data "
+                      "ORDER BY timestamp_unix LIMIT ?;";
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        throw std::runtime_error(std::string("Cannot read sensor_data: ") + sqlite3_errmsg(db));
+    }
+    sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(limit));
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        SensorData row{};
+        row.timestamp_unix = sqlite3_column_int64(stmt, 0);
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            set_sensor_field(row, i, sqlite3_column_double(stmt, static_cast<int>(i) + 1));
+        }
+        rows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return rows;
+}
+
+// Как у фермы: DHT22 с шагом 0.1, DS18B20 - 1/16 градуса, влажность 0.1,
+// уровень воды и освещённость - пересчёт с АЦП, влажность почвы - целые проценты
+std::vector<SensorData> make_rows(size_t count) {
+    std::vector<SensorData> rows(count);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> jitter(-1, 1);
+    std::uniform_int_distribution<int> adc(2000, 2100);
+    int64_t ts = 1746000000;
+    for(size_t i = 0; i < count; ++i) {
+        ts += 10 + jitter(rng);
+        double phase = static_cast<double>(i) / 8640 * 2 * M_PI;
+        rows[i].timestamp_unix = ts;
+        rows[i].temperature_DHT22 = std::round((24 + 3 * std::sin(phase)) * 10) / 10;
+        rows[i].temperature_DS18B20 = std::round((23 + 3 * std::sin(phase)) * 16) / 16;
+        rows[i].humidity = std::round((40 + 10 * std::cos(phase)) * 10) / 10;
+        rows[i].water_level = static_cast<float>(adc(rng) * 0.0412);
+        rows[i].soil_moisture = std::round(60 - 20 * std::sin(phase / 7));
+        rows[i].light_intensity = static_cast<float>(adc(rng) * 0.018315);
+    }
+    return rows;
+}
+
+// То же, что serialize_sensor_data в logs.cpp
+void encode_v1(const std::vector<SensorData>& rows, std::vector<char>& out) {
+    out.resize(rows.size() * RECORD_SIZE);
+    char* pos = out.data();
+    for(const auto& row : rows) {
+        uint64_t fields[7];
+        std::memcpy(fields, &row, sizeof(fields));
+        for(auto& field : fields) {
+            field = __builtin_bswap64(field);
+        }
+        std::memcpy(pos, fields, sizeof(fields));
+        pos += RECORD_SIZE;
+    }
+}
+
+size_t encode_v2(const std::vector<SensorData>& rows, WireCodec codec, std::vector<uint8_t>& out) {
+    out.clear();
+    WireEncoder encoder(codec);
+    for(const auto& row : rows) {
+        if(encoder.add(row)) {
+            const std::vector<uint8_t>& frame = encoder.frame();
+            out.insert(out.end(), frame.begin(), frame.end());
+        }
+    }
+    if(encoder.pending() > 0) {
+        const std::vector<uint8_t>& frame = encoder.frame();
+        out.insert(out.end(), frame.begin(), frame.end());
+    }
+    return out.size() + WIRE_HEADER_SIZE + 2 * sizeof(uint32_t);
+}
+
+void decode_v2(const std::vector<uint8_t>& in, std::vector<SensorData>& rows) {
+    rows.clear();
+    WireDecoder decoder;
+    size_t pos = 0;
+    while(pos < in.size()) {
+        uint32_t raw_size = get_uint32(in.data() + pos);
+        uint32_t stored_size = get_uint32(in.data() + pos + sizeof(uint32_t));
+        WireCodec codec = static_cast<WireCodec>(in[pos + 2 * sizeof(uint32_t)]);
+        pos += WIRE_FRAME_HEADER;
+        decoder.decode(in.data() + pos, stored_size, raw_size, codec, rows);
+        pos += stored_size;
+    }
+}
+
+template <typename F>
+double ns_per_row(size_t rows, int repeats, F&& body) {
+    auto begin = bench_clock::now();
+    for(int i = 0; i < repeats; ++i) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - begin;
+    return elapsed.count() / repeats / rows;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    std::vector<SensorData> rows = argc > 2 ? load_rows(argv[2], count) : make_rows(count);
+    if(rows.empty()) {
+        std::cerr << "No rows" << std::endl;
+        return 1;
+    }
+    const int repeats = 5;
+    std::cout << "Rows: " << rows.size() << (argc > 2 ? " from " + std::string(argv[2]) : " generated") << std::endl;
+
+    std::vector<char> v1;
+    double v1_ns = ns_per_row(rows.size(), repeats, [&]() { encode_v1(rows, v1); });
+    std::cout << "  v1        bytes/row=" << static_cast<double>(v1.size() + sizeof(uint32_t)) / rows.size()
+              << " encode_ns/row=" << v1_ns << std::endl;
+
+    const std::pair<const char*, WireCodec> codecs[] = {
+        {"v2 none", WireCodec::None}, {"v2 lz4 ", WireCodec::Lz4}, {"v2 zstd", WireCodec::Zstd}
+    };
+    std::vector<uint8_t> v2;
+    std::vector<SensorData> decoded;
+    bool ok = true;
+    for(const auto& codec : codecs) {
+        size_t bytes = 0;
+        double encode_ns = ns_per_row(rows.size(), repeats, [&]() { bytes = encode_v2(rows, codec.second, v2); });
+        double decode_ns = ns_per_row(rows.size(), repeats, [&]() { decode_v2(v2, decoded); });
+        bool same = decoded.size() == rows.size() &&
+                    std::memcmp(decoded.data(), rows.data(), rows.size() * sizeof(SensorData)) == 0;
+        ok = ok && same;
+        std::cout << "  " << codec.first << "   bytes/row=" << static_cast<double>(bytes) / rows.size()
+                  << " encode_ns/row=" << encode_ns << " decode_ns/row=" << decode_ns
+                  << (same ? "" : " MISMATCH") << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -1 +1 @@
-g++ command.cpp -o COMMAND     -lboost_system     -lboost_thread     -lpaho-mqttpp3     -lpaho-mqtt3as
+g++ -std=c++17 -pthread -o COMMAND command.cpp -I/usr/include/boost -lboost_system -lboost_thread -lpaho-mqttpp3 -lpaho-mqtt3as
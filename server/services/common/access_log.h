@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "metrics.h"
+
+// Журнал запросов сервисов: обработчик только кладёт строку в очередь без блокировок
+// (log() не ждёт ни мьютекса, ни диска), поток записи забирает всё накопленное раз в
+// ACCESS_LOG_FLUSH_INTERVAL, ставит всем строкам пачки одно время "YYYY-mm-dd HH:MM:SS | "
+// и дописывает пачку одним write(). Файл открыт с O_APPEND, поэтому его могут делить
+// процессы (command.cpp и config.cpp пишут в /var/log/phone_command.log). Когда файл
+// больше ACCESS_LOG_MAX_BYTES, он переименовывается в .1 (.1 в .2 и т.д., хранится
+// ACCESS_LOG_KEEP старых); ротацию делает тот, кто первым взял flock, остальные
+// замечают новый файл по inode и переоткрывают его.
+
+constexpr std::chrono::milliseconds ACCESS_LOG_FLUSH_INTERVAL{100};
+constexpr size_t ACCESS_LOG_MAX_PENDING = 65536;       // Сверх этого строки отбрасываются, а не копятся
+constexpr off_t ACCESS_LOG_MAX_BYTES = 64 * 1024 * 1024;
+constexpr int ACCESS_LOG_KEEP = 5;
+
+// Очередь много писателей - один читатель (Вьюков): push - один exchange, без циклов
+template <typename T>
+class MpscQueue {
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    std::atomic<Node*> head;
+    Node* tail;  // Только читатель
+
+public:
+    MpscQueue() {
+        Node* stub = new Node();
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue() {
+        T value;
+        while(pop(value)) {
+        }
+        delete tail;
+    }
+
+    void push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // false - пусто (или писатель между exchange и next.store: элемент заберётся в следующий раз)
+    bool pop(T& value) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if(!next) {
+            return false;
+        }
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+};
+
+struct AccessLogStats {
+    uint64_t lines;
+    uint64_t batches;
+    uint64_t dropped;
+    uint64_t failed;      // Строк, которые не удалось записать
+    uint64_t rotations;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const AccessLogStats& s) {
+    return os << "lines=" << s.lines
+              << " batches=" << s.batches
+              << " dropped=" << s.dropped
+              << " failed=" << s.failed
+              << " rotations=" << s.rotations;
+}
+
+class AccessLog {
+    std::string path;
+    int fd = -1;
+    ino_t inode = 0;
+    MpscQueue<std::string> queue;
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+
+    std::atomic<uint64_t> lines{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> rotations{0};
+
+    void open_file() {
+        int opened = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if(opened < 0) {
+            throw std::runtime_error("Cannot open log file " + path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        fstat(opened, &st);
+        if(fd >= 0) {
+            ::close(fd);
+        }
+        fd = opened;
+        inode = st.st_ino;
+    }
+
+    // Перед пачкой: файл переименован другим процессом - переоткрыть; вырос - повернуть
+    void check_rotation() {
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0 || st.st_ino != inode) {
+            open_file();
+            return;
+        }
+        if(st.st_size < ACCESS_LOG_MAX_BYTES) {
+            return;
+        }
+        flock(fd, LOCK_EX);
+        // Пока ждали замок, другой процесс мог уже повернуть файл
+        if(stat(path.c_str(), &st) == 0 && st.st_ino == inode && st.st_size >= ACCESS_LOG_MAX_BYTES) {
+            for(int i = ACCESS_LOG_KEEP - 1; i >= 1; --i) {
+                std::rename((path + "." + std::to_string(i)).c_str(), (path + "." + std::to_string(i + 1)).c_str());
+            }
+            std::rename(path.c_str(), (path + ".1").c_str());
+            ++rotations;
+        }
+        flock(fd, LOCK_UN);
+        open_file();
+    }
+
+    static std::string now_string() {
+        std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::tm tm{};
+        localtime_r(&now, &tm);
+        char time_str[20];
+        std::strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+        return time_str;
+    }
+
+    void flush(std::string& buffer) {
+        std::string line;
+        if(!queue.pop(line)) {
+            return;
+        }
+        std::string stamp = now_string() + " | ";
+        size_t count = 0;
+        buffer.clear();
+        do {
+            buffer += stamp;
+            buffer += line;
+            buffer += '\n';
+            ++count;
+        } while(queue.pop(line));
+        pending -= count;
+        try {
+            check_rotation();
+        }
+        catch(const std::exception&) {
+            // Пишем в прежний дескриптор; не открылся и он - строки пропадут ниже
+        }
+        const char* data = buffer.data();
+        size_t size = buffer.size();
+        while(size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                failed += count;
+                return;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        lines += count;
+        ++batches;
+    }
+
+    void run() {
+        std::string buffer;
+        while(!stopping.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_for(ACCESS_LOG_FLUSH_INTERVAL);
+            flush(buffer);
+        }
+        flush(buffer);
+    }
+
+public:
+    explicit AccessLog(const std::string& file_path) : path(file_path) {
+        open_file();
+        writer = std::thread([this]() { run(); });
+    }
+
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    // Дописывает всё, что в очереди
+    ~AccessLog() {
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+        if(fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Один писатель на файл в процессе: сервисы одного процесса, пишущие в один путь,
+    // получают общий AccessLog
+    static std::shared_ptr<AccessLog> shared(const std::string& file_path) {
+        static std::mutex mutex;
+        static std::map<std::string, std::weak_ptr<AccessLog>> logs;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<AccessLog> log = logs[file_path].lock();
+        if(!log) {
+            log = std::make_shared<AccessLog>(file_path);
+            logs[file_path] = log;
+        }
+        return log;
+    }
+
+    // Строка без времени и перевода строки
+    void log(std::string line) {
+        if(pending.fetch_add(1, std::memory_order_relaxed) >= ACCESS_LOG_MAX_PENDING) {
+            pending.fetch_sub(1, std::memory_order_relaxed);
+            ++dropped;
+            return;
+        }
+        queue.push(std::move(line));
+    }
+
+    AccessLogStats stats() const {
+        return {lines.load(), batches.load(), dropped.load(), failed.load(), rotations.load()};
+    }
+
+    const std::string& file() const {
+        return path;
+    }
+};
+
+inline void write_metrics(MetricsWriter& out, const AccessLog& log) {
+    AccessLogStats s = log.stats();
+    std::string labels = "file=\"" + log.file() + "\"";
+    out.counter("iop_access_log_lines_total", "Lines written to the access log", s.lines, labels);
+    out.counter("iop_access_log_dropped_total", "Lines dropped because the writer fell behind", s.dropped, labels);
+    out.counter("iop_access_log_failed_total", "Lines lost to write errors", s.failed, labels);
+    out.counter("iop_access_log_rotations_total", "Log file rotations done by this process", s.rotations, labels);
+}
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/sendfile.h>
+#include <boost/asio.hpp>
+#include "latency_histogram.h"
+#include "metrics.h"
+
+// Сервер "одна строка-запрос -> один ответ" для сервисов телефона поверх io_context:
+// приём и чтение/запись асинхронные, сам запрос (SQLite, MQTT) выполняется в
+// фиксированном пуле потоков. Одновременно обрабатывается не больше max_active
+// запросов, следующие max_queued ждут в очереди, остальные соединения закрываются.
+// Ответ может уходить частями по мере готовности (ResponseWriter), не собираясь целиком.
+// Обработчик может оставить соединение открытым, передав сокет дальше (hand_over).
+// Готовые файлы уходят в сокет через sendfile, минуя память процесса (write_file).
+
+constexpr size_t RESPONSE_CHUNK_BYTES = 64 * 1024;
+
+struct ServerOptions {
+    unsigned short port = 0;
+    size_t max_active = 32;                    // Запросов в пуле и на отправке одновременно
+    size_t max_queued = 256;                   // Прочитанных запросов, ждущих места
+    std::chrono::seconds read_timeout{10};     // На строку запроса с момента подключения
+    std::chrono::seconds write_timeout{30};    // На отправку одной части ответа
+    // Сколько поток пула может суммарно ждать отправки за один запрос: дольше - клиент
+    // читает слишком медленно, соединение закрывается, чтобы он не занимал пул
+    std::chrono::seconds write_wait_budget{20};
+    size_t max_request_bytes = 64 * 1024;
+};
+
+struct ServerStats {
+    uint64_t accepted;
+    uint64_t completed;
+    uint64_t rejected;   // Очередь полна
+    uint64_t timeouts;
+    uint64_t failed;     // Обработчик бросил исключение или ошибка сокета
+    size_t active;
+    size_t queued;
+    LatencyHistogram::Snapshot latency;  // От получения запроса до отправки ответа
+};
+
+inline std::ostream& operator<<(std::ostream& os, const ServerStats& s) {
+    return os << "accepted=" << s.accepted
+              << " completed=" << s.completed
+              << " rejected=" << s.rejected
+              << " timeouts=" << s.timeouts
+              << " failed=" << s.failed
+              << " active=" << s.active
+              << " queued=" << s.queued
+              << " " << s.latency;
+}
+
+// Отправка ответа из потока пула. write() отдаёт буферы сокету одной записью (gather)
+// и возвращается сразу, дождавшись лишь предыдущей записи: пока уходит одна часть,
+// обработчик готовит следующую. Буферы нельзя трогать до следующего write()/flush()/wait().
+// При ошибке или таймауте отправки write() и flush() бросают исключение; ожидание
+// ограничено write_wait_budget на запрос.
+class ResponseWriter {
+public:
+    // Получает сокет в его strand после отправки ответа вместо закрытия
+    using SocketOwner = std::function<void(boost::asio::ip::tcp::socket& socket, const std::string& client_ip)>;
+
+    virtual ~ResponseWriter() = default;
+    virtual void write(const std::vector<boost::asio::const_buffer>& buffers) = 0;
+    // length байт файла fd с offset через sendfile; fd нельзя закрывать до flush()/wait()
+    virtual void write_file(int fd, uint64_t offset, uint64_t length) = 0;
+    virtual void flush() = 0;   // Дождаться отправки всего записанного
+    virtual void wait() noexcept = 0;   // То же без исключения, для деструкторов
+    // Соединение не закрывается, а после ответа переходит к owner; место запроса освобождается
+    virtual void hand_over(SocketOwner owner) = 0;
+    // Байты, прочитанные из сокета после строки запроса (следующие запросы клиента,
+    // отправленные не дожидаясь ответа); после вызова буфер пуст
+    virtual std::string take_unread() = 0;
+};
+
+// Два буфера фиксированного размера на ответ: заполненный уходит в сокет, пока пишется
+// второй, так что память на запрос не зависит от размера ответа. Деструктор
+// дожидается отправки, и буферы не освобождаются под незавершённой записью.
+class ChunkedResponse {
+    ResponseWriter& writer;
+    std::vector<char> chunks[2];
+    size_t current = 0;
+    size_t used = 0;
+    boost::asio::const_buffer prefix;
+    bool sent = false;
+
+public:
+    explicit ChunkedResponse(ResponseWriter& w, size_t chunk_bytes = RESPONSE_CHUNK_BYTES) : writer(w) {
+        chunks[0].resize(chunk_bytes);
+        chunks[1].resize(chunk_bytes);
+    }
+
+    ~ChunkedResponse() { writer.wait(); }
+
+    ChunkedResponse(const ChunkedResponse&) = delete;
+    ChunkedResponse& operator=(const ChunkedResponse&) = delete;
+
+    // Отправится перед первой частью той же записью; data должна жить до finish()
+    void set_prefix(const void* data, size_t size) { prefix = boost::asio::buffer(data, size); }
+
+    // Место под size байт (не больше размера буфера); полный буфер отправляется
+    char* reserve(size_t size) {
+        if(used + size > chunks[current].size()) {
+            send();
+        }
+        char* out = chunks[current].data() + used;
+        used += size;
+        return out;
+    }
+
+    // Произвольный размер: данные раскладываются по буферам
+    void append(const void* data, size_t size) {
+        const char* in = static_cast<const char*>(data);
+        while(size > 0) {
+            if(used == chunks[current].size()) {
+                send();
+            }
+            size_t n = std::min(size, chunks[current].size() - used);
+            std::memcpy(chunks[current].data() + used, in, n);
+            used += n;
+            in += n;
+            size -= n;
+        }
+    }
+
+    void send() {
+        std::vector<boost::asio::const_buffer> buffers;
+        if(prefix.size() > 0) {
+            buffers.push_back(prefix);
+            prefix = boost::asio::const_buffer();
+        }
+        if(used > 0) {
+            buffers.push_back(boost::asio::buffer(chunks[current].data(), used));
+        }
+        if(buffers.empty()) {
+            return;
+        }
+        writer.write(buffers);
+        sent = true;
+        current ^= 1;
+        used = 0;
+    }
+
+    // Кусок файла после всего записанного ранее, без копирования в буферы
+    void append_file(int fd, uint64_t offset, uint64_t length) {
+        send();
+        if(length == 0) {
+            return;
+        }
+        writer.write_file(fd, offset, length);
+        sent = true;
+    }
+
+    void finish() {
+        send();
+        writer.flush();
+    }
+
+    // Клиент уже получил часть ответа: заменить его другим нельзя
+    bool started() const { return sent; }
+
+    // Отбросить неотправленное, чтобы начать ответ заново
+    void clear() {
+        used = 0;
+        prefix = boost::asio::const_buffer();
+    }
+};
+
+// Вызывается в потоке пула: request - строка без '\n' (пустая, если клиент
+// отключился, не дописав её), ответ целиком кладётся в response
+using RequestHandler = std::function<void(const std::string& request, const std::string& client_ip,
+                                          std::vector<char>& response)>;
+
+// То же, но ответ отправляется по частям через out
+using StreamingRequestHandler = std::function<void(const std::string& request, const std::string& client_ip,
+                                                   ResponseWriter& out)>;
+
+class AsyncRequestServer {
+    using tcp = boost::asio::ip::tcp;
+    using clock = std::chrono::steady_clock;
+
+    class Session : public std::enable_shared_from_this<Session>, public ResponseWriter {
+        AsyncRequestServer& server;
+        tcp::socket socket;
+        boost::asio::steady_timer timer;
+        boost::asio::streambuf buffer;
+        std::string client_ip = "unknown";
+        std::string request;
+        clock::time_point started;
+        bool timed_out = false;
+
+        // Состояние записи разделяют поток пула и strand сокета
+        std::mutex write_mutex;
+        std::condition_variable write_done;
+        bool writing = false;
+        boost::system::error_code write_error;
+        clock::duration write_wait_left;
+        SocketOwner owner;
+
+        void arm_timer(std::chrono::seconds timeout) {
+            timer.expires_after(timeout);
+            timer.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+                if(!ec) {
+                    self->timed_out = true;
+                    boost::system::error_code ignored;
+                    self->socket.close(ignored);
+                }
+            });
+        }
+
+        // В strand: запись завершена, поток пула может продолжать
+        void write_finished(const boost::system::error_code& ec) {
+            timer.cancel();
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                writing = false;
+                if(ec) {
+                    write_error = ec;
+                }
+            }
+            write_done.notify_all();
+        }
+
+        // В strand: sendfile, пока сокет принимает данные, затем ожидание готовности к записи
+        void send_file(int fd, off_t offset, uint64_t remaining) {
+            boost::system::error_code ec;
+            socket.native_non_blocking(true, ec);
+            while(!ec && remaining > 0) {
+                ssize_t n = ::sendfile(socket.native_handle(), fd, &offset, remaining);
+                if(n > 0) {
+                    remaining -= static_cast<uint64_t>(n);
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    socket.async_wait(tcp::socket::wait_write,
+                        [self = shared_from_this(), fd, offset, remaining](const boost::system::error_code& ec) {
+                            if(ec) {
+                                self->write_finished(ec);
+                                return;
+                            }
+                            self->send_file(fd, offset, remaining);
+                        });
+                    return;
+                }
+                // n == 0: файл короче, чем обещано
+                ec = n < 0 ? boost::system::error_code(errno, boost::system::system_category())
+                           : boost::asio::error::make_error_code(boost::asio::error::eof);
+            }
+            write_finished(ec);
+        }
+
+        // В потоке пула: ждёт окончания записи не дольше остатка write_wait_budget. Когда
+        // он исчерпан, сокет закрывается в strand, запись обрывается, и write_error
+        // остаётся выставленным - следующий write()/flush() бросит исключение
+        void wait_written(std::unique_lock<std::mutex>& lock) {
+            auto begin = clock::now();
+            bool done = write_done.wait_for(lock, write_wait_left, [this] { return !writing; });
+            write_wait_left -= std::min(write_wait_left, clock::now() - begin);
+            if(done) {
+                return;
+            }
+            boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+                self->timed_out = true;
+                boost::system::error_code ignored;
+                self->socket.close(ignored);
+            });
+            write_done.wait(lock, [this] { return !writing; });
+            if(!write_error) {
+                write_error = boost::asio::error::timed_out;
+            }
+        }
+
+        void finish(bool ok) {
+            if(ok && owner) {
+                timer.cancel();
+                owner(socket, client_ip);
+                server.release(ok, timed_out, started);
+                return;
+            }
+            boost::system::error_code ignored;
+            socket.shutdown(tcp::socket::shutdown_both, ignored);
+            socket.close(ignored);
+            server.release(ok, timed_out, started);
+        }
+
+    public:
+        Session(AsyncRequestServer& owner, tcp::socket s)
+            : server(owner), socket(std::move(s)), timer(socket.get_executor()),
+              buffer(owner.options.max_request_bytes), write_wait_left(owner.options.write_wait_budget) {}
+
+        void start() {
+            boost::system::error_code ec;
+            auto endpoint = socket.remote_endpoint(ec);
+            if(!ec) {
+                client_ip = endpoint.address().to_string();
+            }
+            arm_timer(server.options.read_timeout);
+            boost::asio::async_read_until(socket, buffer, '\n',
+                [self = shared_from_this()](const boost::system::error_code& ec, size_t) {
+                    self->timer.cancel();
+                    if(self->timed_out) {
+                        ++self->server.timeouts;
+                        return;
+                    }
+                    // Как прежний read_until + getline: без '\n' (EOF, слишком длинная
+                    // строка) запрос считается пустым и обработчик отдаёт запасной ответ
+                    if(!ec) {
+                        std::istream is(&self->buffer);
+                        std::getline(is, self->request);
+                    }
+                    self->started = clock::now();
+                    self->server.admit(self);
+                });
+        }
+
+        void write(const std::vector<boost::asio::const_buffer>& buffers) override {
+            flush();
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                writing = true;
+            }
+            boost::asio::post(socket.get_executor(), [self = shared_from_this(), buffers]() {
+                self->arm_timer(self->server.options.write_timeout);
+                boost::asio::async_write(self->socket, buffers,
+                    [self](const boost::system::error_code& ec, size_t) {
+                        self->write_finished(ec);
+                    });
+            });
+        }
+
+        void write_file(int fd, uint64_t offset, uint64_t length) override {
+            flush();
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                writing = true;
+            }
+            boost::asio::post(socket.get_executor(), [self = shared_from_this(), fd, offset, length]() {
+                self->arm_timer(self->server.options.write_timeout);
+                self->send_file(fd, static_cast<off_t>(offset), length);
+            });
+        }
+
+        void flush() override {
+            std::unique_lock<std::mutex> lock(write_mutex);
+            wait_written(lock);
+            if(write_error) {
+                throw boost::system::system_error(write_error, "Response write failed");
+            }
+        }
+
+        void wait() noexcept override {
+            std::unique_lock<std::mutex> lock(write_mutex);
+            wait_written(lock);
+        }
+
+        void hand_over(SocketOwner socket_owner) override {
+            owner = std::move(socket_owner);
+        }
+
+        // Чтение закончено до вызова обработчика: буфер больше не трогает strand
+        std::string take_unread() override {
+            std::string rest(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_end(buffer.data()));
+            buffer.consume(buffer.size());
+            return rest;
+        }
+
+        // В потоке пула
+        void process() {
+            bool ok = true;
+            try {
+                server.handler(request, client_ip, *this);
+                flush();
+            }
+            catch(const std::exception& e) {
+                std::cerr << "Request handler error for " << client_ip << ": " << e.what() << std::endl;
+                ok = false;
+            }
+            wait();
+            boost::asio::post(socket.get_executor(), [self = shared_from_this(), ok]() {
+                self->finish(ok);
+            });
+        }
+    };
+
+    ServerOptions options;
+    StreamingRequestHandler handler;
+    boost::asio::thread_pool& workers;
+    tcp::acceptor acceptor;
+
+    std::mutex mutex;
+    size_t active = 0;
+    std::deque<std::shared_ptr<Session>> queue;
+
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> failed{0};
+    LatencyHistogram latency;
+
+    void accept() {
+        acceptor.async_accept(boost::asio::make_strand(acceptor.get_executor()),
+            [this](const boost::system::error_code& ec, tcp::socket socket) {
+                if(!ec) {
+                    ++accepted;
+                    std::make_shared<Session>(*this, std::move(socket))->start();
+                }
+                else if(ec == boost::asio::error::operation_aborted) {
+                    return;
+                }
+                accept();
+            });
+    }
+
+    void dispatch(std::shared_ptr<Session> session) {
+        boost::asio::post(workers, [session]() { session->process(); });
+    }
+
+    void admit(std::shared_ptr<Session> session) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(active >= options.max_active) {
+                if(queue.size() < options.max_queued) {
+                    queue.push_back(std::move(session));
+                    return;
+                }
+                ++rejected;
+                session.reset();
+            }
+            else {
+                ++active;
+            }
+        }
+        // Сессия без владельца закрывается деструктором сокета
+        if(session) {
+            dispatch(std::move(session));
+        }
+    }
+
+    void release(bool ok, bool timed_out, clock::time_point started) {
+        if(ok) {
+            ++completed;
+            latency.record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - started));
+        }
+        else if(timed_out) {
+            ++timeouts;
+        }
+        else {
+            ++failed;
+        }
+        std::shared_ptr<Session> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(queue.empty()) {
+                --active;
+                return;
+            }
+            next = std::move(queue.front());
+            queue.pop_front();
+        }
+        dispatch(std::move(next));
+    }
+
+public:
+    AsyncRequestServer(boost::asio::io_context& io, boost::asio::thread_pool& pool,
+                       const ServerOptions& opts, StreamingRequestHandler on_request)
+        : options(opts), handler(std::move(on_request)), workers(pool),
+          acceptor(io, tcp::endpoint(tcp::v4(), opts.port)) {
+        // У sendfile нет MSG_NOSIGNAL: отключившийся клиент не должен завершать процесс
+        std::signal(SIGPIPE, SIG_IGN);
+        accept();
+    }
+
+    // Ответ собирается целиком и отправляется одной записью
+    AsyncRequestServer(boost::asio::io_context& io, boost::asio::thread_pool& pool,
+                       const ServerOptions& opts, RequestHandler on_request)
+        : AsyncRequestServer(io, pool, opts,
+              [on_request](const std::string& request, const std::string& client_ip, ResponseWriter& out) {
+                  std::vector<char> response;
+                  on_request(request, client_ip, response);
+                  if(!response.empty()) {
+                      out.write({boost::asio::buffer(response)});
+                      out.flush();
+                  }
+              }) {}
+
+    AsyncRequestServer(const AsyncRequestServer&) = delete;
+    AsyncRequestServer& operator=(const AsyncRequestServer&) = delete;
+
+    void stop() {
+        boost::system::error_code ignored;
+        acceptor.close(ignored);
+    }
+
+    ServerStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {accepted.load(), completed.load(), rejected.load(), timeouts.load(), failed.load(),
+                active, queue.size(), latency.snapshot()};
+    }
+
+    const LatencyHistogram& latency_histogram() const {
+        return latency;
+    }
+};
+
+inline void write_metrics(MetricsWriter& out, AsyncRequestServer& server, int port) {
+    ServerStats s = server.stats();
+    std::string labels = "port=\"" + std::to_string(port) + "\"";
+    out.counter("iop_requests_accepted_total", "Accepted connections", s.accepted, labels);
+    out.counter("iop_requests_completed_total", "Requests answered", s.completed, labels);
+    out.counter("iop_requests_rejected_total", "Connections closed because the queue was full", s.rejected, labels);
+    out.counter("iop_requests_timeouts_total", "Requests that hit the read or write timeout", s.timeouts, labels);
+    out.counter("iop_requests_failed_total", "Requests that failed in the handler or on the socket", s.failed, labels);
+    out.gauge("iop_requests_active", "Requests in the pool or being sent", static_cast<double>(s.active), labels);
+    out.gauge("iop_requests_queued", "Requests waiting for a pool slot", static_cast<double>(s.queued), labels);
+    out.histogram("iop_request_duration_seconds", "From reading the request to sending the response",
+                  server.latency_histogram(), labels);
+}
@@ -0,0 +1,810 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include "sensor_data.h"
+#include "row_filter.h"
+#include "device_shards.h"
+#include "partitions.h"
+#include "rollups.h"
+
+// Колоночное хранилище закрытой истории. Показания устройства за сутки (UTC)
+// упаковываются в один неизменяемый файл blocks/<device>/<window_start>.blk:
+// столбец времени кодируется delta-of-delta, каждая метрика - отдельным столбцом
+// с XOR-кодированием Gorilla. Читатели отображают файлы в память (mmap).
+
+constexpr int64_t BLOCK_DURATION_SEC = 86400;
+constexpr uint32_t BLOCK_VERSION = 1;
+constexpr size_t BLOCK_COLUMNS = 1 + SENSOR_FIELDS_COUNT;  // Время + метрики
+
+inline int64_t block_window_start(int64_t timestamp) {
+    int64_t rem = timestamp % BLOCK_DURATION_SEC;
+    return timestamp - (rem < 0 ? rem + BLOCK_DURATION_SEC : rem);
+}
+
+class BitWriter {
+    std::vector<uint8_t> bytes;
+    uint64_t bit_count = 0;
+
+public:
+    void write(uint64_t value, unsigned bits) {
+        while(bits > 0) {
+            if(bit_count % 8 == 0) {
+                bytes.push_back(0);
+            }
+            unsigned free_bits = 8 - bit_count % 8;
+            unsigned take = bits < free_bits ? bits : free_bits;
+            uint8_t chunk = static_cast<uint8_t>((value >> (bits - take)) & ((1u << take) - 1));
+            bytes.back() |= static_cast<uint8_t>(chunk << (free_bits - take));
+            bits -= take;
+            bit_count += take;
+        }
+    }
+
+    const std::vector<uint8_t>& data() const { return bytes; }
+    uint64_t size_bits() const { return bit_count; }
+};
+
+class BitReader {
+    const uint8_t* data;
+    uint64_t size_bits;
+    uint64_t pos = 0;
+
+public:
+    BitReader(const uint8_t* bytes, uint64_t bits) : data(bytes), size_bits(bits) {}
+
+    uint64_t read(unsigned bits) {
+        if(pos + bits > size_bits) {
+            throw std::runtime_error("Block column is truncated");
+        }
+        uint64_t value = 0;
+        while(bits > 0) {
+            unsigned avail = 8 - pos % 8;
+            unsigned take = bits < avail ? bits : avail;
+            uint8_t chunk = static_cast<uint8_t>((data[pos / 8] >> (avail - take)) & ((1u << take) - 1));
+            value = (value << take) | chunk;
+            bits -= take;
+            pos += take;
+        }
+        return value;
+    }
+
+    bool read_bit() {
+        return read(1) != 0;
+    }
+};
+
+// delta-of-delta: при ровном периоде отправки каждая метка стоит 1 бит
+class TimestampEncoder {
+    BitWriter& out;
+    int64_t prev = 0;
+    int64_t prev_delta = 0;
+    bool first = true;
+
+public:
+    explicit TimestampEncoder(BitWriter& writer) : out(writer) {}
+
+    void append(int64_t timestamp) {
+        if(first) {
+            out.write(static_cast<uint64_t>(timestamp), 64);
+            prev = timestamp;
+            first = false;
+            return;
+        }
+        int64_t delta = timestamp - prev;
+        int64_t dod = delta - prev_delta;
+        if(dod == 0) {
+            out.write(0b0, 1);
+        }
+        else if(dod >= -63 && dod <= 64) {
+            out.write(0b10, 2);
+            out.write(static_cast<uint64_t>(dod + 63), 7);
+        }
+        else if(dod >= -255 && dod <= 256) {
+            out.write(0b110, 3);
+            out.write(static_cast<uint64_t>(dod + 255), 9);
+        }
+        else if(dod >= -2047 && dod <= 2048) {
+            out.write(0b1110, 4);
+            out.write(static_cast<uint64_t>(dod + 2047), 12);
+        }
+        else {
+            out.write(0b1111, 4);
+            out.write(static_cast<uint64_t>(dod), 64);
+        }
+        prev = timestamp;
+        prev_delta = delta;
+    }
+};
+
+class TimestampDecoder {
+    BitReader in;
+    int64_t prev = 0;
+    int64_t prev_delta = 0;
+    bool first = true;
+
+public:
+    TimestampDecoder(const uint8_t* data, uint64_t bits) : in(data, bits) {}
+
+    int64_t next() {
+        if(first) {
+            first = false;
+            prev = static_cast<int64_t>(in.read(64));
+            return prev;
+        }
+        int64_t dod;
+        if(!in.read_bit()) {
+            dod = 0;
+        }
+        else if(!in.read_bit()) {
+            dod = static_cast<int64_t>(in.read(7)) - 63;
+        }
+        else if(!in.read_bit()) {
+            dod = static_cast<int64_t>(in.read(9)) - 255;
+        }
+        else if(!in.read_bit()) {
+            dod = static_cast<int64_t>(in.read(12)) - 2047;
+        }
+        else {
+            dod = static_cast<int64_t>(in.read(64));
+        }
+        prev_delta += dod;
+        prev += prev_delta;
+        return prev;
+    }
+};
+
+// XOR с предыдущим значением: повтор показания стоит 1 бит,
+// небольшое изменение - только значащие биты внутри окна предыдущего XOR
+class XorEncoder {
+    BitWriter& out;
+    uint64_t prev = 0;
+    unsigned prev_leading = 0;
+    unsigned prev_trailing = 0;
+    bool first = true;
+    bool has_window = false;
+
+public:
+    explicit XorEncoder(BitWriter& writer) : out(writer) {}
+
+    void append(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        if(first) {
+            out.write(bits, 64);
+            prev = bits;
+            first = false;
+            return;
+        }
+        uint64_t x = bits ^ prev;
+        prev = bits;
+        if(x == 0) {
+            out.write(0b0, 1);
+            return;
+        }
+        out.write(0b1, 1);
+        unsigned leading = static_cast<unsigned>(__builtin_clzll(x));
+        unsigned trailing = static_cast<unsigned>(__builtin_ctzll(x));
+        if(leading > 31) {
+            leading = 31;  // На длину отводится 5 бит
+        }
+        if(has_window && leading >= prev_leading && trailing >= prev_trailing) {
+            out.write(0b0, 1);
+            unsigned meaningful = 64 - prev_leading - prev_trailing;
+            out.write(x >> prev_trailing, meaningful);
+            return;
+        }
+        unsigned meaningful = 64 - leading - trailing;
+        out.write(0b1, 1);
+        out.write(leading, 5);
+        out.write(meaningful - 1, 6);
+        out.write(x >> trailing, meaningful);
+        prev_leading = leading;
+        prev_trailing = trailing;
+        has_window = true;
+    }
+};
+
+class XorDecoder {
+    BitReader in;
+    uint64_t prev = 0;
+    unsigned prev_leading = 0;
+    unsigned prev_trailing = 0;
+    bool first = true;
+
+public:
+    XorDecoder(const uint8_t* data, uint64_t bits) : in(data, bits) {}
+
+    double next() {
+        if(first) {
+            first = false;
+            prev = in.read(64);
+        }
+        else if(in.read_bit()) {
+            if(in.read_bit()) {
+                prev_leading = static_cast<unsigned>(in.read(5));
+                unsigned meaningful = static_cast<unsigned>(in.read(6)) + 1;
+                prev_trailing = 64 - prev_leading - meaningful;
+            }
+            unsigned meaningful = 64 - prev_leading - prev_trailing;
+            prev ^= in.read(meaningful) << prev_trailing;
+        }
+        double value;
+        std::memcpy(&value, &prev, sizeof(value));
+        return value;
+    }
+};
+
+// Порядок байт - родной для сервера: блоки не покидают машину
+#pragma pack(push, 1)
+struct BlockColumn {
+    uint64_t offset;  // От начала файла, байты
+    uint64_t bits;
+};
+
+struct BlockHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t window_start;
+    int64_t min_timestamp;
+    int64_t max_timestamp;
+    uint32_t count;
+    uint32_t column_count;
+    BlockColumn columns[BLOCK_COLUMNS];
+};
+#pragma pack(pop)
+
+// rows должны быть упорядочены по времени
+inline std::vector<uint8_t> encode_block(int64_t window_start, const std::vector<SensorData>& rows) {
+    BlockHeader header{};
+    std::memcpy(header.magic, "IOPB", 4);
+    header.version = BLOCK_VERSION;
+    header.window_start = window_start;
+    header.count = static_cast<uint32_t>(rows.size());
+    header.column_count = BLOCK_COLUMNS;
+    if(!rows.empty()) {
+        header.min_timestamp = rows.front().timestamp_unix;
+        header.max_timestamp = rows.back().timestamp_unix;
+    }
+
+    std::vector<BitWriter> columns(BLOCK_COLUMNS);
+    TimestampEncoder timestamps(columns[0]);
+    std::vector<XorEncoder> values;
+    for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+        values.emplace_back(columns[i + 1]);
+    }
+    for(const auto& row : rows) {
+        timestamps.append(row.timestamp_unix);
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            values[i].append(sensor_field(row, i));
+        }
+    }
+
+    std::vector<uint8_t> file(sizeof(BlockHeader));
+    for(size_t c = 0; c < BLOCK_COLUMNS; ++c) {
+        header.columns[c].offset = file.size();
+        header.columns[c].bits = columns[c].size_bits();
+        file.insert(file.end(), columns[c].data().begin(), columns[c].data().end());
+    }
+    std::memcpy(file.data(), &header, sizeof(header));
+    return file;
+}
+
+// Закрытый блок, отображённый в память только для чтения
+class MappedBlock {
+    int fd = -1;
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+    BlockHeader header{};
+
+    void validate() {
+        if(length < sizeof(BlockHeader)) {
+            throw std::runtime_error("Block file is too short");
+        }
+        std::memcpy(&header, base, sizeof(header));
+        if(std::memcmp(header.magic, "IOPB", 4) != 0 || header.version != BLOCK_VERSION ||
+           header.column_count != BLOCK_COLUMNS) {
+            throw std::runtime_error("Unknown block format");
+        }
+        for(const auto& column : header.columns) {
+            if(column.offset > length || (column.bits + 7) / 8 > length - column.offset) {
+                throw std::runtime_error("Block column is out of file bounds");
+            }
+        }
+    }
+
+public:
+    explicit MappedBlock(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            throw std::runtime_error("Cannot open block " + path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat block " + path);
+        }
+        length = static_cast<size_t>(st.st_size);
+        void* mapped = length ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if(mapped == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot mmap block " + path);
+        }
+        base = static_cast<const uint8_t*>(mapped);
+        madvise(mapped, length, MADV_SEQUENTIAL);
+        try {
+            validate();
+        }
+        catch(...) {
+            munmap(mapped, length);
+            ::close(fd);
+            throw;
+        }
+    }
+
+    ~MappedBlock() {
+        munmap(const_cast<uint8_t*>(base), length);
+        ::close(fd);
+    }
+
+    MappedBlock(const MappedBlock&) = delete;
+    MappedBlock& operator=(const MappedBlock&) = delete;
+
+    const BlockHeader& info() const { return header; }
+
+    // Столбцы декодируются синхронно, из метрик - только columns (остальные в row нули, их
+    // страницы не читаются); on_row возвращает false, чтобы остановить чтение.
+    // Возвращает false, если чтение остановил on_row.
+    template <typename F>
+    bool scan(int64_t from, int64_t to, FieldMask columns, F&& on_row) const {
+        if(header.count == 0 || header.max_timestamp < from || header.min_timestamp > to) {
+            return true;
+        }
+        TimestampDecoder timestamps(base + header.columns[0].offset, header.columns[0].bits);
+        std::vector<XorDecoder> values;
+        std::vector<size_t> fields;
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            if(has_sensor_field(columns, i)) {
+                values.emplace_back(base + header.columns[i + 1].offset, header.columns[i + 1].bits);
+                fields.push_back(i);
+            }
+        }
+        SensorData row{};
+        for(uint32_t n = 0; n < header.count; ++n) {
+            row.timestamp_unix = timestamps.next();
+            for(size_t k = 0; k < fields.size(); ++k) {
+                set_sensor_field(row, fields[k], values[k].next());
+            }
+            if(row.timestamp_unix > to) {
+                break;
+            }
+            if(row.timestamp_unix >= from && !on_row(row)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename F>
+    bool scan(int64_t from, int64_t to, F&& on_row) const {
+        return scan(from, to, ALL_SENSOR_FIELDS, on_row);
+    }
+};
+
+class BlockStore {
+    std::string root;
+
+    static void make_dir(const std::string& path) {
+        if(mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+        }
+    }
+
+public:
+    explicit BlockStore(const std::string& root_dir) : root(root_dir) {}
+
+    std::string block_path(const std::string& device, int64_t window_start) const {
+        return root + "/" + device + "/" + std::to_string(window_start) + ".blk";
+    }
+
+    // Запись через временный файл + rename: читатель видит либо весь блок, либо ничего
+    size_t write(const std::string& device, int64_t window_start, const std::vector<SensorData>& rows) {
+        make_dir(root);
+        make_dir(root + "/" + device);
+        std::vector<uint8_t> bytes = encode_block(window_start, rows);
+        std::string path = block_path(device, window_start);
+        std::string tmp = path + ".tmp";
+
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            throw std::runtime_error("Cannot create " + tmp + ": " + std::strerror(errno));
+        }
+        size_t written = 0;
+        while(written < bytes.size()) {
+            ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                ::close(fd);
+                throw std::runtime_error("Cannot write " + tmp + ": " + std::strerror(errno));
+            }
+            written += static_cast<size_t>(n);
+        }
+        fsync(fd);
+        ::close(fd);
+        if(std::rename(tmp.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Cannot rename " + tmp + ": " + std::strerror(errno));
+        }
+        return bytes.size();
+    }
+
+    // Начала закрытых суток устройства по возрастанию; пропущенные сутки (ферма была офлайн) - без файла
+    std::vector<int64_t> windows(const std::string& device) const {
+        std::vector<int64_t> result;
+        DIR* dir = opendir((root + "/" + device).c_str());
+        if(!dir) {
+            return result;
+        }
+        while(dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if(name.size() > 4 && name.compare(name.size() - 4, 4, ".blk") == 0) {
+                try {
+                    result.push_back(std::stoll(name.substr(0, name.size() - 4)));
+                }
+                catch(...) {}
+            }
+        }
+        closedir(dir);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // Закрытые сутки из [from, to] по порядку; декодируются только столбцы filter.columns(),
+    // on_row получает строки, прошедшие условия фильтра
+    template <typename F>
+    bool scan(const std::string& device, int64_t from, int64_t to, const RowFilter& filter, F&& on_row) const {
+        FieldMask columns = filter.columns();
+        for(int64_t window : windows(device)) {
+            if(window + BLOCK_DURATION_SEC <= from) {
+                continue;
+            }
+            if(window > to) {
+                break;
+            }
+            MappedBlock block(block_path(device, window));
+            bool completed = block.scan(from, to, columns, [&](const SensorData& row) {
+                return !filter.matches(row) || on_row(row);
+            });
+            if(!completed) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename F>
+    bool scan(const std::string& device, int64_t from, int64_t to, F&& on_row) const {
+        return scan(device, from, to, RowFilter(), on_row);
+    }
+
+    // Число показаний в [from, to]: без условий целые сутки - по заголовку блока, края -
+    // декодированием; с условиями декодируются только столбцы условий
+    size_t count(const std::string& device, int64_t from, int64_t to, const RowFilter& filter = RowFilter()) const {
+        if(filter.filtered()) {
+            RowFilter conditions;
+            conditions.fields = 0;
+            conditions.predicates = filter.predicates;
+            size_t total = 0;
+            scan(device, from, to, conditions, [&total](const SensorData&) {
+                ++total;
+                return true;
+            });
+            return total;
+        }
+        size_t total = 0;
+        for(int64_t window : windows(device)) {
+            if(window + BLOCK_DURATION_SEC <= from) {
+                continue;
+            }
+            if(window > to) {
+                break;
+            }
+            MappedBlock block(block_path(device, window));
+            const BlockHeader& info = block.info();
+            if(info.count > 0 && info.min_timestamp >= from && info.max_timestamp <= to) {
+                total += info.count;
+                continue;
+            }
+            block.scan(from, to, 0, [&total](const SensorData&) {
+                ++total;
+                return true;
+            });
+        }
+        return total;
+    }
+
+    // Последнее показание среди закрытых суток до horizon
+    bool latest(const std::string& device, int64_t horizon, SensorData& out) const {
+        std::vector<int64_t> all = windows(device);
+        for(auto it = all.rbegin(); it != all.rend(); ++it) {
+            if(*it >= horizon) {
+                continue;
+            }
+            MappedBlock block(block_path(device, *it));
+            if(block.info().count > 0) {
+                bool found = false;
+                block.scan(block.info().max_timestamp, block.info().max_timestamp, [&](const SensorData& row) {
+                    out = row;
+                    found = true;
+                    return true;
+                });
+                if(found) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+// Таблица sealed_blocks в файле шарда: до какого момента история устройства уже
+// лежит в блоках. Всё, что раньше sealed_until, читается из blocks/, остальное - из sensor_data.
+inline void create_sealed_table(sqlite3* db) {
+    sqlite3_exec(db,
+        "CREATE TABLE IF NOT EXISTS sealed_blocks ("
+        "device_id TEXT PRIMARY KEY,"
+        "sealed_until INTEGER NOT NULL);",
+        nullptr, nullptr, nullptr);
+}
+
+inline int64_t sealed_until(sqlite3* db, const std::string& device) {
+    sqlite3_stmt* stmt;
+    int64_t result = 0;
+    if(sqlite3_prepare_v2(db, "SELECT sealed_until FROM sealed_blocks WHERE device_id = ?;",
+                          -1, &stmt, nullptr) != SQLITE_OK) {
+        return result;  // Блоков ещё нет: база старой версии
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        result = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+struct SealStats {
+    size_t blocks = 0;
+    size_t rows = 0;
+    size_t bytes = 0;
+    size_t pruned_rows = 0;
+    size_t dropped_partitions = 0;
+    int64_t sealed_until = 0;
+};
+
+// Переносит закрытые сутки из сырых строк шарда в блоки и удаляет из SQLite
+// строки старше raw_retention_sec, которые уже лежат в блоках, а заодно
+// минутные агрегаты старше MINUTE_ROLLUP_RETENTION_SEC. Месячные файлы
+// удаляются целиком в seal_all, здесь DELETE только для строк до разбиения.
+class BlockSealer {
+    sqlite3* db = nullptr;
+    PartitionReaders partitions;
+    BlockStore& store;
+
+    static bool min_timestamp(sqlite3* handle, const std::string& device, int64_t from, int64_t& out) {
+        sqlite3_stmt* stmt;
+        const char* sql = "SELECT MIN(timestamp_unix) FROM sensor_data "
+                          "WHERE device_id = ? AND timestamp_unix >= ?;";
+        if(sqlite3_prepare_v2(handle, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(handle));
+        }
+        sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, from);
+        bool found = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+        if(found) {
+            out = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
+    bool next_timestamp(const std::string& device, int64_t from, int64_t& out) {
+        bool found = min_timestamp(db, device, from, out);
+        for(int month : list_partitions(partitions.path())) {
+            if(partition_month_end(month) <= from) {
+                continue;
+            }
+            if(found && partition_month_start(month) > out) {
+                break;
+            }
+            ReadPool::Lease part = partitions.get(month);
+            int64_t candidate;
+            if(part && min_timestamp(part->handle(), device, from, candidate)) {
+                out = found ? std::min(out, candidate) : candidate;
+                found = true;
+                break;
+            }
+        }
+        return found;
+    }
+
+    std::vector<SensorData> load_window(const std::string& device, int64_t window) {
+        std::vector<SensorData> rows;
+        scan_partitions(db, partitions, device, window, window + BLOCK_DURATION_SEC - 1,
+                        [&rows](const SensorData& row) {
+            rows.push_back(row);
+            return true;
+        });
+        return rows;
+    }
+
+    void set_sealed_until(const std::string& device, int64_t value) {
+        sqlite3_stmt* stmt;
+        const char* sql = "INSERT INTO sealed_blocks (device_id, sealed_until) VALUES (?, ?) "
+                          "ON CONFLICT(device_id) DO UPDATE SET sealed_until = excluded.sealed_until;";
+        if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+        sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, value);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if(rc != SQLITE_DONE) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+    }
+
+    void exec(const char* sql) {
+        if(sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+    }
+
+    // Одно окно от поиска строк до сдвига sealed_until - под BEGIN IMMEDIATE на основном
+    // файле шарда. write_batch берёт ту же блокировку до чтения горизонта, поэтому строка,
+    // пришедшая во время закрытия, либо попадает в блок, либо видит новый sealed_until и
+    // отбрасывается как late - в месяц, который потом удалят, она не ляжет.
+    // false - до limit строк больше нет, sealed_until сдвинут до limit
+    bool seal_next(const std::string& device, int64_t limit, int64_t& window, SealStats& stats) {
+        exec("BEGIN IMMEDIATE;");
+        try {
+            int64_t next;
+            bool found = next_timestamp(device, window, next) && next < limit;
+            if(found) {
+                // Пустые сутки пропускаются одним запросом
+                window = block_window_start(next);
+                std::vector<SensorData> rows = load_window(device, window);
+                stats.bytes += store.write(device, window, rows);
+                stats.rows += rows.size();
+                ++stats.blocks;
+                window += BLOCK_DURATION_SEC;
+            }
+            else {
+                window = limit;
+            }
+            set_sealed_until(device, window);
+            exec("COMMIT;");
+            return found;
+        }
+        catch(...) {
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            throw;
+        }
+    }
+
+    size_t prune(const std::string& device, int64_t before) {
+        sqlite3_stmt* stmt;
+        const char* sql = "DELETE FROM sensor_data WHERE device_id = ? AND timestamp_unix < ?;";
+        if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+        sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, before);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if(rc != SQLITE_DONE) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+        return static_cast<size_t>(sqlite3_changes(db));
+    }
+
+public:
+    BlockSealer(const std::string& shard_path, BlockStore& blocks) : partitions(shard_path), store(blocks) {
+        if(sqlite3_open(shard_path.c_str(), &db) != SQLITE_OK) {
+            std::string message = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            throw std::runtime_error(message);
+        }
+        sqlite3_busy_timeout(db, 5000);
+        create_sealed_table(db);
+    }
+
+    ~BlockSealer() {
+        sqlite3_close(db);
+    }
+
+    BlockSealer(const BlockSealer&) = delete;
+    BlockSealer& operator=(const BlockSealer&) = delete;
+
+    // Закрывает все полные сутки строго до суток, содержащих seal_before
+    SealStats seal(const std::string& device, int64_t seal_before, int64_t raw_retention_sec) {
+        SealStats stats;
+        int64_t limit = block_window_start(seal_before);
+        int64_t window = sealed_until(db, device);
+        while(window < limit && seal_next(device, limit, window, stats)) {
+        }
+        stats.sealed_until = window;
+        if(raw_retention_sec >= 0) {
+            int64_t prune_before = std::min(window, seal_before - raw_retention_sec);
+            stats.pruned_rows = prune(device, prune_before);
+            prune_rollups(db, device, seal_before);
+        }
+        return stats;
+    }
+};
+
+// Месячные файлы шарда: закончившиеся закрываются на запись, а те, что целиком
+// лежат в блоках и старше срока хранения, удаляются вместе с файлом
+inline size_t maintain_partitions(const std::string& shard_path, int64_t now, int64_t drop_before) {
+    size_t dropped = 0;
+    for(int month : list_partitions(shard_path)) {
+        int64_t end = partition_month_end(month);
+        std::string path = partition_path(shard_path, month);
+        if(end <= drop_before) {
+            if(drop_partition(path)) {
+                ++dropped;
+            }
+        }
+        else if(end + PARTITION_FINALIZE_DELAY_SEC <= now && !finalize_partition(path)) {
+            std::cerr << "Partition " << path << " is busy, will finalize later" << std::endl;
+        }
+    }
+    return dropped;
+}
+
+// Один проход по всем шардам и устройствам: сервис data_server_farm зовёт его
+// периодически, migrate_blocks - один раз для всей накопленной истории
+inline SealStats seal_all(DeviceDirectory& directory, const std::string& base_path, BlockStore& store,
+                          int64_t seal_before, int64_t raw_retention_sec) {
+    SealStats total;
+    for(size_t shard = 0; shard < directory.total_shards(); ++shard) {
+        std::vector<std::string> devices = directory.devices_in_shard(shard);
+        if(devices.empty()) {
+            continue;
+        }
+        std::string shard_path = shard_db_path(base_path, shard);
+        // Месяц можно удалить, только когда он в блоках у всех устройств шарда
+        int64_t drop_before = seal_before - raw_retention_sec;
+        {
+            BlockSealer sealer(shard_path, store);
+            for(const auto& device : devices) {
+                SealStats s = sealer.seal(device, seal_before, raw_retention_sec);
+                total.blocks += s.blocks;
+                total.rows += s.rows;
+                total.bytes += s.bytes;
+                total.pruned_rows += s.pruned_rows;
+                drop_before = std::min(drop_before, s.sealed_until);
+            }
+        }
+        // Соединения сборщика с месячными файлами к этому моменту закрыты
+        if(raw_retention_sec < 0) {
+            drop_before = std::numeric_limits<int64_t>::min();
+        }
+        total.dropped_partitions += maintain_partitions(shard_path, seal_before, drop_before);
+    }
+    return total;
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sensor_data.h"
+#include "block_store.h"
+#include "metrics.h"
+
+// Готовые ответы за закрытые сутки. Блок суток не меняется, поэтому его строки один раз
+// кодируются в формат ответа и кладутся в <root>/<device>/<window_start>.<encoding>;
+// запрос, покрывающий сутки целиком, отдаёт этот файл в сокет через sendfile
+// (ChunkedResponse::append_file) без чтения блока и кодирования. Файл строится при первом
+// запросе суток в этом формате. Заголовок файла запоминает размер и время изменения блока:
+// если блок переписан (повторная миграция), файл строится заново. Каталог можно удалить
+// в любой момент.
+
+constexpr uint32_t DAY_CACHE_VERSION = 1;
+
+#pragma pack(push, 1)
+struct DayCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t rows;
+    uint64_t payload_bytes;
+    int64_t block_size;
+    int64_t block_mtime_ns;
+};
+#pragma pack(pop)
+
+struct DayCacheStats {
+    uint64_t hits;
+    uint64_t built;
+    uint64_t failed;   // Не удалось записать файл: сутки посчитаны обычным путём
+};
+
+inline std::ostream& operator<<(std::ostream& os, const DayCacheStats& s) {
+    return os << "hits=" << s.hits << " built=" << s.built << " failed=" << s.failed;
+}
+
+// Открытый файл суток; payload - байты ответа с offset
+class DayFile {
+    int descriptor = -1;
+
+public:
+    uint64_t offset = sizeof(DayCacheHeader);
+    uint64_t length = 0;
+    uint32_t rows = 0;
+
+    DayFile() = default;
+    explicit DayFile(int fd) : descriptor(fd) {}
+    DayFile(DayFile&& other) noexcept
+        : descriptor(other.descriptor), offset(other.offset), length(other.length), rows(other.rows) {
+        other.descriptor = -1;
+    }
+    DayFile& operator=(DayFile&& other) noexcept {
+        std::swap(descriptor, other.descriptor);
+        offset = other.offset;
+        length = other.length;
+        rows = other.rows;
+        return *this;
+    }
+    ~DayFile() {
+        if(descriptor >= 0) {
+            ::close(descriptor);
+        }
+    }
+
+    int fd() const { return descriptor; }
+};
+
+class DayCache {
+public:
+    // Кодирует строки суток для формата encoding в bytes (как PushHub::Encoder)
+    using Encoder = std::function<void(size_t encoding, const std::vector<SensorData>& rows,
+                                       std::vector<uint8_t>& bytes)>;
+
+    DayCache(const std::string& cache_dir, const std::string& blocks_dir, Encoder encode_rows)
+        : root(cache_dir), blocks(blocks_dir), encoder(std::move(encode_rows)) {}
+
+    DayCache(const DayCache&) = delete;
+    DayCache& operator=(const DayCache&) = delete;
+
+    // Начала суток устройства с блоком в [from, to) по порядку
+    std::vector<int64_t> windows(const std::string& device, int64_t from, int64_t to) const {
+        std::vector<int64_t> result;
+        for(int64_t window : blocks.windows(device)) {
+            if(window >= from && window < to) {
+                result.push_back(window);
+            }
+        }
+        return result;
+    }
+
+    // Файл суток window в формате encoding; false - блока нет или файл не записать
+    bool open(const std::string& device, int64_t window, size_t encoding, DayFile& out) {
+        struct stat block;
+        if(stat(blocks.block_path(device, window).c_str(), &block) != 0) {
+            return false;
+        }
+        std::string path = root + "/" + device + "/" + std::to_string(window) + "." + std::to_string(encoding);
+        if(open_valid(path, encoding, block, out)) {
+            ++hits;
+            return true;
+        }
+        try {
+            build(device, window, encoding, block, path);
+        }
+        catch(const std::exception& e) {
+            std::cerr << "Day cache " << path << ": " << e.what() << std::endl;
+            ++failed;
+            return false;
+        }
+        ++built;
+        return open_valid(path, encoding, block, out);
+    }
+
+    DayCacheStats stats() const {
+        return {hits.load(), built.load(), failed.load()};
+    }
+
+private:
+    std::string root;
+    BlockStore blocks;
+    Encoder encoder;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> built{0};
+    std::atomic<uint64_t> failed{0};
+
+    static int64_t mtime_ns(const struct stat& st) {
+        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    static void make_dir(const std::string& path) {
+        if(mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    static bool write_all(int fd, const void* data, size_t size) {
+        const uint8_t* in = static_cast<const uint8_t*>(data);
+        while(size > 0) {
+            ssize_t n = ::write(fd, in, size);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return false;
+            }
+            in += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool open_valid(const std::string& path, size_t encoding, const struct stat& block, DayFile& out) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            return false;
+        }
+        DayFile file(fd);
+        DayCacheHeader header{};
+        struct stat st;
+        if(pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) || fstat(fd, &st) != 0) {
+            return false;
+        }
+        if(std::memcmp(header.magic, "IOPD", 4) != 0 || header.version != DAY_CACHE_VERSION ||
+           header.encoding != encoding || header.block_size != static_cast<int64_t>(block.st_size) ||
+           header.block_mtime_ns != mtime_ns(block) ||
+           static_cast<uint64_t>(st.st_size) != sizeof(header) + header.payload_bytes) {
+            return false;
+        }
+        file.length = header.payload_bytes;
+        file.rows = header.rows;
+        out = std::move(file);
+        return true;
+    }
+
+    // Запись через временный файл + rename, как у блоков: параллельные сборки одних суток
+    // не мешают друг другу, читатель видит только целый файл
+    void build(const std::string& device, int64_t window, size_t encoding, const struct stat& block,
+               const std::string& path) {
+        std::vector<SensorData> rows;
+        MappedBlock(blocks.block_path(device, window)).scan(window, window + BLOCK_DURATION_SEC - 1,
+            [&rows](const SensorData& row) {
+                rows.push_back(row);
+                return true;
+            });
+        std::vector<uint8_t> payload;
+        encoder(encoding, rows, payload);
+
+        DayCacheHeader header{};
+        std::memcpy(header.magic, "IOPD", 4);
+        header.version = DAY_CACHE_VERSION;
+        header.encoding = static_cast<uint32_t>(encoding);
+        header.rows = static_cast<uint32_t>(rows.size());
+        header.payload_bytes = payload.size();
+        header.block_size = static_cast<int64_t>(block.st_size);
+        header.block_mtime_ns = mtime_ns(block);
+
+        make_dir(root);
+        make_dir(root + "/" + device);
+        std::string tmp = path + ".XXXXXX";
+        int fd = mkostemp(&tmp[0], O_CLOEXEC);
+        if(fd < 0) {
+            throw std::runtime_error(std::string("Cannot create temporary file: ") + std::strerror(errno));
+        }
+        if(!write_all(fd, &header, sizeof(header)) || !write_all(fd, payload.data(), payload.size())) {
+            ::close(fd);
+            std::remove(tmp.c_str());
+            throw std::runtime_error(std::string("Cannot write: ") + std::strerror(errno));
+        }
+        fchmod(fd, 0644);
+        ::close(fd);
+        if(std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error(std::string("Cannot rename: ") + std::strerror(errno));
+        }
+    }
+};
+
+inline void write_metrics(MetricsWriter& out, const DayCache& days) {
+    DayCacheStats s = days.stats();
+    out.counter("iop_day_cache_hits_total", "Whole days served from prebuilt files", s.hits);
+    out.counter("iop_day_cache_built_total", "Day files built", s.built);
+    out.counter("iop_day_cache_failed_total", "Day files that could not be written", s.failed);
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sqlite3.h>
+#include "partitions.h"
+#include "sqlite_pool.h"
+
+// Несколько ферм в одном сервисе: устройство определяется по топику /<device>/data,
+// а его показания живут в одном из SHARD файлов (data.db, data_1.db, ...).
+// Таблица devices в основном data.db хранит, какому шарду принадлежит устройство.
+
+constexpr size_t DEVICE_ID_MAX_LENGTH = 32;  // Как mqtt::DEVICE_ID_MAX_LENGTH в прошивке, с '\0'
+// Топик /<id>/data может прислать любой клиент брокера: дальше новые устройства не регистрируются
+constexpr size_t MAX_DEVICES = 256;
+const std::string LEGACY_DEVICE_ID = "farm001";  // Все строки до появления device_id
+
+inline bool valid_device_id(const std::string& device) {
+    if(device.empty() || device.size() >= DEVICE_ID_MAX_LENGTH) {
+        return false;
+    }
+    for(char c : device) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if(!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// "/farm001/data" + "/data" -> "farm001"
+inline bool device_from_topic(const std::string& topic, const std::string& suffix, std::string& device) {
+    if(topic.size() <= suffix.size() + 1 || topic[0] != '/' ||
+       topic.compare(topic.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return false;
+    }
+    device = topic.substr(1, topic.size() - suffix.size() - 1);
+    return valid_device_id(device);
+}
+
+inline void copy_device_id(char (&dest)[DEVICE_ID_MAX_LENGTH], const std::string& device) {
+    std::strncpy(dest, device.c_str(), DEVICE_ID_MAX_LENGTH - 1);
+    dest[DEVICE_ID_MAX_LENGTH - 1] = '\0';
+}
+
+// data.db -> data.db для шарда 0, data_<k>.db для остальных
+inline std::string shard_db_path(const std::string& base_path, size_t shard) {
+    if(shard == 0) {
+        return base_path;
+    }
+    auto dot = base_path.rfind('.');
+    if(dot == std::string::npos || base_path.find('/', dot) != std::string::npos) {
+        return base_path + "_" + std::to_string(shard);
+    }
+    return base_path.substr(0, dot) + "_" + std::to_string(shard) + base_path.substr(dot);
+}
+
+class DeviceDirectory {
+    sqlite3* db = nullptr;
+    size_t shard_count;
+    size_t max_devices;
+    bool read_only;
+    std::unordered_map<std::string, size_t> cache;
+    std::vector<size_t> devices_per_shard;
+    std::vector<std::pair<std::string, size_t>> unsaved;  // Назначены шарду, но ещё не в devices
+    std::mutex mutex;
+    std::mutex save_mutex;  // Запись в devices; mutex на время ожидания data.db не держится
+
+    void load() {
+        sqlite3_stmt* stmt;
+        // Таблицы может ещё не быть, если data.db создан старой версией сервиса
+        if(sqlite3_prepare_v2(db, "SELECT device_id, shard FROM devices;", -1, &stmt, nullptr) != SQLITE_OK) {
+            return;
+        }
+        while(sqlite3_step(stmt) == SQLITE_ROW) {
+            std::string device = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            size_t shard = static_cast<size_t>(sqlite3_column_int64(stmt, 1));
+            cache[device] = shard;
+            if(shard >= devices_per_shard.size()) {
+                devices_per_shard.resize(shard + 1, 0);
+            }
+            ++devices_per_shard[shard];
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    // Только из save_new_devices: шард и учёт устройств уже назначены в shard_for
+    void insert_devices(const std::vector<std::string>& devices, size_t shard) {
+        std::lock_guard<std::mutex> lock(save_mutex);
+        sqlite3_stmt* stmt;
+        if(sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO devices VALUES (?, ?);", -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+        for(const auto& device : devices) {
+            sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(shard));
+            int rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            if(rc != SQLITE_DONE) {
+                std::string message = sqlite3_errmsg(db);
+                sqlite3_finalize(stmt);
+                throw std::runtime_error(message);
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+
+public:
+    // read_only - для сервисов-читателей: новые устройства не регистрируются
+    DeviceDirectory(const std::string& base_path, size_t shards, bool read_only = false,
+                    size_t max_devices = MAX_DEVICES)
+        : shard_count(shards), max_devices(max_devices), read_only(read_only), devices_per_shard(shards, 0) {
+        if(shards == 0) {
+            throw std::invalid_argument("Shard count must be positive");
+        }
+        int flags = read_only ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+        if(sqlite3_open_v2(base_path.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+            std::string message = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            throw std::runtime_error(message);
+        }
+        sqlite3_busy_timeout(db, 5000);
+        if(!read_only) {
+            const char* sql =
+                "CREATE TABLE IF NOT EXISTS devices ("
+                "device_id TEXT PRIMARY KEY,"
+                "shard INTEGER NOT NULL);";
+            sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+            // Старые строки без device_id лежат в data.db, поэтому farm001 закреплена за шардом 0
+            std::string seed = "INSERT OR IGNORE INTO devices VALUES ('" + LEGACY_DEVICE_ID + "', 0);";
+            sqlite3_exec(db, seed.c_str(), nullptr, nullptr, nullptr);
+        }
+        load();
+    }
+
+    ~DeviceDirectory() {
+        sqlite3_close(db);
+    }
+
+    DeviceDirectory(const DeviceDirectory&) = delete;
+    DeviceDirectory& operator=(const DeviceDirectory&) = delete;
+
+    // Число шардов, на которые уже есть ссылки (может превышать настроенное, если его уменьшили)
+    size_t total_shards() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return devices_per_shard.size();
+    }
+
+    std::vector<std::string> devices_in_shard(size_t shard) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> result;
+        for(const auto& entry : cache) {
+            if(entry.second == shard) {
+                result.push_back(entry.first);
+            }
+        }
+        return result;
+    }
+
+    bool find_shard(const std::string& device, size_t& shard) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(device);
+        if(it != cache.end()) {
+            shard = it->second;
+            return true;
+        }
+        // У писателя в cache все устройства; читатель мог открыть каталог раньше,
+        // чем писатель зарегистрировал устройство
+        if(!read_only) {
+            return false;
+        }
+        sqlite3_stmt* stmt;
+        if(sqlite3_prepare_v2(db, "SELECT shard FROM devices WHERE device_id = ?;", -1, &stmt, nullptr) != SQLITE_OK) {
+            shard = 0;
+            return device == LEGACY_DEVICE_ID;
+        }
+        sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+        bool found = sqlite3_step(stmt) == SQLITE_ROW;
+        if(found) {
+            shard = static_cast<size_t>(sqlite3_column_int64(stmt, 0));
+            cache[device] = shard;
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
+    // Новое устройство попадает в наименее загруженный шард. Назначение делается в памяти:
+    // колбэк MQTT не ждёт data.db, в таблицу devices устройство пишет поток-писатель
+    // шарда (save_new_devices) перед первой пачкой с его строками
+    size_t shard_for(const std::string& device) {
+        size_t shard;
+        if(find_shard(device, shard)) {
+            return shard;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(device);
+        if(it != cache.end()) {
+            return it->second;
+        }
+        if(read_only) {
+            throw std::runtime_error("Device directory is read-only, cannot register " + device);
+        }
+        if(cache.size() >= max_devices) {
+            throw std::runtime_error("Device limit " + std::to_string(max_devices) + " reached, not registering " + device);
+        }
+        shard = 0;
+        for(size_t i = 1; i < shard_count; ++i) {
+            if(devices_per_shard[i] < devices_per_shard[shard]) {
+                shard = i;
+            }
+        }
+        cache[device] = shard;
+        ++devices_per_shard[shard];
+        unsaved.emplace_back(device, shard);
+        return shard;
+    }
+
+    // В потоке-писателе шарда перед пачкой. Если data.db занят дольше busy_timeout, устройства
+    // остаются в очереди и исключение срывает пачку: строк без записи в devices не бывает
+    void save_new_devices(size_t shard) {
+        std::vector<std::string> devices;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto it = unsaved.begin(); it != unsaved.end();) {
+                if(it->second == shard) {
+                    devices.push_back(std::move(it->first));
+                    it = unsaved.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+        if(devices.empty()) {
+            return;
+        }
+        try {
+            insert_devices(devices, shard);
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto& device : devices) {
+                unsaved.emplace_back(std::move(device), shard);
+            }
+            throw;
+        }
+    }
+};
+
+// Соединения сервисов-читателей с файлами шардов: по пулу на шард, соединения
+// открываются при первом обращении и выдаются потоку на время запроса
+class ShardConnections {
+    std::string base_path;
+    size_t pool_size;
+    std::vector<std::shared_ptr<ReadPool>> pools;
+    std::vector<std::unique_ptr<PartitionReaders>> partition_readers;
+    std::mutex mutex;
+
+public:
+    explicit ShardConnections(const std::string& base, size_t connections_per_shard = READ_POOL_SIZE)
+        : base_path(base), pool_size(connections_per_shard) {}
+
+    ShardConnections(const ShardConnections&) = delete;
+    ShardConnections& operator=(const ShardConnections&) = delete;
+
+    ReadPool::Lease get(size_t shard) {
+        std::shared_ptr<ReadPool> pool;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(shard >= pools.size()) {
+                pools.resize(shard + 1);
+            }
+            if(!pools[shard]) {
+                pools[shard] = std::make_shared<ReadPool>(shard_db_path(base_path, shard), pool_size);
+            }
+            pool = pools[shard];
+        }
+        return pool->checkout();
+    }
+
+    // Месячные файлы сырых строк шарда
+    PartitionReaders& partitions(size_t shard) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(shard >= partition_readers.size()) {
+            partition_readers.resize(shard + 1);
+        }
+        if(!partition_readers[shard]) {
+            partition_readers[shard] = std::make_unique<PartitionReaders>(shard_db_path(base_path, shard));
+        }
+        return *partition_readers[shard];
+    }
+};
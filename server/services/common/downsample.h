@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "sensor_data.h"
+
+// Прореживание показаний для графиков за один проход по строкам, упорядоченным по времени.
+// Диапазон [from, to] делится на бакеты равной длины, на выходе не больше max_points точек:
+//   avg    - среднее каждого поля по бакету, время точки - начало бакета (как у агрегатов);
+//   minmax - по две точки на бакет: для каждого поля минимум и максимум в том порядке,
+//            в каком они встретились, время - первого и последнего показания бакета;
+//   lttb   - Largest-Triangle-Three-Buckets: из бакета берётся реальное показание с наибольшей
+//            площадью треугольника (выбранная точка прошлого бакета, кандидат, среднее
+//            следующего). Площади полей нормируются на их размах, и выбор общий для всех полей.
+// max_points 1 - одна точка на весь диапазон: у lttb последнее показание, у avg и minmax
+// среднее (минимум и максимум в одну точку не помещаются).
+// Память не зависит от длины диапазона: lttb держит не больше LTTB_CANDIDATES кандидатов
+// на бакет (остальные прореживаются по времени), avg и minmax - только суммы и экстремумы.
+
+enum class DownsampleMode {
+    Lttb,
+    MinMax,
+    Avg
+};
+
+constexpr size_t MAX_DOWNSAMPLE_POINTS = 100000;
+constexpr size_t LTTB_CANDIDATES = 1024;
+
+// "lttb" / "minmax" / "avg"; false для неизвестного имени
+inline bool parse_downsample_mode(const std::string& name, DownsampleMode& mode) {
+    if(name == "lttb") {
+        mode = DownsampleMode::Lttb;
+    }
+    else if(name == "minmax") {
+        mode = DownsampleMode::MinMax;
+    }
+    else if(name == "avg") {
+        mode = DownsampleMode::Avg;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+template <typename Emit>
+class Downsampler {
+    struct Bucket {
+        int64_t index = -1;
+        size_t count = 0;
+        int64_t first_ts = 0;
+        int64_t last_ts = 0;
+        double ts_sum = 0;
+        double sum[SENSOR_FIELDS_COUNT];
+        double min[SENSOR_FIELDS_COUNT];
+        double max[SENSOR_FIELDS_COUNT];
+        int64_t min_ts[SENSOR_FIELDS_COUNT];
+        int64_t max_ts[SENSOR_FIELDS_COUNT];
+        size_t values[SENSOR_FIELDS_COUNT];  // Показаний, где поле не SENSOR_MISSING
+        std::vector<SensorData> candidates;  // Только для lttb
+        int64_t last_slot = -1;
+        SensorData last{};
+
+        void reset(int64_t i) {
+            index = i;
+            count = 0;
+            ts_sum = 0;
+            candidates.clear();
+            last_slot = -1;
+            for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+                values[f] = 0;
+                sum[f] = min[f] = max[f] = SENSOR_MISSING;
+            }
+        }
+
+        void add(const SensorData& row) {
+            if(count == 0) {
+                first_ts = row.timestamp_unix;
+            }
+            last_ts = row.timestamp_unix;
+            last = row;
+            ts_sum += static_cast<double>(row.timestamp_unix);
+            for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+                double value = sensor_field(row, f);
+                if(sensor_missing(value)) {
+                    continue;
+                }
+                if(values[f] == 0 || value < min[f]) {
+                    min[f] = value;
+                    min_ts[f] = row.timestamp_unix;
+                }
+                if(values[f] == 0 || value > max[f]) {
+                    max[f] = value;
+                    max_ts[f] = row.timestamp_unix;
+                }
+                sum[f] = values[f] == 0 ? value : sum[f] + value;
+                ++values[f];
+            }
+            ++count;
+        }
+    };
+
+    DownsampleMode mode;
+    int64_t from;
+    int64_t width;
+    bool last_only = false;  // lttb с max_points 1
+    Emit emit;
+
+    Bucket current;
+    Bucket next;           // lttb: бакет после текущего, нужен его средний
+    SensorData anchor{};   // lttb: точка, выбранная в прошлом бакете
+    bool has_anchor = false;
+
+    int64_t bucket_of(int64_t timestamp) const {
+        return timestamp < from ? 0 : (timestamp - from) / width;
+    }
+
+    void add_candidate(Bucket& bucket, const SensorData& row) {
+        int64_t offset = row.timestamp_unix - (from + bucket.index * width);
+        int64_t slot = std::max<int64_t>(0, offset) * static_cast<int64_t>(LTTB_CANDIDATES) / width;
+        if(slot > bucket.last_slot) {
+            bucket.candidates.push_back(row);
+            bucket.last_slot = slot;
+        }
+    }
+
+    void flush_avg(const Bucket& bucket) {
+        SensorData point{};
+        point.timestamp_unix = from + bucket.index * width;
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            set_sensor_field(point, f, bucket.values[f] ? bucket.sum[f] / bucket.values[f] : SENSOR_MISSING);
+        }
+        emit(point);
+    }
+
+    void flush_minmax(const Bucket& bucket) {
+        SensorData first{};
+        SensorData second{};
+        first.timestamp_unix = bucket.first_ts;
+        second.timestamp_unix = bucket.last_ts;
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            bool min_first = bucket.values[f] == 0 || bucket.min_ts[f] <= bucket.max_ts[f];
+            set_sensor_field(first, f, min_first ? bucket.min[f] : bucket.max[f]);
+            set_sensor_field(second, f, min_first ? bucket.max[f] : bucket.min[f]);
+        }
+        emit(first);
+        if(bucket.count > 1) {
+            emit(second);
+        }
+    }
+
+    // Кандидат текущего бакета с наибольшей суммой нормированных площадей
+    const SensorData& pick_lttb(const Bucket& bucket, const Bucket* following) const {
+        if(!following) {
+            return bucket.last;  // Последний бакет заканчивается последним показанием
+        }
+        double next_ts = following->ts_sum / following->count;
+        double next_avg[SENSOR_FIELDS_COUNT];
+        double spread[SENSOR_FIELDS_COUNT];
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            next_avg[f] = following->values[f] ? following->sum[f] / following->values[f] : SENSOR_MISSING;
+            spread[f] = std::max({bucket.max[f], following->max[f], sensor_field(anchor, f)}) -
+                        std::min({bucket.min[f], following->min[f], sensor_field(anchor, f)});
+        }
+        double span = next_ts - static_cast<double>(anchor.timestamp_unix);
+        size_t best = 0;
+        double best_area = -1;
+        for(size_t i = 0; i < bucket.candidates.size(); ++i) {
+            const SensorData& c = bucket.candidates[i];
+            double dt_c = static_cast<double>(anchor.timestamp_unix - c.timestamp_unix);
+            double area = 0;
+            for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+                if(!(spread[f] > 0) || !(span > 0)) {
+                    continue;
+                }
+                double a = sensor_field(anchor, f);
+                double term = std::fabs((static_cast<double>(anchor.timestamp_unix) - next_ts) * (sensor_field(c, f) - a) -
+                                        dt_c * (next_avg[f] - a)) / (span * spread[f]);
+                if(std::isfinite(term)) {
+                    area += term;
+                }
+            }
+            if(area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        return bucket.candidates[best];
+    }
+
+    void flush_lttb(const Bucket* following) {
+        anchor = pick_lttb(current, following);
+        emit(anchor);
+    }
+
+    void add_lttb(const SensorData& row, int64_t index) {
+        // Первое показание диапазона отдаётся как есть и становится первой вершиной
+        if(!has_anchor) {
+            anchor = row;
+            has_anchor = true;
+            emit(row);
+            return;
+        }
+        Bucket* target = nullptr;
+        if(current.count == 0 || index == current.index) {
+            if(current.count == 0) {
+                current.reset(index);
+            }
+            target = &current;
+        }
+        else if(next.count == 0 || index == next.index) {
+            if(next.count == 0) {
+                next.reset(index);
+            }
+            target = &next;
+        }
+        else {
+            // Показание третьего бакета: следующий полон, текущий можно закрыть
+            flush_lttb(&next);
+            std::swap(current, next);
+            next.reset(index);
+            target = &next;
+        }
+        target->add(row);
+        add_candidate(*target, row);
+    }
+
+public:
+    // max_points ограничивается MAX_DOWNSAMPLE_POINTS; emit(const SensorData&) получает точки по порядку
+    Downsampler(DownsampleMode m, int64_t unix_from, int64_t unix_to, size_t max_points, Emit on_point)
+        : mode(m), from(unix_from), emit(std::forward<Emit>(on_point)) {
+        size_t points = std::min(std::max<size_t>(max_points, 1), MAX_DOWNSAMPLE_POINTS);
+        if(points == 1) {
+            last_only = mode == DownsampleMode::Lttb;
+            if(mode == DownsampleMode::MinMax) {
+                mode = DownsampleMode::Avg;
+            }
+        }
+        // lttb: первая точка отдельно; minmax: по две точки на бакет
+        size_t buckets = points == 1 ? 1
+                       : mode == DownsampleMode::Lttb ? points - 1
+                       : mode == DownsampleMode::MinMax ? points / 2 : points;
+        int64_t range = std::max<int64_t>(unix_to - unix_from + 1, 1);
+        width = std::max<int64_t>((range + static_cast<int64_t>(buckets) - 1) / static_cast<int64_t>(buckets), 1);
+    }
+
+    void add(const SensorData& row) {
+        if(last_only) {
+            current.last = row;
+            current.count = 1;
+            return;
+        }
+        int64_t index = bucket_of(row.timestamp_unix);
+        if(mode == DownsampleMode::Lttb) {
+            add_lttb(row, index);
+            return;
+        }
+        if(current.count > 0 && index != current.index) {
+            mode == DownsampleMode::Avg ? flush_avg(current) : flush_minmax(current);
+            current.count = 0;
+        }
+        if(current.count == 0) {
+            current.reset(index);
+        }
+        current.add(row);
+    }
+
+    void finish() {
+        if(last_only) {
+            if(current.count > 0) {
+                emit(current.last);
+            }
+            current.count = 0;
+            return;
+        }
+        if(mode == DownsampleMode::Lttb) {
+            if(current.count > 0) {
+                flush_lttb(next.count > 0 ? &next : nullptr);
+            }
+            if(next.count > 0) {
+                std::swap(current, next);
+                flush_lttb(nullptr);
+            }
+            current.count = next.count = 0;
+            return;
+        }
+        if(current.count > 0) {
+            mode == DownsampleMode::Avg ? flush_avg(current) : flush_minmax(current);
+            current.count = 0;
+        }
+    }
+};
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sensor_data.h"
+#include "device_shards.h"
+
+// Кольцо последних показаний в разделяемой памяти POSIX: data_server_farm после
+// коммита пачки дописывает в него строки, logs_to_phone отвечает из него на запросы
+// последнего показания и свежих диапазонов, не открывая SQLite.
+//
+// На устройство - слот с HOT_RING_ROWS последними строками в порядке записи. Писатель
+// у слота один (поток шарда устройства), читатели не берут блокировок: seqlock -
+// счётчик sequence нечётный, пока идёт запись, и читатель повторяет копирование,
+// если счётчик изменился. covered_since - с какого времени в кольце есть все строки
+// устройства (при вытеснении строки сдвигается за её время); раньше - читать из БД.
+// Строки публикуются после COMMIT, и при падении между ними часть закоммиченных строк
+// в кольцо не попадёт: новый писатель сдвигает covered_since занятых слотов за любое
+// время, которое могло быть у строк до перезапуска (сейчас + MAX_DEVICE_CLOCK_SKEW_SEC).
+
+constexpr const char* HOT_RING_NAME = "/iop_farm_hot_ring";
+constexpr size_t HOT_RING_DEVICES = 64;
+constexpr size_t HOT_RING_ROWS = 4096;  // ~11 ч при показании раз в 10 с
+constexpr uint32_t HOT_RING_VERSION = 1;
+constexpr uint64_t HOT_RING_FROM_NOW = UINT64_MAX;  // Позиция для tail: только будущие строки
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Hot ring needs lock-free 64-bit atomics");
+
+struct HotRingSlot {
+    std::atomic<uint32_t> state;          // 0 - свободен, 1 - занят устройством device_id
+    char device_id[DEVICE_ID_MAX_LENGTH];
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> written;        // Строк записано за всё время
+    std::atomic<int64_t> covered_since;
+    SensorData rows[HOT_RING_ROWS];
+};
+
+struct HotRingHeader {
+    char magic[8];
+    uint32_t version;
+    std::atomic<uint32_t> retired;        // Писатель пересоздал кольцо: переоткрыть
+    std::atomic<int32_t> writer_pid;
+    uint32_t devices;
+    uint32_t rows;
+    HotRingSlot slots[HOT_RING_DEVICES];
+};
+
+inline bool hot_ring_compatible(const HotRingHeader* header) {
+    return std::memcmp(header->magic, "IOPRING", 8) == 0 && header->version == HOT_RING_VERSION &&
+           header->devices == HOT_RING_DEVICES && header->rows == HOT_RING_ROWS;
+}
+
+// Сторона data_server_farm; кольцо переживает перезапуск сервиса
+class HotRingWriter {
+    std::string name;
+    HotRingHeader* header = nullptr;
+    std::mutex mutex;
+    std::unordered_map<std::string, HotRingSlot*> slots;
+
+    static HotRingHeader* map(int fd, int prot) {
+        void* mapped = mmap(nullptr, sizeof(HotRingHeader), prot, MAP_SHARED, fd, 0);
+        return mapped == MAP_FAILED ? nullptr : static_cast<HotRingHeader*>(mapped);
+    }
+
+    // Занятый слот устройства или новый; nullptr, если свободных не осталось
+    HotRingSlot* slot_for(const char* device, int64_t first_timestamp) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = slots.find(device);
+        if(it != slots.end()) {
+            return it->second;
+        }
+        for(HotRingSlot& slot : header->slots) {
+            if(slot.state.load(std::memory_order_relaxed) == 0) {
+                copy_device_id(slot.device_id, device);
+                slot.written.store(0, std::memory_order_relaxed);
+                slot.covered_since.store(first_timestamp, std::memory_order_relaxed);
+                slot.state.store(1, std::memory_order_release);
+                slots.emplace(device, &slot);
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    explicit HotRingWriter(const std::string& shm_name = HOT_RING_NAME) : name(shm_name) {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0) {
+            throw std::runtime_error("Cannot open shared memory " + name + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        bool reuse = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == sizeof(HotRingHeader);
+        if(reuse) {
+            header = map(fd, PROT_READ | PROT_WRITE);
+            reuse = header && hot_ring_compatible(header);
+        }
+        if(!reuse) {
+            // Кольцо другой версии: читатели со старым отображением увидят retired
+            if(header) {
+                header->retired.store(1, std::memory_order_release);
+                munmap(header, sizeof(HotRingHeader));
+                header = nullptr;
+            }
+            ::close(fd);
+            shm_unlink(name.c_str());
+            fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if(fd < 0 || ftruncate(fd, sizeof(HotRingHeader)) != 0 || !(header = map(fd, PROT_READ | PROT_WRITE))) {
+                std::string error = std::strerror(errno);
+                if(fd >= 0) {
+                    ::close(fd);
+                }
+                throw std::runtime_error("Cannot create shared memory " + name + ": " + error);
+            }
+            header->version = HOT_RING_VERSION;
+            header->devices = HOT_RING_DEVICES;
+            header->rows = HOT_RING_ROWS;
+            std::memcpy(header->magic, "IOPRING", 8);
+        }
+        ::close(fd);
+        int64_t restarted_at = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        int64_t uncovered_until = restarted_at + MAX_DEVICE_CLOCK_SKEW_SEC + 1;
+        for(HotRingSlot& slot : header->slots) {
+            uint64_t seq = slot.sequence.load(std::memory_order_relaxed);
+            if(seq & 1) {
+                // Прошлый писатель упал посреди записи: строки слота могут быть порваны,
+                // слот освобождается и начнётся заново со следующего показания
+                slot.state.store(0, std::memory_order_relaxed);
+                slot.written.store(0, std::memory_order_relaxed);
+                slot.sequence.store(seq + 1, std::memory_order_release);
+            }
+            else if(slot.state.load(std::memory_order_acquire) == 1) {
+                // Строки слота целы, но за ними могли быть закоммиченные и не опубликованные
+                if(slot.covered_since.load(std::memory_order_relaxed) < uncovered_until) {
+                    slot.sequence.store(seq + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                    slot.covered_since.store(uncovered_until, std::memory_order_relaxed);
+                    slot.sequence.store(seq + 2, std::memory_order_release);
+                }
+                slots.emplace(slot.device_id, &slot);
+            }
+        }
+        header->writer_pid.store(getpid(), std::memory_order_release);
+    }
+
+    ~HotRingWriter() {
+        header->writer_pid.store(0, std::memory_order_release);
+        munmap(header, sizeof(HotRingHeader));
+    }
+
+    HotRingWriter(const HotRingWriter&) = delete;
+    HotRingWriter& operator=(const HotRingWriter&) = delete;
+
+    // Только закоммиченные строки: всё, что есть в кольце, есть и в БД
+    void publish(const char* device, const SensorData& row) {
+        HotRingSlot* slot = slot_for(device, row.timestamp_unix);
+        if(!slot) {
+            return;  // Устройств больше HOT_RING_DEVICES: читатели идут в БД
+        }
+        uint64_t seq = slot->sequence.load(std::memory_order_relaxed);
+        slot->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint64_t written = slot->written.load(std::memory_order_relaxed);
+        SensorData& cell = slot->rows[written % HOT_RING_ROWS];
+        if(written >= HOT_RING_ROWS) {
+            int64_t evicted = cell.timestamp_unix + 1;
+            if(evicted > slot->covered_since.load(std::memory_order_relaxed)) {
+                slot->covered_since.store(evicted, std::memory_order_relaxed);
+            }
+        }
+        cell = row;
+        slot->written.store(written + 1, std::memory_order_relaxed);
+        slot->sequence.store(seq + 2, std::memory_order_release);
+    }
+};
+
+// Сторона сервисов телефона: кольцо открывается лениво и переоткрывается, если писатель
+// его пересоздал; пока писателя нет (data_server_farm остановлен), кольцо не используется
+class HotRingReader {
+    std::string name;
+    const HotRingHeader* header = nullptr;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point next_check{};
+    bool alive = false;
+
+    static constexpr std::chrono::seconds CHECK_INTERVAL{1};
+    static constexpr int MAX_READ_ATTEMPTS = 1000;
+
+    bool writer_alive() const {
+        int32_t pid = header->writer_pid.load(std::memory_order_acquire);
+        return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+    }
+
+    void unmap() {
+        if(header) {
+            munmap(const_cast<HotRingHeader*>(header), sizeof(HotRingHeader));
+            header = nullptr;
+        }
+    }
+
+    void open() {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) {
+            return;
+        }
+        struct stat st;
+        if(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == sizeof(HotRingHeader)) {
+            void* mapped = mmap(nullptr, sizeof(HotRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+            if(mapped != MAP_FAILED) {
+                header = static_cast<const HotRingHeader*>(mapped);
+                if(!hot_ring_compatible(header)) {
+                    unmap();
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    // Отображение, если кольцу можно верить; проверки не чаще раза в CHECK_INTERVAL
+    const HotRingHeader* acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        if(now >= next_check) {
+            next_check = now + CHECK_INTERVAL;
+            if(header && header->retired.load(std::memory_order_acquire)) {
+                unmap();
+            }
+            if(!header) {
+                open();
+            }
+            alive = header && writer_alive();
+        }
+        return alive ? header : nullptr;
+    }
+
+    static const HotRingSlot* find(const HotRingHeader* ring, const std::string& device) {
+        for(const HotRingSlot& slot : ring->slots) {
+            if(slot.state.load(std::memory_order_acquire) == 1 && device == slot.device_id) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    // Согласованная копия слота: on_row(row) для каждой строки в порядке записи;
+    // при гонке с писателем копирование повторяется с начала (begin()).
+    // false - писатель так и не закончил запись (упал посреди неё)
+    template <typename Begin, typename F>
+    static bool read_slot(const HotRingSlot* slot, int64_t& covered_since, Begin&& begin, F&& on_row) {
+        for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+            uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+            if(seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            begin();
+            uint64_t written = slot->written.load(std::memory_order_relaxed);
+            covered_since = slot->covered_since.load(std::memory_order_relaxed);
+            uint64_t first = written > HOT_RING_ROWS ? written - HOT_RING_ROWS : 0;
+            for(uint64_t i = first; i < written; ++i) {
+                SensorData row;
+                std::memcpy(&row, &slot->rows[i % HOT_RING_ROWS], sizeof(row));
+                on_row(row);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot->sequence.load(std::memory_order_relaxed) == seq) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    explicit HotRingReader(const std::string& shm_name = HOT_RING_NAME) : name(shm_name) {}
+
+    ~HotRingReader() { unmap(); }
+
+    HotRingReader(const HotRingReader&) = delete;
+    HotRingReader& operator=(const HotRingReader&) = delete;
+
+    // Строки [max(from, covered_since), to] по возрастанию времени в out; false -
+    // кольцо недоступно или устройства в нём нет, тогда весь диапазон читается из БД
+    bool snapshot(const std::string& device, int64_t from, int64_t to,
+                  std::vector<SensorData>& out, int64_t& covered_since) {
+        const HotRingHeader* ring = acquire();
+        const HotRingSlot* slot = ring ? find(ring, device) : nullptr;
+        if(!slot) {
+            return false;
+        }
+        bool consistent = read_slot(slot, covered_since, [&out]() { out.clear(); }, [&](const SensorData& row) {
+            if(row.timestamp_unix >= from && row.timestamp_unix <= to) {
+                out.push_back(row);
+            }
+        });
+        if(!consistent) {
+            return false;
+        }
+        out.erase(std::remove_if(out.begin(), out.end(), [covered_since](const SensorData& row) {
+            return row.timestamp_unix < covered_since;
+        }), out.end());
+        // Строки приходят почти по порядку; поздние показания устройства - редкость
+        if(!std::is_sorted(out.begin(), out.end(), [](const SensorData& a, const SensorData& b) {
+            return a.timestamp_unix < b.timestamp_unix;
+        })) {
+            std::stable_sort(out.begin(), out.end(), [](const SensorData& a, const SensorData& b) {
+                return a.timestamp_unix < b.timestamp_unix;
+            });
+        }
+        return true;
+    }
+
+    // Строки устройства, записанные после позиции position (номер строки в слоте), в порядке
+    // записи; position сдвигается на конец. Вытесненные до чтения строки пропускаются.
+    // HOT_RING_FROM_NOW запоминает текущий конец; если устройства ещё нет, позиция - 0,
+    // чтобы не потерять первые строки. false - кольцо недоступно или чтение не удалось
+    bool tail(const std::string& device, uint64_t& position, std::vector<SensorData>& out) {
+        out.clear();
+        const HotRingHeader* ring = acquire();
+        if(!ring) {
+            return false;
+        }
+        const HotRingSlot* slot = find(ring, device);
+        if(!slot) {
+            if(position == HOT_RING_FROM_NOW) {
+                position = 0;
+            }
+            return true;
+        }
+        if(slot->written.load(std::memory_order_acquire) == position) {
+            return true;
+        }
+        for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+            uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+            if(seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            out.clear();
+            uint64_t written = slot->written.load(std::memory_order_relaxed);
+            // Слот освобождён и занят заново после перезапуска писателя
+            uint64_t first = position == HOT_RING_FROM_NOW ? written : position > written ? 0 : position;
+            first = std::max(first, written > HOT_RING_ROWS ? written - HOT_RING_ROWS : 0);
+            for(uint64_t i = first; i < written; ++i) {
+                SensorData row;
+                std::memcpy(&row, &slot->rows[i % HOT_RING_ROWS], sizeof(row));
+                out.push_back(row);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot->sequence.load(std::memory_order_relaxed) == seq) {
+                position = written;
+                return true;
+            }
+        }
+        out.clear();
+        return false;
+    }
+
+    // Самое позднее по времени показание устройства в кольце; строки до covered_since
+    // не в счёт - в БД может быть более позднее
+    bool latest(const std::string& device, SensorData& data) {
+        const HotRingHeader* ring = acquire();
+        const HotRingSlot* slot = ring ? find(ring, device) : nullptr;
+        if(!slot) {
+            return false;
+        }
+        bool found = false;
+        int64_t covered_since;
+        bool consistent = read_slot(slot, covered_since, [&found]() { found = false; }, [&](const SensorData& row) {
+            if(!found || row.timestamp_unix >= data.timestamp_unix) {
+                data = row;
+                found = true;
+            }
+        });
+        return consistent && found && data.timestamp_unix >= covered_since;
+    }
+};
@@ -0,0 +1,765 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sqlite3.h>
+#include "sensor_data.h"
+#include "sensor_parser.h"
+#include "device_shards.h"
+#include "partitions.h"
+#include "rollups.h"
+#include "block_store.h"
+#include "hot_ring.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+
+// Конвейер записи показаний: колбэк MQTT только кладёт показание в ограниченную
+// очередь, а отдельный поток-писатель коммитит их пачками в одной транзакции.
+
+struct IngestOptions {
+    size_t queue_capacity = 8192;                         // Максимум показаний в памяти
+    size_t batch_rows = 512;                              // Коммит после N строк...
+    std::chrono::milliseconds flush_interval{500};        // ...или через T мс после первой строки пачки
+    std::chrono::milliseconds enqueue_timeout{200};       // Сколько колбэк ждёт места, прежде чем отбросить показание
+    HotRingWriter* hot_ring = nullptr;                    // Куда дописывать закоммиченные строки (common/hot_ring.h)
+};
+
+// Неизвестные ключи показания длиннее этого не хранятся (extra_dropped): очередь шарда
+// занимает не больше queue_capacity * (sizeof(DeviceReading) + INGEST_EXTRA_MAX)
+constexpr size_t INGEST_EXTRA_MAX = 512;
+
+struct IngestStats {
+    uint64_t enqueued;
+    uint64_t dropped;
+    uint64_t backpressure_waits;
+    uint64_t committed_rows;
+    uint64_t committed_batches;
+    uint64_t failed_rows;
+    uint64_t duplicates;      // Повторы (retained-сообщение после переподключения), отсечены уникальным ключом
+    uint64_t late_rows;       // Время устройства уже в закрытых блоках
+    uint64_t extra_dropped;   // Показаний, у которых extra длиннее INGEST_EXTRA_MAX отброшен
+    int64_t lag_avg_ms;       // Время устройства -> коммит, среднее за всё время
+    int64_t last_lag_max_ms;  // ... максимум в последней пачке
+    size_t queue_depth;
+};
+
+// Элемент очереди: всё, кроме extra, фиксированного размера, extra не длиннее
+// INGEST_EXTRA_MAX - память очереди ограничена при любом содержимом сообщений
+struct DeviceReading {
+    char device_id[DEVICE_ID_MAX_LENGTH];
+    SensorData data;       // timestamp_unix - время устройства (NTP), у старой прошивки - сервера
+    int64_t sequence;      // Номер публикации с устройства, -1 - прошивка без него
+    int64_t received_at;   // Когда сообщение пришло на сервер
+    std::string extra;     // Неизвестные ключи JSON, пусто - их не было или они не влезли
+};
+
+// Итог записи пачки
+struct BatchResult {
+    size_t inserted = 0;
+    size_t duplicates = 0;
+    size_t late = 0;
+    size_t lag_rows = 0;     // Вставленные строки со временем устройства
+    int64_t lag_sum_ms = 0;
+    int64_t lag_max_ms = 0;
+};
+
+enum class EnqueueResult { Accepted, AcceptedAfterWait, Dropped };
+
+// Кольцевой буфер фиксированной ёмкости: память не растёт при всплесках
+template <typename T>
+class BoundedQueue {
+    std::vector<T> slots;
+    size_t head = 0;
+    size_t count = 0;
+    bool closed = false;
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+
+public:
+    explicit BoundedQueue(size_t capacity) : slots(capacity) {
+        if(capacity == 0) {
+            throw std::invalid_argument("Queue capacity must be positive");
+        }
+    }
+
+    EnqueueResult push(T item, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        bool waited = false;
+        if(count == slots.size() && !closed) {
+            waited = true;
+            if(!not_full.wait_for(lock, timeout, [this] { return count < slots.size() || closed; })) {
+                return EnqueueResult::Dropped;
+            }
+        }
+        if(closed) {
+            return EnqueueResult::Dropped;
+        }
+        slots[(head + count) % slots.size()] = std::move(item);
+        ++count;
+        lock.unlock();
+        not_empty.notify_one();
+        return waited ? EnqueueResult::AcceptedAfterWait : EnqueueResult::Accepted;
+    }
+
+    // Ждёт первое показание, затем добирает пачку до max_items или до истечения linger.
+    // Возвращает false, когда очередь закрыта и пуста.
+    bool pop_batch(std::vector<T>& out, size_t max_items, std::chrono::milliseconds linger) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return count > 0 || closed; });
+        if(count == 0) {
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now() + linger;
+        not_empty.wait_until(lock, deadline, [&] { return count >= max_items || closed; });
+
+        size_t taken = std::min(count, max_items);
+        for(size_t i = 0; i < taken; ++i) {
+            out.push_back(std::move(slots[head]));
+            head = (head + 1) % slots.size();
+        }
+        count -= taken;
+        lock.unlock();
+        not_full.notify_all();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+};
+
+inline void exec_sql(sqlite3* db, const char* sql) {
+    char* err = nullptr;
+    if(sqlite3_exec(db, sql, nullptr, nullptr, &err) != SQLITE_OK) {
+        std::string message = err ? err : sqlite3_errmsg(db);
+        sqlite3_free(err);
+        throw std::runtime_error(message);
+    }
+}
+
+inline bool has_column(sqlite3* db, const char* table, const char* column) {
+    sqlite3_stmt* stmt;
+    std::string sql = std::string("PRAGMA table_info(") + table + ");";
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error(sqlite3_errmsg(db));
+    }
+    bool found = false;
+    while(!found && sqlite3_step(stmt) == SQLITE_ROW) {
+        found = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1))) == column;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Создаёт sensor_data или доводит схему старой версии до текущей
+inline void ensure_sensor_schema(sqlite3* db) {
+    exec_sql(db,
+        "CREATE TABLE IF NOT EXISTS sensor_data ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "timestamp_unix INTEGER,"
+        "temperature_DHT22 REAL,"
+        "temperature_DS18B20 REAL,"
+        "humidity REAL,"
+        "water_level REAL,"
+        "soil_moisture REAL,"
+        "light_intensity REAL,"
+        "device_id TEXT NOT NULL DEFAULT 'farm001');");
+    // Базы старой версии: до мультифермы все строки принадлежали farm001
+    if(!has_column(db, "sensor_data", "device_id")) {
+        exec_sql(db, "ALTER TABLE sensor_data ADD COLUMN device_id TEXT NOT NULL DEFAULT 'farm001';");
+    }
+    exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_sensor_data_device_time "
+                 "ON sensor_data (device_id, timestamp_unix);");
+    // Неизвестные ключи показаний: в основном файле шарда, а не в месячном - месяцы после
+    // переноса в блоки удаляются, а блоки хранят только метрики
+    exec_sql(db,
+        "CREATE TABLE IF NOT EXISTS sensor_extra ("
+        "device_id TEXT NOT NULL,"
+        "timestamp_unix INTEGER NOT NULL,"
+        "seq INTEGER,"
+        "extra TEXT NOT NULL);");
+    exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_sensor_extra_device_time "
+                 "ON sensor_extra (device_id, timestamp_unix);");
+}
+
+// Месячный файл: уникальный ключ (device_id, timestamp_unix, seq) отсекает повторы
+// одним поиском по индексу, покрывающий индекс - для чтения диапазонов
+inline void ensure_partition_schema(sqlite3* db) {
+    exec_sql(db,
+        "CREATE TABLE IF NOT EXISTS sensor_data ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "timestamp_unix INTEGER,"
+        "temperature_DHT22 REAL,"
+        "temperature_DS18B20 REAL,"
+        "humidity REAL,"
+        "water_level REAL,"
+        "soil_moisture REAL,"
+        "light_intensity REAL,"
+        "device_id TEXT NOT NULL,"
+        "seq INTEGER,"
+        "received_unix INTEGER);");
+    // Месяцы, созданные до появления номера публикации
+    if(!has_column(db, "sensor_data", "seq")) {
+        exec_sql(db, "ALTER TABLE sensor_data ADD COLUMN seq INTEGER;");
+    }
+    if(!has_column(db, "sensor_data", "received_unix")) {
+        exec_sql(db, "ALTER TABLE sensor_data ADD COLUMN received_unix INTEGER;");
+    }
+    // Покрывающий: диапазонный запрос читает только индекс
+    exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_sensor_data_cover ON sensor_data ("
+                 "device_id, timestamp_unix, temperature_DHT22, temperature_DS18B20, "
+                 "humidity, water_level, soil_moisture, light_intensity);");
+    // seq NULL (старая прошивка) не конфликтует ни с чем
+    exec_sql(db, "CREATE UNIQUE INDEX IF NOT EXISTS idx_sensor_data_unique "
+                 "ON sensor_data (device_id, timestamp_unix, seq);");
+}
+
+// Владелец соединений писателя шарда: WAL, подготовленная INSERT на каждый открытый месяц.
+// Сырые строки уходят в месячный файл (partitions.h), агрегаты - в основной файл шарда.
+class SqliteBatchWriter {
+    struct Partition {
+        sqlite3* db = nullptr;
+        sqlite3_stmt* insert_stmt = nullptr;
+        bool in_transaction = false;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    std::string shard_path;
+    sqlite3* db = nullptr;
+    sqlite3_stmt* horizon_stmt = nullptr;
+    sqlite3_stmt* extra_stmt = nullptr;
+    std::map<int, Partition> partitions;
+    std::unique_ptr<RollupAccumulator> rollups;
+    std::unordered_map<std::string, int64_t> horizons;  // sealed_until устройств, на одну пачку
+    std::vector<const DeviceReading*> inserted_rows;     // Строки последней пачки, не отсечённые как повторы
+
+    static sqlite3* open_writable(const std::string& path) {
+        sqlite3* handle;
+        if(sqlite3_open(path.c_str(), &handle) != SQLITE_OK) {
+            std::string message = sqlite3_errmsg(handle);
+            sqlite3_close(handle);
+            throw std::runtime_error(message);
+        }
+        sqlite3_busy_timeout(handle, 5000);
+        // WAL: читатели (logs_to_phone) не блокируют писателя, fsync только на checkpoint
+        exec_sql(handle, "PRAGMA journal_mode=WAL;");
+        exec_sql(handle, "PRAGMA synchronous=NORMAL;");
+        return handle;
+    }
+
+    // В транзакции основного файла, вместе с агрегатами пачки
+    void write_extra(const DeviceReading& row) {
+        sqlite3_bind_text(extra_stmt, 1, row.device_id, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(extra_stmt, 2, row.data.timestamp_unix);
+        if(row.sequence >= 0) {
+            sqlite3_bind_int64(extra_stmt, 3, row.sequence);
+        }
+        else {
+            sqlite3_bind_null(extra_stmt, 3);
+        }
+        sqlite3_bind_text(extra_stmt, 4, row.extra.data(), static_cast<int>(row.extra.size()), SQLITE_STATIC);
+        int rc = sqlite3_step(extra_stmt);
+        sqlite3_reset(extra_stmt);
+        if(rc != SQLITE_DONE) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+    }
+
+    // nullptr - месяц уже закрыт на запись (finalize_partition)
+    Partition* partition(int month) {
+        auto it = partitions.find(month);
+        if(it == partitions.end()) {
+            std::string path = partition_path(shard_path, month);
+            if(partition_is_readonly(path)) {
+                return nullptr;
+            }
+            Partition p;
+            p.db = open_writable(path);
+            try {
+                ensure_partition_schema(p.db);
+                // Повтор не пишется: стоимость - один поиск по уникальному индексу
+                const char* sql = "INSERT INTO sensor_data (timestamp_unix, "
+                    "temperature_DHT22, temperature_DS18B20, humidity, "
+                    "water_level, soil_moisture, light_intensity, device_id, seq, received_unix) "
+                    "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?) "
+                    "ON CONFLICT (device_id, timestamp_unix, seq) DO NOTHING;";
+                if(sqlite3_prepare_v3(p.db, sql, -1, SQLITE_PREPARE_PERSISTENT, &p.insert_stmt, nullptr) != SQLITE_OK) {
+                    throw std::runtime_error(sqlite3_errmsg(p.db));
+                }
+            }
+            catch(...) {
+                sqlite3_close(p.db);
+                throw;
+            }
+            it = partitions.emplace(month, p).first;
+        }
+        it->second.last_used = std::chrono::steady_clock::now();
+        return &it->second;
+    }
+
+    // Граница закрытых блоков устройства: строки раньше неё уже не попадут ни в блоки,
+    // ни в агрегаты без двойного счёта
+    int64_t horizon(const char* device) {
+        auto it = horizons.find(device);
+        if(it != horizons.end()) {
+            return it->second;
+        }
+        int64_t value = 0;
+        sqlite3_bind_text(horizon_stmt, 1, device, -1, SQLITE_STATIC);
+        if(sqlite3_step(horizon_stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int64(horizon_stmt, 0);
+        }
+        sqlite3_reset(horizon_stmt);
+        horizons.emplace(device, value);
+        return value;
+    }
+
+    static void close_partition(Partition& p) {
+        sqlite3_finalize(p.insert_stmt);
+        sqlite3_close(p.db);
+    }
+
+    // Прошлый месяц отпускается, когда в него перестают приходить строки:
+    // к моменту finalize_partition у писателя не остаётся его соединения
+    void close_idle_partitions() {
+        auto now = std::chrono::steady_clock::now();
+        for(auto it = partitions.begin(); it != partitions.end();) {
+            if(now - it->second.last_used > std::chrono::seconds(PARTITION_IDLE_CLOSE_SEC)) {
+                close_partition(it->second);
+                it = partitions.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+public:
+    explicit SqliteBatchWriter(const std::string& path) : shard_path(path) {
+        db = open_writable(path);
+        try {
+            // sensor_data основного файла - строки, записанные до разбиения на месяцы
+            ensure_sensor_schema(db);
+            create_sealed_table(db);
+            if(sqlite3_prepare_v3(db, "SELECT sealed_until FROM sealed_blocks WHERE device_id = ?;", -1,
+                                  SQLITE_PREPARE_PERSISTENT, &horizon_stmt, nullptr) != SQLITE_OK) {
+                throw std::runtime_error(sqlite3_errmsg(db));
+            }
+            if(sqlite3_prepare_v3(db, "INSERT INTO sensor_extra (device_id, timestamp_unix, seq, extra) "
+                                      "VALUES (?, ?, ?, ?);", -1,
+                                  SQLITE_PREPARE_PERSISTENT, &extra_stmt, nullptr) != SQLITE_OK) {
+                throw std::runtime_error(sqlite3_errmsg(db));
+            }
+            rollups = std::make_unique<RollupAccumulator>(db);
+        }
+        catch(...) {
+            sqlite3_finalize(extra_stmt);
+            sqlite3_finalize(horizon_stmt);
+            sqlite3_close(db);
+            throw;
+        }
+    }
+
+    ~SqliteBatchWriter() {
+        for(auto& entry : partitions) {
+            close_partition(entry.second);
+        }
+        rollups.reset();
+        sqlite3_finalize(extra_stmt);
+        sqlite3_finalize(horizon_stmt);
+        sqlite3_close(db);
+    }
+
+    SqliteBatchWriter(const SqliteBatchWriter&) = delete;
+    SqliteBatchWriter& operator=(const SqliteBatchWriter&) = delete;
+
+    // Вставленные строки последней успешной пачки (указатели в её вектор)
+    const std::vector<const DeviceReading*>& last_inserted() const {
+        return inserted_rows;
+    }
+
+    // Пачка - по транзакции на каждый затронутый месяц и одна на агрегаты; при ошибке
+    // откатываются все. Месячные файлы коммитятся первыми: после сбоя между коммитами
+    // агрегаты могут недосчитать пачку, но сырые строки не теряются.
+    BatchResult write_batch(const std::vector<DeviceReading>& batch) {
+        BatchResult result;
+        inserted_rows.clear();
+        std::vector<Partition*> touched;
+        int64_t device_ms_sum = 0;
+        int64_t device_ms_min = std::numeric_limits<int64_t>::max();
+        horizons.clear();
+        exec_sql(db, "BEGIN IMMEDIATE;");
+        try {
+            for(const auto& row : batch) {
+                Partition* p = nullptr;
+                if(row.data.timestamp_unix >= horizon(row.device_id)) {
+                    p = partition(partition_month(row.data.timestamp_unix));
+                }
+                if(!p) {
+                    ++result.late;
+                    continue;
+                }
+                if(!p->in_transaction) {
+                    exec_sql(p->db, "BEGIN IMMEDIATE;");
+                    p->in_transaction = true;
+                    touched.push_back(p);
+                }
+                sqlite3_stmt* stmt = p->insert_stmt;
+                sqlite3_bind_int64(stmt, 1, row.data.timestamp_unix);
+                for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+                    double value = sensor_field(row.data, i);
+                    if(sensor_missing(value)) {
+                        sqlite3_bind_null(stmt, static_cast<int>(i) + 2);
+                    }
+                    else {
+                        sqlite3_bind_double(stmt, static_cast<int>(i) + 2, value);
+                    }
+                }
+                sqlite3_bind_text(stmt, 8, row.device_id, -1, SQLITE_STATIC);
+                if(row.sequence >= 0) {
+                    sqlite3_bind_int64(stmt, 9, row.sequence);
+                }
+                else {
+                    sqlite3_bind_null(stmt, 9);
+                }
+                sqlite3_bind_int64(stmt, 10, row.received_at);
+                int rc = sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+                if(rc != SQLITE_DONE) {
+                    throw std::runtime_error(sqlite3_errmsg(p->db));
+                }
+                if(sqlite3_changes(p->db) == 0) {
+                    ++result.duplicates;
+                    continue;
+                }
+                ++result.inserted;
+                inserted_rows.push_back(&row);
+                rollups->add(row.device_id, row.data);
+                // Только у вставленных: повтор не дублирует extra
+                if(!row.extra.empty()) {
+                    write_extra(row);
+                }
+                if(row.sequence >= 0) {
+                    int64_t device_ms = row.data.timestamp_unix * 1000;
+                    device_ms_sum += device_ms;
+                    device_ms_min = std::min(device_ms_min, device_ms);
+                    ++result.lag_rows;
+                }
+            }
+            rollups->flush(db);
+            for(Partition* p : touched) {
+                exec_sql(p->db, "COMMIT;");
+                p->in_transaction = false;
+            }
+            exec_sql(db, "COMMIT;");
+            rollups->clear();
+        }
+        catch(...) {
+            for(Partition* p : touched) {
+                if(p->in_transaction) {
+                    sqlite3_exec(p->db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                    p->in_transaction = false;
+                }
+            }
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            rollups->clear();
+            inserted_rows.clear();
+            close_idle_partitions();
+            throw;
+        }
+        close_idle_partitions();
+
+        // Задержка от снятия показания на устройстве до коммита; у старой прошивки
+        // время строки серверное, там она ничего не говорит
+        if(result.lag_rows > 0) {
+            int64_t committed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            result.lag_sum_ms = committed_ms * static_cast<int64_t>(result.lag_rows) - device_ms_sum;
+            result.lag_max_ms = committed_ms - device_ms_min;
+        }
+        return result;
+    }
+};
+
+class IngestPipeline {
+    IngestOptions options;
+    BoundedQueue<DeviceReading> queue;
+    SqliteBatchWriter writer;
+    std::function<void()> before_batch;
+    std::thread writer_thread;
+
+    std::atomic<uint64_t> enqueued{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> backpressure_waits{0};
+    std::atomic<uint64_t> committed_rows{0};
+    std::atomic<uint64_t> committed_batches{0};
+    std::atomic<uint64_t> failed_rows{0};
+    std::atomic<uint64_t> duplicates{0};
+    std::atomic<uint64_t> late_rows{0};
+    std::atomic<uint64_t> extra_dropped{0};
+    std::atomic<uint64_t> lag_rows{0};
+    std::atomic<int64_t> lag_sum_ms{0};
+    std::atomic<int64_t> last_lag_max_ms{0};
+    LatencyHistogram commit_latency;  // Пачка целиком: BEGIN, вставки, агрегаты, COMMIT
+    LatencyHistogram lag;             // На строку с временем устройства: снятие -> коммит
+
+    void run() {
+        std::vector<DeviceReading> batch;
+        batch.reserve(options.batch_rows);
+        while(true) {
+            batch.clear();
+            if(!queue.pop_batch(batch, options.batch_rows, options.flush_interval)) {
+                break;
+            }
+            try {
+                auto started = std::chrono::steady_clock::now();
+                if(before_batch) {
+                    before_batch();
+                }
+                BatchResult result = writer.write_batch(batch);
+                commit_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - started));
+                int64_t committed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                for(const DeviceReading* row : writer.last_inserted()) {
+                    if(options.hot_ring) {
+                        options.hot_ring->publish(row->device_id, row->data);
+                    }
+                    if(row->sequence >= 0) {
+                        int64_t lag_ms = committed_ms - row->data.timestamp_unix * 1000;
+                        lag.record_value(lag_ms > 0 ? static_cast<uint64_t>(lag_ms) * 1000 : 0);
+                    }
+                }
+                committed_rows += result.inserted;
+                duplicates += result.duplicates;
+                late_rows += result.late;
+                ++committed_batches;
+                if(result.lag_rows > 0) {
+                    lag_rows += result.lag_rows;
+                    lag_sum_ms += result.lag_sum_ms;
+                    last_lag_max_ms = result.lag_max_ms;
+                }
+            }
+            catch(const std::exception& e) {
+                failed_rows += batch.size();
+                std::cerr << "Batch commit error (" << batch.size() << " rows): " << e.what() << std::endl;
+            }
+        }
+    }
+
+public:
+    // before_batch - в потоке писателя перед каждой пачкой; исключение срывает пачку
+    IngestPipeline(const std::string& db_path, IngestOptions opts = {}, std::function<void()> before_batch = nullptr)
+        : options(opts), queue(opts.queue_capacity), writer(db_path), before_batch(std::move(before_batch)) {
+        writer_thread = std::thread([this] { run(); });
+    }
+
+    ~IngestPipeline() {
+        stop();
+    }
+
+    // Вызывается из потока колбэка MQTT. Если очередь полна, колбэк ждёт
+    // enqueue_timeout (Paho перестаёт забирать сообщения - это и есть backpressure),
+    // после чего показание отбрасывается и учитывается в dropped.
+    // extra длиннее INGEST_EXTRA_MAX не хранится, само показание пишется.
+    bool submit(DeviceReading row) {
+        if(row.extra.size() > INGEST_EXTRA_MAX) {
+            row.extra = std::string();
+            ++extra_dropped;
+        }
+        switch(queue.push(std::move(row), options.enqueue_timeout)) {
+            case EnqueueResult::Accepted:
+                ++enqueued;
+                return true;
+            case EnqueueResult::AcceptedAfterWait:
+                ++enqueued;
+                ++backpressure_waits;
+                return true;
+            case EnqueueResult::Dropped:
+                ++backpressure_waits;
+                ++dropped;
+                return false;
+        }
+        return false;
+    }
+
+    // Дописывает всё, что уже в очереди, и останавливает писателя
+    void stop() {
+        queue.close();
+        if(writer_thread.joinable()) {
+            writer_thread.join();
+        }
+    }
+
+    IngestStats stats() const {
+        uint64_t lagged = lag_rows.load();
+        return {enqueued.load(), dropped.load(), backpressure_waits.load(),
+                committed_rows.load(), committed_batches.load(), failed_rows.load(),
+                duplicates.load(), late_rows.load(), extra_dropped.load(),
+                lagged ? lag_sum_ms.load() / static_cast<int64_t>(lagged) : 0, last_lag_max_ms.load(),
+                queue.size()};
+    }
+
+    const LatencyHistogram& commit_histogram() const {
+        return commit_latency;
+    }
+
+    const LatencyHistogram& lag_histogram() const {
+        return lag;
+    }
+};
+
+// По конвейеру (очередь + поток-писатель + свой файл) на шард: медленная ферма
+// забивает только свою очередь. Память ограничена shards * queue_capacity.
+class ShardedIngest {
+    DeviceDirectory& directory;
+    std::vector<std::unique_ptr<IngestPipeline>> shards;
+
+public:
+    ShardedIngest(const std::string& base_path, DeviceDirectory& dir, IngestOptions opts = {})
+        : directory(dir) {
+        for(size_t i = 0; i < dir.total_shards(); ++i) {
+            shards.push_back(std::make_unique<IngestPipeline>(shard_db_path(base_path, i), opts,
+                [this, i]() { directory.save_new_devices(i); }));
+        }
+    }
+
+    // sequence -1: показание без номера публикации, повторы не отсекаются.
+    // Новое устройство сверх MAX_DEVICES - std::runtime_error
+    bool submit(const std::string& device, const SensorData& data, int64_t sequence, int64_t received_at,
+                std::string extra = std::string()) {
+        DeviceReading row;
+        copy_device_id(row.device_id, device);
+        row.data = data;
+        row.sequence = sequence;
+        row.received_at = received_at;
+        row.extra = std::move(extra);
+        size_t shard = directory.shard_for(device);
+        return shard < shards.size() && shards[shard]->submit(std::move(row));
+    }
+
+    void stop() {
+        for(auto& shard : shards) {
+            shard->stop();
+        }
+    }
+
+    size_t shard_count() const {
+        return shards.size();
+    }
+
+    IngestStats stats(size_t shard) const {
+        return shards[shard]->stats();
+    }
+
+    const IngestPipeline& shard(size_t index) const {
+        return *shards[index];
+    }
+
+    IngestStats stats() const {
+        IngestStats total{};
+        for(const auto& shard : shards) {
+            IngestStats s = shard->stats();
+            total.enqueued += s.enqueued;
+            total.dropped += s.dropped;
+            total.backpressure_waits += s.backpressure_waits;
+            total.committed_rows += s.committed_rows;
+            total.committed_batches += s.committed_batches;
+            total.failed_rows += s.failed_rows;
+            total.duplicates += s.duplicates;
+            total.late_rows += s.late_rows;
+            total.extra_dropped += s.extra_dropped;
+            total.lag_avg_ms = std::max(total.lag_avg_ms, s.lag_avg_ms);
+            total.last_lag_max_ms = std::max(total.last_lag_max_ms, s.last_lag_max_ms);
+            total.queue_depth += s.queue_depth;
+        }
+        return total;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const IngestStats& s) {
+    return os << "enqueued=" << s.enqueued
+              << " committed=" << s.committed_rows
+              << " batches=" << s.committed_batches
+              << " failed=" << s.failed_rows
+              << " duplicates=" << s.duplicates
+              << " late=" << s.late_rows
+              << " extra_dropped=" << s.extra_dropped
+              << " dropped=" << s.dropped
+              << " backpressure_waits=" << s.backpressure_waits
+              << " queue_depth=" << s.queue_depth
+              << " lag_avg_ms=" << s.lag_avg_ms
+              << " lag_max_ms=" << s.last_lag_max_ms;
+}
+
+// По шардам: темп записи - rate(iop_ingest_committed_rows_total)
+inline void write_metrics(MetricsWriter& out, const ShardedIngest& ingest) {
+    for(size_t i = 0; i < ingest.shard_count(); ++i) {
+        IngestStats s = ingest.stats(i);
+        std::string labels = "shard=\"" + std::to_string(i) + "\"";
+        out.counter("iop_ingest_enqueued_total", "Readings accepted into the ingest queue", s.enqueued, labels);
+        out.counter("iop_ingest_committed_rows_total", "Rows committed to SQLite", s.committed_rows, labels);
+        out.counter("iop_ingest_batches_total", "Batches committed", s.committed_batches, labels);
+        out.counter("iop_ingest_failed_rows_total", "Rows in batches that failed to commit", s.failed_rows, labels);
+        out.counter("iop_ingest_duplicates_total", "Repeated readings skipped by the unique key", s.duplicates, labels);
+        out.counter("iop_ingest_late_rows_total", "Readings for days already sealed into blocks", s.late_rows, labels);
+        out.counter("iop_ingest_extra_dropped_total", "Readings whose unknown keys were too long to keep",
+                    s.extra_dropped, labels);
+        out.counter("iop_ingest_dropped_total", "Readings dropped with a full queue", s.dropped, labels);
+        out.counter("iop_ingest_backpressure_waits_total", "Times the MQTT callback waited for queue space",
+                    s.backpressure_waits, labels);
+        out.gauge("iop_ingest_queue_depth", "Readings waiting in the queue", static_cast<double>(s.queue_depth), labels);
+        out.gauge("iop_ingest_last_lag_max_seconds", "Largest device-to-commit lag in the last batch",
+                  s.last_lag_max_ms / 1000.0, labels);
+        out.histogram("iop_ingest_lag_seconds", "From the reading on the device to the commit",
+                      ingest.shard(i).lag_histogram(), labels);
+        out.histogram("iop_sqlite_batch_commit_seconds", "Writing one batch: BEGIN, inserts, rollups, COMMIT",
+                      ingest.shard(i).commit_histogram(), labels);
+    }
+}
+
+// Разбор JSON от контроллера (ключи как в controller/IoP_Farm/data/data.json) за один
+// проход, см. sensor_parser.h: метрики без значения - SENSOR_MISSING, неизвестные ключи - в extra.
+// Прошивка добавляет "timestamp" (NTP) и "seq"; без них - время прихода на сервер
+// и sequence = -1. Время устройства, убежавшее вперёд, тоже заменяется серверным.
+inline SensorData parse_sensor_payload(const std::string& payload, int64_t received_at, int64_t& sequence,
+                                       std::string& extra) {
+    thread_local SensorPayload parsed;
+    scan_sensor_payload(payload, parsed);
+    SensorData row = parsed.row;
+    row.timestamp_unix = received_at;
+    sequence = -1;
+    if(parsed.has_timestamp && parsed.has_seq) {
+        if(parsed.timestamp > 0 && parsed.timestamp <= received_at + MAX_DEVICE_CLOCK_SKEW_SEC) {
+            row.timestamp_unix = parsed.timestamp;
+            sequence = parsed.seq;
+        }
+    }
+    extra = parsed.extra;
+    return row;
+}
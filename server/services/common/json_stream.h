@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "sensor_data.h"
+
+// Ответ JSON {"count":N,"data":[{...},...]}\n без построения nlohmann::json: строки
+// пишутся сразу в буфер фиксированного размера, полный буфер уходит в sink(data, size).
+// Вывод совпадает с прежним json.dump() побайтно: ключи записи в порядке std::map
+// (как у nlohmann::json), числа с плавающей точкой - тем же Grisu2 из nlohmann
+// (detail::to_chars), нечисловые значения - null. fields - какие метрики попадают в запись
+// (время - всегда).
+
+constexpr size_t JSON_STREAM_BUFFER = 64 * 1024;
+constexpr size_t JSON_RECORD_MAX = 512;   // Запись с любыми значениями короче
+
+template <typename Sink>
+class JsonRowStream {
+    struct Key {
+        std::string text;   // ,"name":
+        int field;          // -1 - timestamp
+    };
+
+    Sink sink;
+    std::vector<char> buffer;
+    size_t used = 0;
+    size_t records = 0;
+    std::vector<Key> keys;
+
+    void put(const char* data, size_t size) {
+        if(used + size > buffer.size()) {
+            flush();
+        }
+        std::memcpy(buffer.data() + used, data, size);
+        used += size;
+    }
+
+    template <typename T>
+    static char* put_integer(char* out, T value) {
+        return std::to_chars(out, out + 24, value).ptr;
+    }
+
+    static char* put_double(char* out, double value) {
+        if(!std::isfinite(value)) {
+            std::memcpy(out, "null", 4);
+            return out + 4;
+        }
+        return nlohmann::detail::to_chars(out, out + 64, value);
+    }
+
+    void flush() {
+        if(used > 0) {
+            sink(buffer.data(), used);
+            used = 0;
+        }
+    }
+
+public:
+    explicit JsonRowStream(Sink out, FieldMask fields = ALL_SENSOR_FIELDS, size_t buffer_bytes = JSON_STREAM_BUFFER)
+        : sink(std::move(out)), buffer(std::max(buffer_bytes, JSON_RECORD_MAX)) {
+        keys.push_back({"timestamp", -1});
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            if(has_sensor_field(fields, i)) {
+                keys.push_back({SENSOR_FIELDS[i], static_cast<int>(i)});
+            }
+        }
+        std::sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) { return a.text < b.text; });
+        for(auto& key : keys) {
+            key.text = ",\"" + key.text + "\":";
+        }
+        keys.front().text[0] = '{';
+    }
+
+    void begin(size_t count) {
+        records = 0;
+        char head[48] = "{\"count\":";
+        char* end = put_integer(head + 9, count);
+        std::memcpy(end, ",\"data\":[", 9);
+        put(head, end + 9 - head);
+    }
+
+    void add(const SensorData& row) {
+        if(used + JSON_RECORD_MAX > buffer.size()) {
+            flush();
+        }
+        char* out = buffer.data() + used;
+        if(records > 0) {
+            *out++ = ',';
+        }
+        for(const auto& key : keys) {
+            std::memcpy(out, key.text.data(), key.text.size());
+            out += key.text.size();
+            out = key.field < 0 ? put_integer(out, row.timestamp_unix) : put_double(out, sensor_field(row, key.field));
+        }
+        *out++ = '}';
+        used = out - buffer.data();
+        ++records;
+    }
+
+    void finish() {
+        put("]}\n", 3);
+        flush();
+    }
+
+    size_t count() const { return records; }
+};
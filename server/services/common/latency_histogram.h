@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Гистограмма задержек для перцентилей без хранения выборки: по 8 корзин на каждую
+// степень двойки микросекунд, погрешность перцентиля не больше 1/8. Запись - несколько
+// атомарных инкрементов, можно звать из любых потоков. Годится и не для времени
+// (строк в ответе и т.п.): record_value пишет число как есть.
+class LatencyHistogram {
+    static constexpr size_t SUB_BUCKETS = 8;
+    static constexpr size_t OCTAVES = 40;  // До ~12 суток
+    static constexpr size_t BUCKETS = SUB_BUCKETS * OCTAVES;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum_us{0};
+    std::atomic<uint64_t> max_us{0};
+
+    static size_t bucket_of(uint64_t us) {
+        if(us < SUB_BUCKETS) {
+            return static_cast<size_t>(us);
+        }
+        size_t octave = 63 - static_cast<size_t>(__builtin_clzll(us));  // >= 3
+        size_t sub = static_cast<size_t>(us >> (octave - 3)) & (SUB_BUCKETS - 1);
+        size_t index = (octave - 2) * SUB_BUCKETS + sub;
+        return index < BUCKETS ? index : BUCKETS - 1;
+    }
+
+    // Верхняя граница корзины
+    static uint64_t bucket_limit(size_t index) {
+        if(index < SUB_BUCKETS) {
+            return index;
+        }
+        size_t octave = index / SUB_BUCKETS + 2;
+        uint64_t width = 1ull << (octave - 3);
+        return (SUB_BUCKETS + index % SUB_BUCKETS) * width + width - 1;
+    }
+
+public:
+    struct Snapshot {
+        uint64_t count;
+        uint64_t p50_us;
+        uint64_t p99_us;
+        uint64_t max_us;
+    };
+
+    void record(std::chrono::microseconds latency) {
+        record_value(latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0);
+    }
+
+    void record_value(uint64_t us) {
+        buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(us, std::memory_order_relaxed);
+        uint64_t seen = max_us.load(std::memory_order_relaxed);
+        while(us > seen && !max_us.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {}
+    }
+
+    // q в (0, 1]; 0, если записей не было
+    uint64_t percentile(double q) const {
+        uint64_t count = total.load(std::memory_order_relaxed);
+        if(count == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * count + 0.999999);
+        uint64_t seen = 0;
+        for(size_t i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if(seen >= rank) {
+                uint64_t limit = bucket_limit(i);
+                uint64_t max = max_us.load(std::memory_order_relaxed);
+                return limit < max ? limit : max;
+            }
+        }
+        return max_us.load(std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const {
+        return sum_us.load(std::memory_order_relaxed);
+    }
+
+    // f(верхняя граница корзины, записей в корзине) по возрастанию границ. Граница
+    // последней корзины октавы - 2^k - 1, так что счёт "меньше 2^k" точный
+    template <typename F>
+    void for_each_bucket(F&& f) const {
+        for(size_t i = 0; i < BUCKETS; ++i) {
+            f(bucket_limit(i), buckets[i].load(std::memory_order_relaxed));
+        }
+    }
+
+    Snapshot snapshot() const {
+        return {total.load(std::memory_order_relaxed), percentile(0.50), percentile(0.99),
+                max_us.load(std::memory_order_relaxed)};
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const LatencyHistogram::Snapshot& s) {
+    return os << "requests=" << s.count
+              << " p50_us=" << s.p50_us
+              << " p99_us=" << s.p99_us
+              << " max_us=" << s.max_us;
+}
@@ -0,0 +1,712 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+#include "metrics.h"
+
+// Журнал прошивки фермы. Пачка с /<device>/log (до MAX_PACKET_SIZE строк через '\n',
+// MQTTLogTransport::flushLogs) разбирается на записи: уровень из префикса StandardFormatter
+// ("[ERROR] ", "[WARN]  ", ...) и модуль из следующей пары скобок ("[MQTT] "). Записи
+// устройства копятся в блок до LOG_BLOCK_RECORDS строк или LOG_FLUSH_INTERVAL и
+// дописываются сжатым zstd блоком в файл часа <root>/<device>/<начало часа, мс>.seg.
+// Рядом, в .idx, на каждый блок одна запись LogBlockEntry: время первой и последней строки,
+// смещение и битовые карты уровней и модулей блока. Это и редкий индекс по времени,
+// и инвертированный индекс: запрос "ERROR за 6 часов" открывает только часы диапазона,
+// читает их .idx и распаковывает лишь блоки, где есть ошибки.
+// Номера модулей общие для всех ферм (файл <root>/modules, строка - модуль).
+
+constexpr int64_t LOG_SEGMENT_MS = 3600 * 1000;
+constexpr size_t LOG_BLOCK_RECORDS = 512;
+constexpr std::chrono::seconds LOG_FLUSH_INTERVAL{5};  // Столько запись может ждать в памяти
+constexpr int64_t LOG_RETENTION_MS = 30LL * 86400 * 1000;
+constexpr int LOG_ZSTD_LEVEL = 3;
+constexpr size_t LOG_MODULE_BITS = 64;  // Модули с номером >= 63 делят последний бит
+constexpr size_t LOG_MAX_TEXT = 0xFFFF;
+
+enum class LogLevel : uint8_t { Error, Warning, Info, Farm, Debug, Test, Unknown };
+
+constexpr size_t LOG_LEVELS_COUNT = 7;
+const char* const LOG_LEVEL_NAMES[LOG_LEVELS_COUNT] = {"ERROR", "WARN", "INFO", "FARM", "DEBUG", "TEST", "?"};
+constexpr uint8_t ALL_LOG_LEVELS = (1u << LOG_LEVELS_COUNT) - 1;
+
+inline bool parse_log_level(const std::string& name, LogLevel& level) {
+    for(size_t i = 0; i < LOG_LEVELS_COUNT - 1; ++i) {
+        if(name == LOG_LEVEL_NAMES[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    if(name == "WARNING") {
+        level = LogLevel::Warning;
+        return true;
+    }
+    return false;
+}
+
+inline uint8_t log_level_bit(LogLevel level) {
+    return static_cast<uint8_t>(1u << static_cast<unsigned>(level));
+}
+
+struct LogRecord {
+    int64_t time_ms;     // Время прихода пачки на сервер: своих меток у строк прошивки нет
+    LogLevel level;
+    std::string module;  // Пусто - без модуля
+    std::string text;    // Строка без префиксов уровня и модуля
+};
+
+// Цветной MQTT-логгер прошивки (ColorFormatter) оборачивает строку в ESC[..m
+inline void strip_ansi(std::string& line) {
+    size_t out = 0;
+    for(size_t i = 0; i < line.size(); ++i) {
+        if(line[i] == '\x1b' && i + 1 < line.size() && line[i + 1] == '[') {
+            i += 2;
+            while(i < line.size() && !(line[i] >= '@' && line[i] <= '~')) {
+                ++i;
+            }
+            continue;
+        }
+        line[out++] = line[i];
+    }
+    line.resize(out);
+}
+
+// "[ERROR] [MQTT] Ошибка публикации" -> Error, "MQTT", "Ошибка публикации"
+inline LogRecord parse_log_line(std::string line, int64_t time_ms) {
+    strip_ansi(line);
+    LogRecord record{time_ms, LogLevel::Unknown, std::string(), std::string()};
+    size_t pos = 0;
+    auto bracket = [&line, &pos](std::string& inside) {
+        if(pos >= line.size() || line[pos] != '[') {
+            return false;
+        }
+        size_t close = line.find(']', pos + 1);
+        if(close == std::string::npos || close - pos - 1 > 32) {
+            return false;
+        }
+        inside = line.substr(pos + 1, close - pos - 1);
+        pos = close + 1;
+        while(pos < line.size() && line[pos] == ' ') {
+            ++pos;
+        }
+        return true;
+    };
+    std::string inside;
+    size_t start = pos;
+    if(bracket(inside) && !parse_log_level(inside, record.level)) {
+        pos = start;  // Строка без уровня начинается со скобок модуля
+    }
+    start = pos;
+    if(bracket(inside) && !inside.empty() && inside.find('%') == std::string::npos) {
+        record.module = inside;
+    }
+    else {
+        pos = start;
+    }
+    record.text = line.substr(pos, LOG_MAX_TEXT);
+    return record;
+}
+
+// Строки пачки по порядку; пустые и '\r' в конце пропускаются
+template <typename F>
+size_t split_log_batch(const std::string& payload, F&& on_line) {
+    size_t lines = 0;
+    size_t begin = 0;
+    while(begin < payload.size()) {
+        size_t end = payload.find('\n', begin);
+        if(end == std::string::npos) {
+            end = payload.size();
+        }
+        size_t last = end;
+        while(last > begin && (payload[last - 1] == '\r' || payload[last - 1] == ' ')) {
+            --last;
+        }
+        if(last > begin) {
+            on_line(payload.substr(begin, last - begin));
+            ++lines;
+        }
+        begin = end + 1;
+    }
+    return lines;
+}
+
+#pragma pack(push, 1)
+struct LogBlockEntry {
+    int64_t first_ms;
+    int64_t last_ms;
+    uint64_t offset;         // В .seg
+    uint32_t stored_bytes;   // Сжатый блок
+    uint32_t raw_bytes;
+    uint32_t records;
+    uint8_t levels;          // Бит log_level_bit - в блоке есть строки уровня
+    uint8_t reserved[3];
+    uint64_t modules;        // Бит номера модуля (LogModules)
+};
+
+// Запись в распакованном блоке, за ней module_length байт модуля и text_length байт текста
+struct LogRecordHeader {
+    uint32_t offset_ms;      // От first_ms блока
+    uint8_t level;
+    uint8_t module_length;
+    uint16_t text_length;
+};
+#pragma pack(pop)
+
+inline int64_t log_segment_start(int64_t time_ms) {
+    return time_ms - time_ms % LOG_SEGMENT_MS;
+}
+
+inline std::string log_segment_path(const std::string& root, const std::string& device, int64_t start,
+                                    const char* extension) {
+    return root + "/" + device + "/" + std::to_string(start) + extension;
+}
+
+inline void make_log_dir(const std::string& path) {
+    if(mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+    }
+}
+
+// Номера модулей: у писателя - единственного, кто дописывает файл, - и у читателей
+class LogModules {
+    std::string path;
+    std::unordered_map<std::string, uint32_t> ids;
+
+public:
+    explicit LogModules(const std::string& root) : path(root + "/modules") {
+        reload();
+    }
+
+    void reload() {
+        std::ifstream in(path);
+        std::string name;
+        while(std::getline(in, name)) {
+            ids.emplace(name, static_cast<uint32_t>(ids.size()));
+        }
+    }
+
+    bool find(const std::string& module, uint32_t& id) const {
+        auto it = ids.find(module);
+        if(it == ids.end()) {
+            return false;
+        }
+        id = it->second;
+        return true;
+    }
+
+    uint32_t get_or_add(const std::string& module) {
+        uint32_t id;
+        if(find(module, id)) {
+            return id;
+        }
+        std::ofstream out(path, std::ios::app);
+        out << module << '\n';
+        if(!out) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+        id = static_cast<uint32_t>(ids.size());
+        ids.emplace(module, id);
+        return id;
+    }
+
+    static uint64_t bit(uint32_t id) {
+        return 1ull << std::min<uint32_t>(id, LOG_MODULE_BITS - 1);
+    }
+};
+
+struct LogStoreStats {
+    uint64_t batches;
+    uint64_t records;
+    uint64_t blocks;
+    uint64_t raw_bytes;
+    uint64_t stored_bytes;
+    uint64_t failed;     // Блоков, которые не удалось записать
+    size_t pending;      // Записей в памяти, ещё не в блоках
+};
+
+inline std::ostream& operator<<(std::ostream& os, const LogStoreStats& s) {
+    return os << "batches=" << s.batches
+              << " records=" << s.records
+              << " blocks=" << s.blocks
+              << " raw_bytes=" << s.raw_bytes
+              << " stored_bytes=" << s.stored_bytes
+              << " failed=" << s.failed
+              << " pending=" << s.pending;
+}
+
+// Запись: add() из колбэка MQTT только кладёт записи в очередь устройства,
+// сжатие и запись на диск - в своём потоке
+class LogStoreWriter {
+    struct Segment {
+        int64_t start = -1;
+        int data = -1;
+        int index = -1;
+        uint64_t end = 0;
+
+        void close() {
+            if(data >= 0) {
+                ::close(data);
+            }
+            if(index >= 0) {
+                ::close(index);
+            }
+            data = index = -1;
+            start = -1;
+        }
+    };
+
+    struct Device {
+        std::vector<LogRecord> records;
+        std::chrono::steady_clock::time_point first_added;
+    };
+
+    std::string root;
+    LogModules modules;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::unordered_map<std::string, Device> pending;
+    size_t pending_records = 0;
+    bool stopping = false;
+    std::unordered_map<std::string, Segment> segments;  // Только поток записи
+    int64_t last_cleanup = 0;
+    ZSTD_CCtx* zstd = nullptr;
+    std::thread writer;
+
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> records_total{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> raw_total{0};
+    std::atomic<uint64_t> stored_total{0};
+    std::atomic<uint64_t> failed{0};
+
+    // Открывает час для дописывания; хвост после последнего проиндексированного блока
+    // (сбой между записью блока и .idx) обрезается
+    Segment& open_segment(const std::string& device, int64_t start) {
+        Segment& segment = segments[device];
+        if(segment.start == start) {
+            return segment;
+        }
+        segment.close();
+        make_log_dir(root + "/" + device);
+        std::string index_path = log_segment_path(root, device, start, ".idx");
+        std::string data_path = log_segment_path(root, device, start, ".seg");
+        segment.index = ::open(index_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        segment.data = ::open(data_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if(segment.index < 0 || segment.data < 0) {
+            segment.close();
+            throw std::runtime_error("Cannot open " + data_path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        fstat(segment.index, &st);
+        size_t entries = static_cast<size_t>(st.st_size) / sizeof(LogBlockEntry);
+        segment.end = 0;
+        if(entries > 0) {
+            LogBlockEntry last;
+            if(pread(segment.index, &last, sizeof(last), (entries - 1) * sizeof(LogBlockEntry)) == sizeof(last)) {
+                segment.end = last.offset + last.stored_bytes;
+            }
+        }
+        if(ftruncate(segment.index, entries * sizeof(LogBlockEntry)) != 0 ||
+           ftruncate(segment.data, static_cast<off_t>(segment.end)) != 0) {
+            segment.close();
+            throw std::runtime_error("Cannot truncate " + data_path + ": " + std::strerror(errno));
+        }
+        segment.start = start;
+        return segment;
+    }
+
+    static bool write_at(int fd, const void* data, size_t size, uint64_t offset) {
+        const uint8_t* in = static_cast<const uint8_t*>(data);
+        while(size > 0) {
+            ssize_t n = pwrite(fd, in, size, static_cast<off_t>(offset));
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return false;
+            }
+            in += n;
+            size -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    // Записи одного часа, по порядку прихода
+    void write_block(const std::string& device, const LogRecord* begin, const LogRecord* end) {
+        LogBlockEntry entry{};
+        entry.first_ms = begin->time_ms;
+        entry.last_ms = begin->time_ms;
+        std::vector<uint8_t> raw;
+        for(const LogRecord* r = begin; r != end; ++r) {
+            entry.first_ms = std::min(entry.first_ms, r->time_ms);
+            entry.last_ms = std::max(entry.last_ms, r->time_ms);
+        }
+        for(const LogRecord* r = begin; r != end; ++r) {
+            LogRecordHeader header;
+            header.offset_ms = static_cast<uint32_t>(r->time_ms - entry.first_ms);
+            header.level = static_cast<uint8_t>(r->level);
+            header.module_length = static_cast<uint8_t>(std::min<size_t>(r->module.size(), 255));
+            header.text_length = static_cast<uint16_t>(std::min(r->text.size(), LOG_MAX_TEXT));
+            const uint8_t* h = reinterpret_cast<const uint8_t*>(&header);
+            raw.insert(raw.end(), h, h + sizeof(header));
+            raw.insert(raw.end(), r->module.begin(), r->module.begin() + header.module_length);
+            raw.insert(raw.end(), r->text.begin(), r->text.begin() + header.text_length);
+            entry.levels |= log_level_bit(r->level);
+            if(!r->module.empty()) {
+                entry.modules |= LogModules::bit(modules.get_or_add(r->module));
+            }
+        }
+        std::vector<uint8_t> packed(ZSTD_compressBound(raw.size()));
+        size_t stored = ZSTD_compressCCtx(zstd, packed.data(), packed.size(), raw.data(), raw.size(), LOG_ZSTD_LEVEL);
+        if(ZSTD_isError(stored)) {
+            throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(stored));
+        }
+        Segment& segment = open_segment(device, log_segment_start(entry.first_ms));
+        entry.offset = segment.end;
+        entry.stored_bytes = static_cast<uint32_t>(stored);
+        entry.raw_bytes = static_cast<uint32_t>(raw.size());
+        entry.records = static_cast<uint32_t>(end - begin);
+        // Сначала блок, потом запись индекса: читатель видит только целые блоки
+        struct stat st;
+        fstat(segment.index, &st);
+        if(!write_at(segment.data, packed.data(), stored, segment.end) ||
+           !write_at(segment.index, &entry, sizeof(entry), static_cast<uint64_t>(st.st_size))) {
+            throw std::runtime_error("Cannot append to " + log_segment_path(root, device, segment.start, ".seg") +
+                                     ": " + std::strerror(errno));
+        }
+        segment.end += stored;
+        ++blocks;
+        raw_total += raw.size();
+        stored_total += stored;
+    }
+
+    void write_device(const std::string& device, std::vector<LogRecord>& records) {
+        size_t begin = 0;
+        while(begin < records.size()) {
+            // Блок не пересекает границу часа и не длиннее LOG_BLOCK_RECORDS
+            int64_t segment = log_segment_start(records[begin].time_ms);
+            size_t end = begin + 1;
+            while(end < records.size() && end - begin < LOG_BLOCK_RECORDS &&
+                  log_segment_start(records[end].time_ms) == segment) {
+                ++end;
+            }
+            try {
+                write_block(device, records.data() + begin, records.data() + end);
+            }
+            catch(const std::exception& e) {
+                std::cerr << "Log store " << device << ": " << e.what() << std::endl;
+                segments[device].close();
+                ++failed;
+            }
+            begin = end;
+        }
+    }
+
+    // Часы старше LOG_RETENTION_MS удаляются файлами
+    void cleanup(int64_t now_ms) {
+        if(now_ms - last_cleanup < LOG_SEGMENT_MS) {
+            return;
+        }
+        last_cleanup = now_ms;
+        DIR* dir = opendir(root.c_str());
+        if(!dir) {
+            return;
+        }
+        std::vector<std::string> devices;
+        while(dirent* entry = readdir(dir)) {
+            if(entry->d_name[0] != '.' && entry->d_type == DT_DIR) {
+                devices.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        for(const auto& device : devices) {
+            DIR* files = opendir((root + "/" + device).c_str());
+            if(!files) {
+                continue;
+            }
+            std::vector<std::string> old;
+            while(dirent* entry = readdir(files)) {
+                char* end = nullptr;
+                long long start = std::strtoll(entry->d_name, &end, 10);
+                if(end != entry->d_name && *end == '.' && start + LOG_SEGMENT_MS < now_ms - LOG_RETENTION_MS) {
+                    old.push_back(root + "/" + device + "/" + entry->d_name);
+                }
+            }
+            closedir(files);
+            for(const auto& path : old) {
+                std::remove(path.c_str());
+            }
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true) {
+            wake.wait_for(lock, std::chrono::seconds(1));
+            auto now = std::chrono::steady_clock::now();
+            std::vector<std::pair<std::string, std::vector<LogRecord>>> ready;
+            for(auto& device : pending) {
+                if(!device.second.records.empty() &&
+                   (stopping || device.second.records.size() >= LOG_BLOCK_RECORDS ||
+                    now - device.second.first_added >= LOG_FLUSH_INTERVAL)) {
+                    pending_records -= device.second.records.size();
+                    ready.emplace_back(device.first, std::move(device.second.records));
+                    device.second.records.clear();
+                }
+            }
+            bool finished = stopping;
+            lock.unlock();
+            for(auto& device : ready) {
+                write_device(device.first, device.second);
+            }
+            cleanup(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+            lock.lock();
+            if(finished) {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit LogStoreWriter(const std::string& root_dir) : root(root_dir), modules((make_log_dir(root_dir), root_dir)) {
+        zstd = ZSTD_createCCtx();
+        if(!zstd) {
+            throw std::runtime_error("Cannot create zstd context");
+        }
+        writer = std::thread([this]() { run(); });
+    }
+
+    LogStoreWriter(const LogStoreWriter&) = delete;
+    LogStoreWriter& operator=(const LogStoreWriter&) = delete;
+
+    // Дописывает всё, что в памяти
+    ~LogStoreWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        for(auto& segment : segments) {
+            segment.second.close();
+        }
+        ZSTD_freeCCtx(zstd);
+    }
+
+    // Пачка с /<device>/log: разбирается на записи со временем прихода
+    size_t add_batch(const std::string& device, const std::string& payload) {
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::vector<LogRecord> parsed;
+        split_log_batch(payload, [&parsed, now_ms](const std::string& line) {
+            parsed.push_back(parse_log_line(line, now_ms));
+        });
+        if(parsed.empty()) {
+            return 0;
+        }
+        bool full = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Device& state = pending[device];
+            if(state.records.empty()) {
+                state.first_added = std::chrono::steady_clock::now();
+            }
+            for(auto& record : parsed) {
+                state.records.push_back(std::move(record));
+            }
+            pending_records += parsed.size();
+            full = state.records.size() >= LOG_BLOCK_RECORDS;
+        }
+        if(full) {
+            wake.notify_one();
+        }
+        ++batches;
+        records_total += parsed.size();
+        return parsed.size();
+    }
+
+    LogStoreStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {batches.load(), records_total.load(), blocks.load(), raw_total.load(), stored_total.load(),
+                failed.load(), pending_records};
+    }
+};
+
+inline void write_metrics(MetricsWriter& out, LogStoreWriter& store) {
+    LogStoreStats s = store.stats();
+    out.counter("iop_log_batches_total", "Log batches received over MQTT", s.batches);
+    out.counter("iop_log_records_total", "Log lines stored", s.records);
+    out.counter("iop_log_blocks_total", "Compressed blocks written", s.blocks);
+    out.counter("iop_log_raw_bytes_total", "Block bytes before compression", s.raw_bytes);
+    out.counter("iop_log_stored_bytes_total", "Block bytes after compression", s.stored_bytes);
+    out.counter("iop_log_failed_blocks_total", "Blocks that could not be written", s.failed);
+    out.gauge("iop_log_pending_records", "Records in memory waiting for a block", static_cast<double>(s.pending));
+}
+
+struct LogQuery {
+    std::string device;
+    int64_t from_ms = 0;
+    int64_t to_ms = INT64_MAX;               // Включительно
+    uint8_t levels = ALL_LOG_LEVELS;         // Биты log_level_bit
+    std::string module;                      // Пусто - любой
+    std::string contains;                    // Подстрока текста; пусто - любой
+};
+
+struct LogQueryStats {
+    size_t segments;
+    size_t blocks;         // Блоков в часах диапазона
+    size_t blocks_read;    // Распакованных после индекса
+    size_t records_read;
+    size_t matched;
+};
+
+// Чтение: можно из другого процесса, пока сервис пишет
+class LogStoreReader {
+    std::string root;
+    LogModules modules;
+
+    std::vector<int64_t> segment_starts(const std::string& device, int64_t from_ms, int64_t to_ms) const {
+        std::vector<int64_t> starts;
+        DIR* dir = opendir((root + "/" + device).c_str());
+        if(!dir) {
+            return starts;
+        }
+        while(dirent* entry = readdir(dir)) {
+            char* end = nullptr;
+            long long start = std::strtoll(entry->d_name, &end, 10);
+            if(end != entry->d_name && std::strcmp(end, ".idx") == 0 &&
+               start <= to_ms && start + LOG_SEGMENT_MS > from_ms) {
+                starts.push_back(start);
+            }
+        }
+        closedir(dir);
+        std::sort(starts.begin(), starts.end());
+        return starts;
+    }
+
+    static std::vector<LogBlockEntry> read_index(const std::string& path) {
+        std::vector<LogBlockEntry> entries;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            return entries;
+        }
+        struct stat st;
+        if(fstat(fd, &st) == 0) {
+            entries.resize(static_cast<size_t>(st.st_size) / sizeof(LogBlockEntry));
+            size_t bytes = entries.size() * sizeof(LogBlockEntry);
+            if(pread(fd, entries.data(), bytes, 0) != static_cast<ssize_t>(bytes)) {
+                entries.clear();
+            }
+        }
+        ::close(fd);
+        return entries;
+    }
+
+public:
+    explicit LogStoreReader(const std::string& root_dir) : root(root_dir), modules(root_dir) {}
+
+    // Записи по порядку часов и блоков (по времени прихода); on_record возвращает false,
+    // чтобы остановиться
+    template <typename F>
+    LogQueryStats query(const LogQuery& q, F&& on_record) {
+        LogQueryStats stats{};
+        // 0 - без отбора по модулю: блоки из одних строк без [Module] (modules == 0) тоже читаются
+        uint64_t module_mask = 0;
+        if(!q.module.empty()) {
+            uint32_t id;
+            if(!modules.find(q.module, id)) {
+                modules.reload();  // Модуль мог появиться после открытия
+                if(!modules.find(q.module, id)) {
+                    return stats;
+                }
+            }
+            module_mask = LogModules::bit(id);
+        }
+        std::vector<uint8_t> packed, raw;
+        for(int64_t start : segment_starts(q.device, q.from_ms, q.to_ms)) {
+            ++stats.segments;
+            std::vector<LogBlockEntry> entries = read_index(log_segment_path(root, q.device, start, ".idx"));
+            stats.blocks += entries.size();
+            int fd = -1;
+            for(const auto& entry : entries) {
+                // Отсев по индексу: время, уровни и модули блока
+                if(entry.last_ms < q.from_ms || entry.first_ms > q.to_ms ||
+                   !(entry.levels & q.levels) || (module_mask && !(entry.modules & module_mask))) {
+                    continue;
+                }
+                if(fd < 0) {
+                    fd = ::open(log_segment_path(root, q.device, start, ".seg").c_str(), O_RDONLY | O_CLOEXEC);
+                    if(fd < 0) {
+                        break;
+                    }
+                }
+                packed.resize(entry.stored_bytes);
+                raw.resize(entry.raw_bytes);
+                if(pread(fd, packed.data(), packed.size(), static_cast<off_t>(entry.offset)) !=
+                   static_cast<ssize_t>(packed.size())) {
+                    continue;
+                }
+                size_t n = ZSTD_decompress(raw.data(), raw.size(), packed.data(), packed.size());
+                if(ZSTD_isError(n) || n != raw.size()) {
+                    continue;
+                }
+                ++stats.blocks_read;
+                size_t pos = 0;
+                for(uint32_t i = 0; i < entry.records && pos + sizeof(LogRecordHeader) <= raw.size(); ++i) {
+                    LogRecordHeader header;
+                    std::memcpy(&header, raw.data() + pos, sizeof(header));
+                    pos += sizeof(header);
+                    if(pos + header.module_length + header.text_length > raw.size()) {
+                        break;
+                    }
+                    ++stats.records_read;
+                    LogRecord record;
+                    record.time_ms = entry.first_ms + header.offset_ms;
+                    record.level = static_cast<LogLevel>(header.level);
+                    const char* bytes = reinterpret_cast<const char*>(raw.data() + pos);
+                    record.module.assign(bytes, header.module_length);
+                    record.text.assign(bytes + header.module_length, header.text_length);
+                    pos += header.module_length + header.text_length;
+                    if(record.time_ms < q.from_ms || record.time_ms > q.to_ms ||
+                       !(log_level_bit(record.level) & q.levels) ||
+                       (!q.module.empty() && record.module != q.module) ||
+                       (!q.contains.empty() && record.text.find(q.contains) == std::string::npos)) {
+                        continue;
+                    }
+                    ++stats.matched;
+                    if(!on_record(record)) {
+                        ::close(fd);
+                        return stats;
+                    }
+                }
+            }
+            if(fd >= 0) {
+                ::close(fd);
+            }
+        }
+        return stats;
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "latency_histogram.h"
+
+// Метрики сервиса в текстовом формате Prometheus: GET http://127.0.0.1:<порт>/metrics.
+// Источник - те же счётчики, что печатаются раз в минуту: сервис регистрирует сборщики,
+// которые при каждом опросе читают stats() и гистограммы и пишут их в MetricsWriter
+// (write_metrics рядом с каждым источником).
+// Гистограммы LatencyHistogram отдаются корзинами le = 2^k микросекунд (в секундах),
+// для значений не времени (строк в ответе) - le = 2^k.
+
+constexpr size_t METRICS_HISTOGRAM_BOUNDS = 36;   // 2^0 .. 2^35 мкс, ~9.5 ч
+constexpr std::chrono::seconds METRICS_REQUEST_TIMEOUT{5};
+
+class MetricsWriter {
+    struct Family {
+        std::string header;   // # HELP и # TYPE
+        std::string samples;
+    };
+
+    std::vector<std::string> order;
+    std::map<std::string, Family> families;
+
+    // Сэмплы одного имени должны идти подряд, даже если их пишут разные сборщики
+    std::string& family(const std::string& name, const std::string& help, const char* type) {
+        auto it = families.find(name);
+        if(it == families.end()) {
+            order.push_back(name);
+            it = families.emplace(name, Family{"# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n",
+                                               std::string()}).first;
+        }
+        return it->second.samples;
+    }
+
+    static std::string number(double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+
+    static std::string with_labels(const std::string& name, const std::string& labels) {
+        return labels.empty() ? name : name + "{" + labels + "}";
+    }
+
+public:
+    // labels - как в формате: port="1488",shard="0"
+    void counter(const std::string& name, const std::string& help, uint64_t value, const std::string& labels = "") {
+        family(name, help, "counter") += with_labels(name, labels) + " " + std::to_string(value) + "\n";
+    }
+
+    void gauge(const std::string& name, const std::string& help, double value, const std::string& labels = "") {
+        family(name, help, "gauge") += with_labels(name, labels) + " " + number(value) + "\n";
+    }
+
+    // scale: множитель значения гистограммы, 1e-6 - микросекунды в секунды
+    void histogram(const std::string& name, const std::string& help, const LatencyHistogram& h,
+                   const std::string& labels = "", double scale = 1e-6) {
+        uint64_t cumulative[METRICS_HISTOGRAM_BOUNDS] = {};
+        h.for_each_bucket([&cumulative](uint64_t limit, uint64_t count) {
+            // Первое k, при котором вся корзина меньше 2^k
+            size_t k = limit ? 64 - static_cast<size_t>(__builtin_clzll(limit)) : 0;
+            if(k < METRICS_HISTOGRAM_BOUNDS) {
+                cumulative[k] += count;
+            }
+        });
+        for(size_t k = 1; k < METRICS_HISTOGRAM_BOUNDS; ++k) {
+            cumulative[k] += cumulative[k - 1];
+        }
+        uint64_t count = h.count();
+        std::string& out = family(name, help, "histogram");
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        for(size_t k = 0; k < METRICS_HISTOGRAM_BOUNDS; ++k) {
+            out += name + "_bucket{" + prefix + "le=\"" + number(static_cast<double>(1ull << k) * scale) + "\"} " +
+                   std::to_string(cumulative[k]) + "\n";
+        }
+        out += name + "_bucket{" + prefix + "le=\"+Inf\"} " + std::to_string(count) + "\n";
+        out += with_labels(name + "_sum", labels) + " " + number(static_cast<double>(h.sum()) * scale) + "\n";
+        out += with_labels(name + "_count", labels) + " " + std::to_string(count) + "\n";
+    }
+
+    std::string text() const {
+        std::string out;
+        for(const auto& name : order) {
+            const Family& f = families.at(name);
+            out += f.header;
+            out += f.samples;
+        }
+        return out;
+    }
+};
+
+class MetricsRegistry {
+public:
+    using Collector = std::function<void(MetricsWriter& out)>;
+
+private:
+    std::mutex mutex;
+    std::vector<Collector> collectors;
+
+public:
+    void add(Collector collector) {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectors.push_back(std::move(collector));
+    }
+
+    std::string render() {
+        MetricsWriter out;
+        std::lock_guard<std::mutex> lock(mutex);
+        for(const auto& collect : collectors) {
+            collect(out);
+        }
+        return out.text();
+    }
+};
+
+// HTTP на 127.0.0.1 в своём потоке: опрос метрик не занимает io_context и пулы сервиса.
+// Соединение - один запрос; ответ собирается в потоке сервера метрик
+class MetricsServer {
+    MetricsRegistry& registry;
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread thread;
+
+    struct Connection : std::enable_shared_from_this<Connection> {
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::steady_timer deadline;
+        boost::asio::streambuf request{8192};
+        std::string response;
+
+        explicit Connection(boost::asio::io_context& io) : socket(io), deadline(io) {}
+    };
+
+    void accept() {
+        auto connection = std::make_shared<Connection>(io_context);
+        acceptor.async_accept(connection->socket, [this, connection](const boost::system::error_code& ec) {
+            if(!acceptor.is_open()) {
+                return;
+            }
+            if(!ec) {
+                serve(connection);
+            }
+            accept();
+        });
+    }
+
+    void serve(const std::shared_ptr<Connection>& connection) {
+        connection->deadline.expires_after(METRICS_REQUEST_TIMEOUT);
+        connection->deadline.async_wait([connection](const boost::system::error_code& ec) {
+            if(!ec) {
+                boost::system::error_code ignored;
+                connection->socket.close(ignored);
+            }
+        });
+        boost::asio::async_read_until(connection->socket, connection->request, "\r\n\r\n",
+            [this, connection](const boost::system::error_code& ec, size_t) {
+                if(ec) {
+                    connection->deadline.cancel();
+                    return;
+                }
+                std::string line;
+                std::istream is(&connection->request);
+                std::getline(is, line);
+                bool found = line.rfind("GET /metrics ", 0) == 0 || line.rfind("GET / ", 0) == 0;
+                std::string body = found ? registry.render() : "Not found\n";
+                connection->response = std::string(found ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n") +
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                    "Connection: close\r\n\r\n" + body;
+                boost::asio::async_write(connection->socket, boost::asio::buffer(connection->response),
+                    [connection](const boost::system::error_code&, size_t) {
+                        boost::system::error_code ignored;
+                        connection->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                        connection->socket.close(ignored);
+                        connection->deadline.cancel();
+                    });
+            });
+    }
+
+public:
+    MetricsServer(MetricsRegistry& metrics, unsigned short port)
+        : registry(metrics),
+          acceptor(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port)) {
+        accept();
+        thread = std::thread([this]() { io_context.run(); });
+    }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    ~MetricsServer() {
+        io_context.stop();
+        thread.join();
+    }
+};
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+#include "sensor_data.h"
+#include "row_filter.h"
+#include "sqlite_pool.h"
+
+// Сырые показания шарда разложены по месячным файлам рядом с ним:
+// data.db -> data.202605.db, data.202606.db, ...; data_1.db -> data_1.202605.db, ...
+// В каждом - своя sensor_data с покрывающим индексом (device_id, timestamp_unix, метрики).
+// Запрос по диапазону открывает только месяцы, которые с ним пересекаются.
+// Закончившийся месяц переводится в режим только для чтения (без WAL, chmod 0444),
+// такие файлы читаются с immutable=1 через пул соединений с mmap (sqlite_pool.h).
+// Старые сырые данные удаляются вместе с файлом, без DELETE.
+
+// Писатель отпускает месяц, в который давно не было строк; закрывается месяц
+// (finalize_partition) не раньше чем через сутки после конца
+constexpr int64_t PARTITION_IDLE_CLOSE_SEC = 600;
+constexpr int64_t PARTITION_FINALIZE_DELAY_SEC = 86400;
+
+// 2026-05-17 -> 202605 (UTC)
+inline int partition_month(int64_t timestamp) {
+    time_t t = static_cast<time_t>(timestamp);
+    std::tm tm{};
+    gmtime_r(&t, &tm);
+    return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+inline int64_t partition_month_start(int month) {
+    std::tm tm{};
+    tm.tm_year = month / 100 - 1900;
+    tm.tm_mon = month % 100 - 1;
+    tm.tm_mday = 1;
+    return static_cast<int64_t>(timegm(&tm));
+}
+
+inline int next_partition_month(int month) {
+    return month % 100 == 12 ? (month / 100 + 1) * 100 + 1 : month + 1;
+}
+
+// Первая секунда следующего месяца
+inline int64_t partition_month_end(int month) {
+    return partition_month_start(next_partition_month(month));
+}
+
+inline std::string partition_path(const std::string& shard_path, int month) {
+    auto dot = shard_path.rfind('.');
+    if(dot == std::string::npos || shard_path.find('/', dot) != std::string::npos) {
+        return shard_path + "." + std::to_string(month);
+    }
+    return shard_path.substr(0, dot) + "." + std::to_string(month) + shard_path.substr(dot);
+}
+
+// Существующие месячные файлы шарда по возрастанию
+inline std::vector<int> list_partitions(const std::string& shard_path) {
+    std::string dir = ".";
+    std::string name = shard_path;
+    auto slash = shard_path.rfind('/');
+    if(slash != std::string::npos) {
+        dir = shard_path.substr(0, slash);
+        name = shard_path.substr(slash + 1);
+    }
+    auto dot = name.rfind('.');
+    std::string stem = dot == std::string::npos ? name : name.substr(0, dot);
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+
+    std::vector<int> months;
+    DIR* d = opendir(dir.c_str());
+    if(!d) {
+        return months;
+    }
+    while(dirent* entry = readdir(d)) {
+        std::string file = entry->d_name;
+        // stem + "." + YYYYMM + ext
+        if(file.size() != stem.size() + 7 + ext.size() || file.compare(0, stem.size(), stem) != 0 ||
+           file[stem.size()] != '.' || file.compare(file.size() - ext.size(), ext.size(), ext) != 0) {
+            continue;
+        }
+        std::string digits = file.substr(stem.size() + 1, 6);
+        if(std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            months.push_back(std::stoi(digits));
+        }
+    }
+    closedir(d);
+    std::sort(months.begin(), months.end());
+    return months;
+}
+
+inline bool partition_is_readonly(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & 0222) == 0;
+}
+
+// Пулы соединений читателей с месячными файлами одного шарда
+class PartitionReaders {
+    struct Pool {
+        std::shared_ptr<ReadPool> pool;
+        bool immutable;
+    };
+
+    std::string shard_path;
+    std::map<int, Pool> pools;
+    std::mutex mutex;
+
+public:
+    explicit PartitionReaders(const std::string& path) : shard_path(path) {}
+
+    PartitionReaders(const PartitionReaders&) = delete;
+    PartitionReaders& operator=(const PartitionReaders&) = delete;
+
+    const std::string& path() const { return shard_path; }
+
+    // Пустой Lease, если месяца нет (не было данных или файл уже удалён по сроку хранения).
+    // Закрытые месяцы - immutable: без блокировок и -shm.
+    ReadPool::Lease get(int month) {
+        std::string path = partition_path(shard_path, month);
+        struct stat st;
+        bool exists = stat(path.c_str(), &st) == 0;
+        bool immutable = exists && (st.st_mode & 0222) == 0;
+        std::shared_ptr<ReadPool> pool;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = pools.find(month);
+            // Месяц закрыт после открытия: новые соединения - уже immutable,
+            // выданные раньше доживут в старом пуле
+            if(it != pools.end() && (!exists || it->second.immutable != immutable)) {
+                pools.erase(it);
+                it = pools.end();
+            }
+            if(!exists) {
+                return ReadPool::Lease();
+            }
+            if(it == pools.end()) {
+                std::string uri = "file:" + path + (immutable ? "?immutable=1" : "?mode=ro");
+                it = pools.emplace(month, Pool{std::make_shared<ReadPool>(uri), immutable}).first;
+            }
+            pool = it->second.pool;
+        }
+        return pool->checkout();
+    }
+};
+
+const char* const SCAN_SENSOR_SQL =
+    "SELECT timestamp_unix, temperature_DHT22, "
+    "temperature_DS18B20, humidity, water_level, "
+    "soil_moisture, light_intensity "
+    "FROM sensor_data "
+    "WHERE device_id = ? AND timestamp_unix BETWEEN ? AND ? "
+    "ORDER BY timestamp_unix;";
+
+const char* const LATEST_SENSOR_SQL =
+    "SELECT timestamp_unix, temperature_DHT22, "
+    "temperature_DS18B20, humidity, water_level, "
+    "soil_moisture, light_intensity "
+    "FROM sensor_data "
+    "WHERE device_id = ? "
+    "ORDER BY timestamp_unix DESC LIMIT 1;";
+
+const char* const COUNT_SENSOR_SQL =
+    "SELECT COUNT(*) FROM sensor_data "
+    "WHERE device_id = ? AND timestamp_unix BETWEEN ? AND ?;";
+
+// Условия фильтра после "timestamp_unix BETWEEN ? AND ?"; значения - параметры с 4-го
+inline std::string sensor_filter_sql(const RowFilter& filter) {
+    std::string sql;
+    for(const auto& predicate : filter.predicates) {
+        sql += std::string(" AND ") + SENSOR_FIELDS[predicate.field] + " " +
+               COMPARE_OP_SQL[static_cast<size_t>(predicate.op)] + " ?";
+    }
+    return sql;
+}
+
+// SCAN_SENSOR_SQL только со столбцами filter.columns() и условиями фильтра
+inline std::string scan_sensor_sql(const RowFilter& filter) {
+    if(filter.trivial()) {
+        return SCAN_SENSOR_SQL;
+    }
+    std::string sql = "SELECT timestamp_unix";
+    FieldMask columns = filter.columns();
+    for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+        if(has_sensor_field(columns, i)) {
+            sql += std::string(", ") + SENSOR_FIELDS[i];
+        }
+    }
+    return sql + " FROM sensor_data WHERE device_id = ? AND timestamp_unix BETWEEN ? AND ?" +
+           sensor_filter_sql(filter) + " ORDER BY timestamp_unix;";
+}
+
+inline std::string count_sensor_sql(const RowFilter& filter) {
+    if(!filter.filtered()) {
+        return COUNT_SENSOR_SQL;
+    }
+    return "SELECT COUNT(*) FROM sensor_data WHERE device_id = ? AND timestamp_unix BETWEEN ? AND ?" +
+           sensor_filter_sql(filter) + ";";
+}
+
+inline void bind_sensor_range(sqlite3_stmt* stmt, const std::string& device, int64_t from, int64_t to,
+                              const RowFilter& filter) {
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, from);
+    sqlite3_bind_int64(stmt, 3, to);
+    for(size_t i = 0; i < filter.predicates.size(); ++i) {
+        sqlite3_bind_double(stmt, static_cast<int>(i) + 4, filter.predicates[i].value);
+    }
+}
+
+// columns - какие метрики есть в выборке (по порядку SENSOR_FIELDS), остальные не трогаются
+inline void read_sensor_row(sqlite3_stmt* stmt, SensorData& row, FieldMask columns = ALL_SENSOR_FIELDS) {
+    row.timestamp_unix = sqlite3_column_int64(stmt, 0);
+    int column = 1;
+    for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+        if(has_sensor_field(columns, i)) {
+            // NULL - метрики не было в показании
+            set_sensor_field(row, i, sqlite3_column_type(stmt, column) == SQLITE_NULL
+                                     ? SENSOR_MISSING : sqlite3_column_double(stmt, column));
+            ++column;
+        }
+    }
+}
+
+// stmt - scan_sensor_sql(filter); после вызова остаётся на последнем шаге
+template <typename F>
+bool scan_sensor_stmt(sqlite3_stmt* stmt, const std::string& device, int64_t from, int64_t to,
+                      const RowFilter& filter, F&& on_row) {
+    bind_sensor_range(stmt, device, from, to, filter);
+    FieldMask columns = filter.columns();
+    SensorData row{};
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        read_sensor_row(stmt, row, columns);
+        if(!on_row(row)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Кэшированный запрос соединения пула
+template <typename F>
+bool scan_sensor_table(ReadConnection& db, const std::string& device, int64_t from, int64_t to,
+                       const RowFilter& filter, F&& on_row) {
+    sqlite3_stmt* stmt = db.statement(scan_sensor_sql(filter));
+    if(!stmt) {
+        return true;
+    }
+    bool completed = scan_sensor_stmt(stmt, device, from, to, filter, on_row);
+    sqlite3_reset(stmt);
+    return completed;
+}
+
+template <typename F>
+bool scan_sensor_table(sqlite3* db, const std::string& device, int64_t from, int64_t to,
+                       const RowFilter& filter, F&& on_row) {
+    sqlite3_stmt* stmt;
+    if(sqlite3_prepare_v2(db, scan_sensor_sql(filter).c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return true;
+    }
+    bool completed = scan_sensor_stmt(stmt, device, from, to, filter, on_row);
+    sqlite3_finalize(stmt);
+    return completed;
+}
+
+template <typename Db, typename F>
+bool scan_sensor_table(Db& db, const std::string& device, int64_t from, int64_t to, F&& on_row) {
+    return scan_sensor_table(db, device, from, to, RowFilter(), on_row);
+}
+
+inline bool latest_in_sensor_table(ReadConnection& db, const std::string& device, SensorData& data) {
+    sqlite3_stmt* stmt = db.statement(LATEST_SENSOR_SQL);
+    if(!stmt) {
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_STATIC);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if(found) {
+        read_sensor_row(stmt, data);
+    }
+    sqlite3_reset(stmt);
+    return found;
+}
+
+// Только по индексу (device_id, timestamp_unix, метрики), без чтения строк таблицы
+inline size_t count_sensor_table(ReadConnection& db, const std::string& device, int64_t from, int64_t to,
+                                 const RowFilter& filter = RowFilter()) {
+    sqlite3_stmt* stmt = db.statement(count_sensor_sql(filter));
+    if(!stmt) {
+        return 0;
+    }
+    bind_sensor_range(stmt, device, from, to, filter);
+    size_t count = sqlite3_step(stmt) == SQLITE_ROW ? static_cast<size_t>(sqlite3_column_int64(stmt, 0)) : 0;
+    sqlite3_reset(stmt);
+    return count;
+}
+
+// Роутер запросов по сырым данным шарда: сначала строки, записанные до разбиения
+// на месяцы (sensor_data основного файла), затем только пересекающиеся месяцы
+template <typename Db, typename F>
+bool scan_partitions(Db& shard_db, PartitionReaders& partitions, const std::string& device,
+                     int64_t from, int64_t to, const RowFilter& filter, F&& on_row) {
+    if(!scan_sensor_table(shard_db, device, from, to, filter, on_row)) {
+        return false;
+    }
+    for(int month : list_partitions(partitions.path())) {
+        if(partition_month_end(month) <= from) {
+            continue;
+        }
+        if(partition_month_start(month) > to) {
+            break;
+        }
+        ReadPool::Lease db = partitions.get(month);
+        if(db && !scan_sensor_table(*db, device, from, to, filter, on_row)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Db, typename F>
+bool scan_partitions(Db& shard_db, PartitionReaders& partitions, const std::string& device,
+                     int64_t from, int64_t to, F&& on_row) {
+    return scan_partitions(shard_db, partitions, device, from, to, RowFilter(), on_row);
+}
+
+// Сколько строк вернёт scan_partitions с теми же аргументами
+inline size_t count_partitions(ReadConnection& shard_db, PartitionReaders& partitions,
+                               const std::string& device, int64_t from, int64_t to,
+                               const RowFilter& filter = RowFilter()) {
+    size_t count = count_sensor_table(shard_db, device, from, to, filter);
+    for(int month : list_partitions(partitions.path())) {
+        if(partition_month_end(month) <= from) {
+            continue;
+        }
+        if(partition_month_start(month) > to) {
+            break;
+        }
+        ReadPool::Lease db = partitions.get(month);
+        if(db) {
+            count += count_sensor_table(*db, device, from, to, filter);
+        }
+    }
+    return count;
+}
+
+// Последнее показание: месяцы от нового к старому, затем строки до разбиения
+inline bool latest_in_partitions(ReadConnection& shard_db, PartitionReaders& partitions,
+                                 const std::string& device, SensorData& data) {
+    std::vector<int> months = list_partitions(partitions.path());
+    for(auto it = months.rbegin(); it != months.rend(); ++it) {
+        ReadPool::Lease db = partitions.get(*it);
+        if(db && latest_in_sensor_table(*db, device, data)) {
+            return true;
+        }
+    }
+    return latest_in_sensor_table(shard_db, device, data);
+}
+
+// Закончившийся месяц: WAL сливается в основной файл, права - только чтение.
+// Не выйдет, пока кто-то держит открытую транзакцию чтения; тогда повтор при следующем проходе.
+inline bool finalize_partition(const std::string& path) {
+    if(partition_is_readonly(path)) {
+        return true;
+    }
+    sqlite3* db;
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_busy_timeout(db, 5000);
+    bool ok = false;
+    sqlite3_stmt* stmt;
+    if(sqlite3_prepare_v2(db, "PRAGMA wal_checkpoint(TRUNCATE);", -1, &stmt, nullptr) == SQLITE_OK) {
+        ok = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 0;
+        sqlite3_finalize(stmt);
+    }
+    // Если файл ещё открыт читателями, журнал останется WAL: immutable-чтению это не мешает
+    if(ok) {
+        sqlite3_exec(db, "PRAGMA journal_mode=DELETE;", nullptr, nullptr, nullptr);
+    }
+    sqlite3_close(db);
+    return ok && chmod(path.c_str(), 0444) == 0;
+}
+
+// Удаление месяца целиком вместо DELETE по строкам
+inline bool drop_partition(const std::string& path) {
+    bool ok = std::remove(path.c_str()) == 0 || errno == ENOENT;
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
+    return ok;
+}
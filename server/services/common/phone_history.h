@@ -0,0 +1,726 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include "sensor_data.h"
+#include "row_filter.h"
+#include "device_shards.h"
+#include "sensor_history.h"
+#include "async_server.h"
+#include "wire_format.h"
+#include "hot_ring.h"
+#include "sync_cursor.h"
+#include "push_hub.h"
+#include "day_cache.h"
+#include "json_stream.h"
+#include "access_log.h"
+
+// Ответы телефону по истории фермы (порт 1488): бинарные форматы logs_to_phone/logs.cpp,
+// подписки, докачка по курсору и JSON reserve_logs.cpp. Всё держит один HistoryDatabase
+// (пулы соединений шардов и кольцо свежих строк), так что logs.cpp, reserve_logs.cpp и
+// phone_gateway/gateway.cpp отвечают одинаково. Пути к базе и логу задаёт сам сервис.
+
+inline uint64_t htonll(uint64_t value) {
+    static const int num = 42;
+    if (*reinterpret_cast<const char*>(&num) == num) {
+        return (static_cast<uint64_t>(htonl(value & 0xFFFFFFFF)) << 32) | htonl(value >> 32);
+    } else {
+        return value;
+    }
+}
+
+inline uint64_t ntohll(uint64_t value) {
+    return htonll(value);
+}
+
+const size_t SYNC_PAGE_ROWS = 10000;  // Больше строк за один запрос с курсором не отдаётся
+const size_t EXTRA_QUERY_MAX_ROWS = 10000;  // Записей за один запрос "extra"
+const int PUSH_POLL_MS = 5;          // Как часто кольцо проверяется на новые строки для подписок
+
+class HistoryDatabase {
+    SensorHistory history;
+    HotRingReader ring;
+
+    // Сырые строки: свежая часть диапазона - из кольца data_server_farm, остальное - из БД.
+    // Условия filter для БД уходят в запрос, строки кольца проверяются здесь
+    template <typename F>
+    void scan_raw(const std::string& device, int64_t unix_from, int64_t unix_to, const RowFilter& filter, F&& on_row) {
+        static thread_local std::vector<SensorData> recent;
+        int64_t covered_since = 0;
+        if(!ring.snapshot(device, unix_from, unix_to, recent, covered_since)) {
+            history.scan(device, unix_from, unix_to, filter, on_row);
+            return;
+        }
+        bool completed = true;
+        if(unix_from < covered_since) {
+            history.scan(device, unix_from, std::min(unix_to, covered_since - 1), filter, [&](const SensorData& row) {
+                completed = on_row(row);
+                return completed;
+            });
+        }
+        for(size_t i = 0; completed && i < recent.size(); ++i) {
+            if(filter.matches(recent[i])) {
+                completed = on_row(recent[i]);
+            }
+        }
+    }
+
+public:
+    HistoryDatabase(const std::string& db_path, size_t shard_count, const std::string& blocks_dir)
+        : history(db_path, shard_count, blocks_dir) {}
+
+    // max_points > 0: длинные диапазоны отдаются по агрегатам (1 мин / 1 ч / 1 сут)
+    template <typename F>
+    void scan_data(const std::string& device, int64_t unix_from, int64_t unix_to, size_t max_points,
+                   const RowFilter& filter, F&& on_row) {
+        if(pick_resolution(unix_from, unix_to, max_points) == 0) {
+            scan_raw(device, unix_from, unix_to, filter, on_row);
+        }
+        else {
+            history.scan_with_budget(device, unix_from, unix_to, max_points, filter, on_row);
+        }
+    }
+
+    // mode из запроса: не больше max_points точек, прореженных за один проход
+    std::vector<SensorData> get_downsampled(const std::string& device, int64_t unix_from, int64_t unix_to,
+                                            size_t max_points, DownsampleMode mode, const RowFilter& filter) {
+        std::vector<SensorData> points;
+        points.reserve(std::min(max_points, MAX_DOWNSAMPLE_POINTS));
+        auto emit = [&points](const SensorData& point) {
+            points.push_back(point);
+        };
+        Downsampler<decltype(emit)&> sampler(mode, unix_from, unix_to, max_points, emit);
+        scan_raw(device, unix_from, unix_to, filter, [&sampler](const SensorData& row) {
+            sampler.add(row);
+            return true;
+        });
+        sampler.finish();
+        return points;
+    }
+
+    template <typename F>
+    void scan_extra(const std::string& device, int64_t unix_from, int64_t unix_to, size_t limit, F&& on_row) {
+        history.scan_extra(device, unix_from, unix_to, limit, on_row);
+    }
+
+    // Число строк того же запроса - по индексам и заголовкам блоков, без чтения строк
+    size_t count_data(const std::string& device, int64_t unix_from, int64_t unix_to, size_t max_points,
+                      const RowFilter& filter) {
+        static thread_local std::vector<SensorData> recent;
+        int64_t covered_since = 0;
+        if(pick_resolution(unix_from, unix_to, max_points) != 0 ||
+           !ring.snapshot(device, unix_from, unix_to, recent, covered_since)) {
+            return history.count_with_budget(device, unix_from, unix_to, max_points, filter);
+        }
+        size_t count = 0;
+        for(const auto& row : recent) {
+            count += filter.matches(row);
+        }
+        if(unix_from < covered_since) {
+            count += history.count_with_budget(device, unix_from, std::min(unix_to, covered_since - 1), 0, filter);
+        }
+        return count;
+    }
+
+    // Страница докачки: до page строк после cursor по unix_to включительно, курсор сдвигается
+    // за последнюю из них. true - за страницей есть ещё строки. Курсор считает только строки,
+    // прошедшие filter: следующие страницы запрашиваются с теми же условиями
+    bool get_sync_page(const std::string& device, SyncCursor& cursor, int64_t unix_to, size_t page,
+                       const RowFilter& filter, std::vector<SensorData>& rows) {
+        rows.clear();
+        uint32_t skip = cursor.skip;
+        bool more = false;
+        scan_raw(device, cursor.timestamp, unix_to, filter, [&](const SensorData& row) {
+            if(row.timestamp_unix == cursor.timestamp && skip > 0) {
+                --skip;
+                return true;
+            }
+            if(rows.size() == page) {
+                more = true;
+                return false;
+            }
+            rows.push_back(row);
+            return true;
+        });
+        for(const auto& row : rows) {
+            cursor.advance(row);
+        }
+        return more;
+    }
+
+    int64_t sealed_until(const std::string& device) {
+        return history.sealed_horizon(device);
+    }
+
+    SensorData get_latest_data(const std::string& device) {
+        SensorData data{};
+        if(!ring.latest(device, data)) {
+            history.latest(device, data);
+        }
+        return data;
+    }
+};
+
+// Строка на запрос истории, через общий журнал (common/access_log.h), и число
+// отданных строк в гистограмму
+class HistoryLog {
+    std::shared_ptr<AccessLog> out;
+    LatencyHistogram rows;
+
+public:
+    explicit HistoryLog(const std::string& path) : out(AccessLog::shared(path)) {}
+
+    void log(const std::string& ip, const std::string& device, int64_t from, int64_t to, size_t count) {
+        rows.record_value(count);
+        out->log("IP: " + ip
+                 + " | Device: " + device
+                 + " | From: " + std::to_string(from)
+                 + " | To: " + std::to_string(to)
+                 + " | Records sent: " + std::to_string(count));
+    }
+
+    AccessLogStats stats() const {
+        return out->stats();
+    }
+
+    void write_metrics(MetricsWriter& metrics) const {
+        ::write_metrics(metrics, *out);
+        metrics.histogram("iop_history_rows_per_query", "Rows sent per history request", rows, "", 1);
+    }
+};
+
+const size_t RECORD_SIZE = 7 * sizeof(uint64_t);
+
+inline void serialize_sensor_data(char* out, const SensorData& data) {
+    uint64_t net_fields[7];
+    net_fields[0] = static_cast<uint64_t>(data.timestamp_unix);
+    memcpy(&net_fields[1], &data.temperature_DHT22, sizeof(double));
+    memcpy(&net_fields[2], &data.temperature_DS18B20, sizeof(double));
+    memcpy(&net_fields[3], &data.humidity, sizeof(double));
+    memcpy(&net_fields[4], &data.water_level, sizeof(double));
+    memcpy(&net_fields[5], &data.soil_moisture, sizeof(double));
+    memcpy(&net_fields[6], &data.light_intensity, sizeof(double));
+
+    for(auto& field : net_fields) field = htonll(field);
+    memcpy(out, net_fields, sizeof(net_fields));
+}
+
+// Запрос с "fields": timestamp и только выбранные метрики по порядку SENSOR_FIELDS
+inline size_t record_size(FieldMask fields) {
+    return sizeof(uint64_t) * (1 + sensor_field_count(fields));
+}
+
+inline void serialize_sensor_fields(char* out, const SensorData& data, FieldMask fields) {
+    uint64_t net_field = htonll(static_cast<uint64_t>(data.timestamp_unix));
+    memcpy(out, &net_field, sizeof(net_field));
+    out += sizeof(net_field);
+    for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+        if(!has_sensor_field(fields, i)) {
+            continue;
+        }
+        double value = sensor_field(data, i);
+        memcpy(&net_field, &value, sizeof(value));
+        net_field = htonll(net_field);
+        memcpy(out, &net_field, sizeof(net_field));
+        out += sizeof(net_field);
+    }
+}
+
+// Показания идут из sqlite3_step прямо в буферы отправки.
+// Обычный ответ: uint32 count, затем count записей по 56 байт - count считается заранее по индексам.
+// С "stream": true счётчика впереди нет: записи, затем метка конца (8 байт 0xFF,
+// timestamp таких значений не бывает) и uint32 count.
+// С "format": 2 - сжатые кадры common/wire_format.h, число показаний тоже в конце.
+// Ответ на запрос с "cursor" дополнительно заканчивается хвостом курсора (sync_trailer).
+// С "fields" ответ v1 начинается с байта - маски метрик (как в common/row_filter.h), записи
+// короче: 8 байт времени и по 8 байт на выбранную метрику; v2 - версия WIRE_VERSION_FIELDS.
+class RecordWriter {
+    ChunkedResponse out;
+    bool streamed = false;
+    FieldMask fields = ALL_SENSOR_FIELDS;
+    std::unique_ptr<WireEncoder> wire;
+    uint8_t header[1 + sizeof(uint32_t)] = {};
+    size_t records = 0;
+
+    void send_frame() {
+        if(wire->pending() > 0) {
+            const std::vector<uint8_t>& frame = wire->frame();
+            out.append(frame.data(), frame.size());
+        }
+    }
+
+public:
+    explicit RecordWriter(ResponseWriter& writer) : out(writer) {}
+
+    // format 2 всегда без счётчика впереди; codec - сжатие кадров, mask - метрики записей.
+    // Повторный вызов начинает ответ заново: кодер с накопленными строками не переживает его
+    void configure(bool stream, int format, WireCodec codec, FieldMask mask) {
+        out.clear();
+        streamed = stream || format == 2;
+        fields = mask;
+        wire.reset();
+        if(format == 2) {
+            wire = std::make_unique<WireEncoder>(codec, fields);
+        }
+    }
+
+    void begin(size_t count) {
+        records = 0;
+        bool projected = fields != ALL_SENSOR_FIELDS;
+        if(wire) {
+            wire_header(reinterpret_cast<uint8_t*>(out.reserve(wire_header_size(fields))), fields);
+        }
+        else if(!streamed) {
+            header[0] = fields;
+            uint32_t net_count = htonl(static_cast<uint32_t>(count));
+            memcpy(header + 1, &net_count, sizeof(net_count));
+            out.set_prefix(projected ? header : header + 1, projected ? sizeof(header) : sizeof(net_count));
+        }
+        else if(projected) {
+            *out.reserve(1) = static_cast<char>(fields);
+        }
+    }
+
+    void add(const SensorData& data) {
+        if(wire) {
+            if(wire->add(data)) {
+                send_frame();
+            }
+        }
+        else if(fields == ALL_SENSOR_FIELDS) {
+            serialize_sensor_data(out.reserve(RECORD_SIZE), data);
+        }
+        else {
+            serialize_sensor_fields(out.reserve(record_size(fields)), data, fields);
+        }
+        ++records;
+    }
+
+    // Готовые байты суток из DayCache (та же кодировка, что у ответа) - через sendfile
+    void add_file(const DayFile& file) {
+        if(wire) {
+            send_frame();
+        }
+        out.append_file(file.fd(), file.offset, file.length);
+        records += file.rows;
+    }
+
+    // trailer - байты после ответа выбранного формата
+    void finish(const std::string& trailer = std::string()) {
+        uint32_t count = htonl(static_cast<uint32_t>(records));
+        if(wire) {
+            send_frame();
+            uint32_t end = 0;
+            out.append(&end, sizeof(end));
+            out.append(&count, sizeof(count));
+        }
+        else if(streamed) {
+            memset(out.reserve(sizeof(uint64_t)), 0xFF, sizeof(uint64_t));
+            out.append(&count, sizeof(count));
+        }
+        out.append(trailer.data(), trailer.size());
+        out.finish();
+    }
+
+    size_t count() const { return records; }
+    bool started() const { return out.started(); }
+};
+
+const uint8_t SYNC_MORE = 1;    // За страницей есть ещё строки: сразу запросить следующую
+const uint8_t SYNC_RESET = 2;   // Курсор не принят, страница начата заново с unix_time_from
+
+// uint8 флаги, uint8 длина курсора, курсор
+inline std::string sync_trailer(uint8_t flags, const SyncCursor& cursor, const std::string& device) {
+    std::string text = encode_sync_cursor(cursor, device);
+    std::string trailer;
+    trailer.push_back(static_cast<char>(flags));
+    trailer.push_back(static_cast<char>(text.size()));
+    return trailer + text;
+}
+
+// Подписка: 0 - записи v1 по 56 байт, 1 + WireCodec - кадры format 2
+const size_t PUSH_ENCODINGS = 4;
+const char PUSH_MAGIC[4] = {'I', 'O', 'P', 'S'};
+
+inline void encode_push(size_t encoding, const std::vector<SensorData>& rows, std::vector<uint8_t>& bytes) {
+    if(encoding == 0) {
+        bytes.resize(rows.size() * RECORD_SIZE);
+        for(size_t i = 0; i < rows.size(); ++i) {
+            serialize_sensor_data(reinterpret_cast<char*>(bytes.data()) + i * RECORD_SIZE, rows[i]);
+        }
+        return;
+    }
+    WireEncoder wire(static_cast<WireCodec>(encoding - 1));
+    for(size_t i = 0; i < rows.size(); ++i) {
+        if(wire.add(rows[i]) || i + 1 == rows.size()) {
+            const std::vector<uint8_t>& frame = wire.frame();
+            bytes.insert(bytes.end(), frame.begin(), frame.end());
+        }
+    }
+}
+
+// Начало потока подписки: "IOPS" и версия для v1, заголовок "IOP2" для format 2
+inline std::vector<uint8_t> push_header(size_t encoding) {
+    std::vector<uint8_t> header(WIRE_HEADER_SIZE);
+    if(encoding == 0) {
+        memcpy(header.data(), PUSH_MAGIC, sizeof(PUSH_MAGIC));
+        header[sizeof(PUSH_MAGIC)] = 1;
+    }
+    else {
+        wire_header(header.data());
+    }
+    return header;
+}
+
+// Закрытые сутки, целиком лежащие в [unix_from, unix_to], - открытые файлы готовых ответов
+// в кодировке encoding (как у подписок). [days_from, days_to) - покрытая ими часть диапазона;
+// сутки без блока (ферма была офлайн) строк не содержат. Если файл суток не открылся,
+// дальше диапазон считается обычным путём
+inline std::vector<DayFile> open_whole_days(HistoryDatabase& db, DayCache& days, const std::string& device,
+                                     int64_t unix_from, int64_t unix_to, size_t encoding,
+                                     int64_t& days_from, int64_t& days_to) {
+    std::vector<DayFile> files;
+    int64_t first = block_window_start(unix_from);
+    if(first < unix_from) {
+        first += BLOCK_DURATION_SEC;
+    }
+    int64_t horizon = db.sealed_until(device);
+    if(first > unix_to - (BLOCK_DURATION_SEC - 1) || first + BLOCK_DURATION_SEC > horizon) {
+        return files;
+    }
+    days_from = days_to = first;
+    for(int64_t window : days.windows(device, first, horizon)) {
+        if(window > unix_to - (BLOCK_DURATION_SEC - 1) || window + BLOCK_DURATION_SEC > horizon) {
+            break;
+        }
+        DayFile file;
+        if(!days.open(device, window, encoding, file)) {
+            break;
+        }
+        files.push_back(std::move(file));
+        days_to = window + BLOCK_DURATION_SEC;
+    }
+    return files;
+}
+
+// Отдельный поток: новые строки кольца data_server_farm - подписчикам их ферм.
+// Кольцо общее для процессов, так что SQLite для подписок не читается вовсе
+inline void follow_ring(PushHub& hub) {
+    HotRingReader ring;
+    std::unordered_map<std::string, uint64_t> positions;
+    std::vector<SensorData> rows;
+    while(true) {
+        std::unordered_map<std::string, uint64_t> next;
+        for(const auto& device : hub.subscribed_devices()) {
+            auto it = positions.find(device);
+            uint64_t position = it == positions.end() ? HOT_RING_FROM_NOW : it->second;
+            if(ring.tail(device, position, rows)) {
+                hub.publish(device, rows);
+            }
+            next.emplace(device, position);
+        }
+        positions.swap(next);
+        std::this_thread::sleep_for(std::chrono::milliseconds(PUSH_POLL_MS));
+    }
+}
+
+// Выполняется в пуле потоков сервера; память на ответ - два буфера RESPONSE_CHUNK_BYTES
+inline void handle_history_request(const std::string& request_str, const std::string& client_ip,
+                                   ResponseWriter& writer, HistoryDatabase& db, HistoryLog& logger,
+                                   PushHub& hub, DayCache& days) {
+    std::string device = LEGACY_DEVICE_ID;
+    bool streamed = false;
+    int format = 1;
+    WireCodec codec = WireCodec::None;
+    bool downsample = false;
+    DownsampleMode mode = DownsampleMode::Lttb;
+    bool sync = false;
+    SyncCursor cursor;
+    uint8_t sync_flags = 0;
+    RowFilter filter;
+    std::vector<DayFile> whole_days;  // Открыты, пока sendfile не отправит их до конца
+    RecordWriter records(writer);
+    try {
+        bool valid_request = false;
+        int64_t unix_from = 0, unix_to = 0;
+        size_t max_points = 0;
+        size_t page = SYNC_PAGE_ROWS;
+
+        try {
+            auto request = nlohmann::json::parse(request_str);
+            // Старые клиенты не знают о device_id и всегда смотрят farm001
+            device = request.value("device_id", LEGACY_DEVICE_ID);
+            streamed = request.value("stream", false);
+            format = request.value("format", 1) == 2 ? 2 : 1;
+            if(!parse_wire_codec(request.value("compression", std::string("none")), codec)) {
+                codec = WireCodec::None;
+            }
+            std::vector<std::string> fields = request.value("fields", std::vector<std::string>());
+            bool valid_filter = parse_row_filter(request.contains("fields") ? &fields : nullptr,
+                                                 request.value("where", std::vector<std::string>()), filter);
+            if(!valid_device_id(device)) {
+                device = LEGACY_DEVICE_ID;
+            }
+            else if(!valid_filter) {
+                // Неизвестное поле или условие: запрос не принят, как запрос без диапазона
+            }
+            else if(request.value("subscribe", false)) {
+                // Соединение остаётся открытым, новые строки фермы приходят сами
+                size_t encoding = format == 2 ? 1 + static_cast<size_t>(codec) : 0;
+                std::vector<uint8_t> header = push_header(encoding);
+                writer.hand_over([&hub, device, encoding, header](boost::asio::ip::tcp::socket& socket, const std::string&) {
+                    hub.subscribe(socket, device, encoding, header);
+                });
+                logger.log(client_ip, device, 0, 0, 0);
+                return;
+            }
+            else if(request.contains("cursor")) {
+                // Докачка: только строки новее курсора, страницами не больше SYNC_PAGE_ROWS.
+                // Пустой курсор - первая синхронизация с unix_time_from
+                unix_from = request.value("unix_time_from", static_cast<int64_t>(0));
+                unix_to = request.value("unix_time_to", std::numeric_limits<int64_t>::max());
+                page = std::min(std::max(request.value("page_size", SYNC_PAGE_ROWS), static_cast<size_t>(1)),
+                                SYNC_PAGE_ROWS);
+                std::string text = request["cursor"].get<std::string>();
+                if(!text.empty() && !decode_sync_cursor(text, device, cursor)) {
+                    sync_flags |= SYNC_RESET;
+                }
+                if(text.empty() || (sync_flags & SYNC_RESET)) {
+                    cursor.timestamp = unix_from;
+                    cursor.skip = 0;
+                }
+                sync = true;
+            }
+            else if(request.contains("unix_time_from") && request.contains("unix_time_to")) {
+                unix_from = request["unix_time_from"].get<int64_t>();
+                unix_to = request["unix_time_to"].get<int64_t>();
+                max_points = request.value("max_points", static_cast<size_t>(0));
+                // Без mode max_points выбирает разрешение агрегатов, как раньше
+                downsample = max_points > 0 && request.contains("mode") &&
+                             parse_downsample_mode(request["mode"].get<std::string>(), mode);
+                valid_request = unix_from <= unix_to;
+            }
+        } catch (...) {}
+        records.configure(streamed, format, codec, filter.fields);
+
+        if(sync) {
+            // Страница ограничена, её можно собрать до отправки и знать число заранее
+            static thread_local std::vector<SensorData> rows;
+            if(db.get_sync_page(device, cursor, unix_to, page, filter, rows)) {
+                sync_flags |= SYNC_MORE;
+            }
+            records.begin(rows.size());
+            for(const auto& row : rows) {
+                records.add(row);
+            }
+            unix_from = rows.empty() ? cursor.timestamp : rows.front().timestamp_unix;
+            unix_to = cursor.timestamp;
+        }
+        else if(valid_request && downsample) {
+            // Точек не больше max_points: их можно собрать до отправки и знать число заранее
+            std::vector<SensorData> points = db.get_downsampled(device, unix_from, unix_to, max_points, mode, filter);
+            records.begin(points.size());
+            for(const auto& point : points) {
+                records.add(point);
+            }
+        }
+        else if(valid_request) {
+            bool counted = !streamed && format == 1;
+            // Строки, дописанные после подсчёта, в ответ v1 уже не попадают
+            auto send_range = [&](int64_t from, int64_t to, size_t expected) {
+                size_t first = records.count();
+                db.scan_data(device, from, to, max_points, filter, [&](const SensorData& row) {
+                    if(counted && records.count() - first == expected) {
+                        return false;
+                    }
+                    records.add(row);
+                    return true;
+                });
+                if(records.count() - first < expected) {
+                    throw std::runtime_error("Range returned fewer rows than counted");
+                }
+            };
+            // Целые закрытые сутки уходят готовыми файлами, считаются только края диапазона
+            int64_t days_from = 0, days_to = 0;
+            if(pick_resolution(unix_from, unix_to, max_points) == 0 && filter.trivial()) {
+                size_t encoding = format == 2 ? 1 + static_cast<size_t>(codec) : 0;
+                whole_days = open_whole_days(db, days, device, unix_from, unix_to, encoding, days_from, days_to);
+            }
+            if(whole_days.empty()) {
+                size_t expected = counted ? db.count_data(device, unix_from, unix_to, max_points, filter) : 0;
+                records.begin(expected);
+                send_range(unix_from, unix_to, expected);
+            }
+            else {
+                bool head = unix_from < days_from;
+                bool tail = days_to <= unix_to;
+                size_t head_rows = counted && head ? db.count_data(device, unix_from, days_from - 1, 0, filter) : 0;
+                size_t tail_rows = counted && tail ? db.count_data(device, days_to, unix_to, 0, filter) : 0;
+                size_t expected = head_rows + tail_rows;
+                for(const auto& file : whole_days) {
+                    expected += file.rows;
+                }
+                records.begin(expected);
+                if(head) {
+                    send_range(unix_from, days_from - 1, head_rows);
+                }
+                for(const auto& file : whole_days) {
+                    records.add_file(file);
+                }
+                if(tail) {
+                    send_range(days_to, unix_to, tail_rows);
+                }
+            }
+        }
+        else {
+            records.begin(1);
+            records.add(db.get_latest_data(device));
+            unix_from = unix_to = 0;
+        }
+
+        records.finish(sync ? sync_trailer(sync_flags, cursor, device) : std::string());
+        logger.log(client_ip, device, unix_from, unix_to, records.count());
+    }
+    catch(const std::exception& e) {
+        // Часть ответа уже у клиента: остаётся только закрыть соединение
+        if(records.started()) {
+            throw;
+        }
+        records.configure(streamed, format, codec, filter.fields);
+        if(sync) {
+            // Пустая страница с прежним курсором: клиент повторит запрос позже
+            records.begin(0);
+            records.finish(sync_trailer(sync_flags & SYNC_RESET, cursor, device));
+            logger.log(client_ip, device, 0, 0, 0);
+            return;
+        }
+        records.begin(1);
+        records.add(db.get_latest_data(device));
+        records.finish();
+        logger.log(client_ip, device, 0, 0, records.count());
+    }
+}
+
+// Ответ reserve_logs.cpp: {"count":..,"data":[...]} из sqlite3_step прямо в сокет.
+// Ошибка в запросе - исключение, соединение закрывается без ответа
+inline void handle_json_request(const std::string& request_str, const std::string& client_ip,
+                                ResponseWriter& writer, HistoryDatabase& db, HistoryLog& logger) {
+    auto request = nlohmann::json::parse(request_str);
+    if(!request.contains("unix_time_from") || !request.contains("unix_time_to")) {
+        throw std::runtime_error("Invalid request format");
+    }
+
+    int64_t unix_from = request["unix_time_from"];
+    int64_t unix_to = request["unix_time_to"];
+    std::string device = request.value("device_id", LEGACY_DEVICE_ID);
+    size_t max_points = request.value("max_points", static_cast<size_t>(0));
+    DownsampleMode mode = DownsampleMode::Lttb;
+    bool downsample = request.contains("mode");
+    if(downsample && !parse_downsample_mode(request["mode"].get<std::string>(), mode)) {
+        throw std::runtime_error("Invalid mode");
+    }
+
+    if(unix_from > unix_to) {
+        throw std::runtime_error("Invalid time range");
+    }
+    if(!valid_device_id(device)) {
+        throw std::runtime_error("Invalid device_id");
+    }
+    // "extra": true - неизвестные ключи показаний вместо метрик:
+    // {"count":N,"data":[{"timestamp":..,"seq":..,"extra":{...}},...]}, не больше "limit" записей
+    if(request.value("extra", false)) {
+        size_t limit = std::min(request.value("limit", EXTRA_QUERY_MAX_ROWS), EXTRA_QUERY_MAX_ROWS);
+        std::string data;
+        size_t count = 0;
+        db.scan_extra(device, unix_from, unix_to, limit,
+                      [&data, &count](int64_t timestamp, int64_t seq, const std::string& extra) {
+            data += count++ ? ",{\"timestamp\":" : "{\"timestamp\":";
+            data += std::to_string(timestamp);
+            data += ",\"seq\":" + (seq >= 0 ? std::to_string(seq) : std::string("null"));
+            data += ",\"extra\":" + extra + "}";
+            return true;
+        });
+        std::string response = "{\"count\":" + std::to_string(count) + ",\"data\":[" + data + "]}\n";
+        writer.write({boost::asio::buffer(response)});
+        writer.flush();
+        logger.log(client_ip, device, unix_from, unix_to, count);
+        return;
+    }
+
+    // "fields" - только эти ключи в записях, "where" - условия вида "water_level < 10"
+    RowFilter filter;
+    std::vector<std::string> fields = request.value("fields", std::vector<std::string>());
+    if(!parse_row_filter(request.contains("fields") ? &fields : nullptr,
+                         request.value("where", std::vector<std::string>()), filter)) {
+        throw std::runtime_error("Invalid fields or where");
+    }
+
+    // Буфер JsonRowStream переиспользуется после возврата: часть дожидается отправки
+    auto send = [&writer](const char* data, size_t size) {
+        writer.write({boost::asio::buffer(data, size)});
+        writer.flush();
+    };
+    JsonRowStream<decltype(send)> out(send, filter.fields);
+    if(downsample && max_points > 0) {
+        std::vector<SensorData> points = db.get_downsampled(device, unix_from, unix_to, max_points, mode, filter);
+        out.begin(points.size());
+        for(const auto& point : points) {
+            out.add(point);
+        }
+    }
+    else {
+        size_t expected = db.count_data(device, unix_from, unix_to, max_points, filter);
+        out.begin(expected);
+        // Строки, дописанные после подсчёта, в ответ уже не попадают
+        db.scan_data(device, unix_from, unix_to, max_points, filter, [&](const SensorData& row) {
+            if(out.count() == expected) {
+                return false;
+            }
+            out.add(row);
+            return true;
+        });
+        if(out.count() < expected) {
+            throw std::runtime_error("Range returned fewer rows than counted");
+        }
+    }
+    out.finish();
+
+    logger.log(client_ip, device, unix_from, unix_to, out.count());
+}
+
+// "format": "json" - ответ reserve_logs.cpp, иначе бинарные форматы logs.cpp
+inline bool json_history_request(const std::string& request_str) {
+    try {
+        auto request = nlohmann::json::parse(request_str);
+        auto format = request.find("format");
+        return format != request.end() && *format == "json";
+    } catch (...) {
+        return false;
+    }
+}
+
+// Один вход для запросов порта истории: разбор по типу запроса
+inline void handle_phone_history(const std::string& request_str, const std::string& client_ip,
+                                 ResponseWriter& writer, HistoryDatabase& db, HistoryLog& logger,
+                                 PushHub& hub, DayCache& days) {
+    if(json_history_request(request_str)) {
+        handle_json_request(request_str, client_ip, writer, db, logger);
+    }
+    else {
+        handle_history_request(request_str, client_ip, writer, db, logger, hub, days);
+    }
+}
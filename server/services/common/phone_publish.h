@@ -0,0 +1,437 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <mqtt/async_client.h>
+#include <nlohmann/json.hpp>
+#include "async_server.h"
+#include "latency_histogram.h"
+#include "access_log.h"
+
+// Команды и конфиги с телефона (порты 1490 и 1489): строка JSON проверяется, пишется в лог
+// и публикуется в топик фермы. Один MqttPublisher обслуживает любое число топиков, так что
+// command.cpp, config.cpp и phone_gateway/gateway.cpp различаются только тем, какие
+// порты и топики они открывают.
+//
+// Публикация не ждёт брокера в потоке пула: сообщение уходит в Paho, а PUBACK (QoS 1)
+// возвращается колбэком. Без подтверждения одновременно не больше окна публикаций,
+// следующий запрос ждёт места. Телефон получает строку JSON с исходом:
+// {"status":"delivered","latency_ms":..}, "failed" (с "error"), "timeout" или "invalid".
+// Запросы с "id" идут одним долгим соединением, ответы сопоставляются по id (PublishSession).
+
+constexpr size_t PUBLISH_WINDOW = 64;                   // Публикаций без PUBACK одновременно
+constexpr std::chrono::seconds PUBLISH_TIMEOUT{10};     // Столько телефон ждёт подтверждения
+
+struct PublishStats {
+    uint64_t published;
+    uint64_t delivered;
+    uint64_t failed;
+    uint64_t window_waits;   // Запрос ждал, пока освободится место в окне
+    size_t in_flight;
+    LatencyHistogram::Snapshot latency;  // От запроса до PUBACK
+};
+
+inline std::ostream& operator<<(std::ostream& os, const PublishStats& s) {
+    return os << "published=" << s.published
+              << " delivered=" << s.delivered
+              << " failed=" << s.failed
+              << " window_waits=" << s.window_waits
+              << " in_flight=" << s.in_flight
+              << " " << s.latency;
+}
+
+struct PublishResult {
+    bool delivered;
+    std::string error;
+    std::chrono::microseconds latency;
+};
+
+// Строка на команду или конфиг; command и config пишут в один файл
+class PublishLog {
+    std::shared_ptr<AccessLog> out;
+
+public:
+    explicit PublishLog(const std::string& path) : out(AccessLog::shared(path)) {}
+
+    void log(const std::string& ip, const std::string& config) {
+        out->log("IP: " + ip + " | Config: " + config);
+    }
+
+    void invalid(const std::string& ip) {
+        out->log("IP: " + ip + " | Invalid JSON");
+    }
+
+    AccessLogStats stats() const {
+        return out->stats();
+    }
+
+    void write_metrics(MetricsWriter& metrics) const {
+        ::write_metrics(metrics, *out);
+    }
+};
+
+// Одно соединение с брокером на процесс; publish потокобезопасен в Paho.
+// После обрыва клиент переподключается сам, публикации до этого завершаются ошибкой
+class MqttPublisher {
+public:
+    // Вызывается один раз из потока Paho (или сразу, если Paho не принял сообщение)
+    using Completion = std::function<void(const PublishResult& result)>;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Живёт от publish до колбэка Paho и удаляет себя сам
+    class Delivery : public mqtt::iaction_listener {
+        MqttPublisher& owner;
+        Completion done;
+        clock::time_point started;
+
+    public:
+        Delivery(MqttPublisher& publisher, Completion completion, clock::time_point start)
+            : owner(publisher), done(std::move(completion)), started(start) {}
+
+        void on_success(const mqtt::token&) override {
+            owner.complete(started, true, std::string(), done);
+            delete this;
+        }
+
+        void on_failure(const mqtt::token& token) override {
+            fail("Broker error " + std::to_string(token.get_return_code()));
+        }
+
+        void fail(const std::string& error) {
+            owner.complete(started, false, error, done);
+            delete this;
+        }
+    };
+
+    mqtt::async_client client;
+    size_t window;
+
+    std::mutex mutex;
+    std::condition_variable window_free;
+    size_t in_flight = 0;
+
+    std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> window_waits{0};
+    LatencyHistogram latency;
+
+    void complete(clock::time_point started, bool ok, const std::string& error, const Completion& done) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - started);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --in_flight;
+        }
+        window_free.notify_one();
+        if(ok) {
+            ++delivered;
+            latency.record(elapsed);
+        }
+        else {
+            ++failed;
+        }
+        done({ok, error, elapsed});
+    }
+
+public:
+    MqttPublisher(const std::string& broker, const std::string& client_id, size_t max_in_flight = PUBLISH_WINDOW)
+        : client(broker, client_id), window(max_in_flight) {
+        auto options = mqtt::connect_options_builder()
+            .clean_session(true)
+            .automatic_reconnect(true)
+            .max_inflight(static_cast<int>(max_in_flight))
+            .finalize();
+        client.connect(options)->wait();
+    }
+
+    MqttPublisher(const MqttPublisher&) = delete;
+    MqttPublisher& operator=(const MqttPublisher&) = delete;
+
+    // Ждёт места в окне, дальше не блокирует: исход придёт в done
+    void publish_async(const std::string& topic, const std::string& payload, Completion done) {
+        clock::time_point started = clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(in_flight >= window) {
+                ++window_waits;
+                window_free.wait(lock, [this] { return in_flight < window; });
+            }
+            ++in_flight;
+        }
+        ++published;
+        auto msg = mqtt::make_message(topic, payload);
+        msg->set_qos(1);
+        Delivery* delivery = new Delivery(*this, std::move(done), started);
+        try {
+            client.publish(msg, nullptr, *delivery);
+        }
+        catch(const std::exception& e) {
+            // Нет соединения или очередь Paho полна: колбэка не будет
+            delivery->fail(e.what());
+        }
+    }
+
+    PublishStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {published.load(), delivered.load(), failed.load(), window_waits.load(), in_flight,
+                latency.snapshot()};
+    }
+
+    const LatencyHistogram& latency_histogram() const {
+        return latency;
+    }
+};
+
+inline void write_metrics(MetricsWriter& out, MqttPublisher& publisher) {
+    PublishStats s = publisher.stats();
+    out.counter("iop_mqtt_published_total", "Messages handed to the MQTT client", s.published);
+    out.counter("iop_mqtt_delivered_total", "Messages acknowledged by the broker (PUBACK)", s.delivered);
+    out.counter("iop_mqtt_failed_total", "Messages that failed to publish", s.failed);
+    out.counter("iop_mqtt_window_waits_total", "Publishes that waited for a free window slot", s.window_waits);
+    out.gauge("iop_mqtt_in_flight", "Messages awaiting PUBACK", static_cast<double>(s.in_flight));
+    out.histogram("iop_mqtt_publish_duration_seconds", "From the request to PUBACK", publisher.latency_histogram());
+}
+
+// Соединение телефона после первой строки (ResponseWriter::hand_over). Все поля меняются
+// только в strand сокета: исходы публикаций из потока Paho приходят туда через post.
+// Запрос без "id" - как раньше: одна строка, ответ, соединение закрывается. Если в первом
+// запросе есть "id", соединение остаётся открытым: каждая следующая строка - запрос,
+// публикуется сразу, не дожидаясь ответов на предыдущие, ответы идут по мере PUBACK и
+// несут "id" своего запроса (порядок ответов может отличаться от порядка запросов).
+// Без ответа в сессии не больше SESSION_PIPELINE запросов, дальше чтение ждёт. Сессия
+// закрывается, если SESSION_IDLE_TIMEOUT нет ни новых запросов, ни ожидающих ответа.
+// Клиент, закрывший свою сторону после последней строки (nc -N), получает ответы на все
+// уже принятые запросы: соединение закрывается, когда они отправлены.
+constexpr size_t SESSION_PIPELINE = 32;
+constexpr std::chrono::seconds SESSION_IDLE_TIMEOUT{60};
+constexpr size_t SESSION_MAX_LINE = 64 * 1024;
+
+class PublishSession : public std::enable_shared_from_this<PublishSession> {
+    using tcp = boost::asio::ip::tcp;
+    using Timer = boost::asio::steady_timer;
+
+    struct Pending {
+        nlohmann::json id;
+        std::unique_ptr<Timer> timeout;
+    };
+
+    MqttPublisher& publisher;
+    PublishLog& logger;
+    boost::asio::thread_pool& pool;
+    std::string topic;
+    std::string client_ip;
+    std::string first;
+
+    std::unique_ptr<tcp::socket> socket;
+    std::unique_ptr<Timer> idle;
+    boost::asio::streambuf input{SESSION_MAX_LINE};
+    bool persistent = false;
+    bool reading = false;
+    bool writing = false;
+    bool eof = false;      // Клиент закрыл свою сторону, новых запросов не будет
+    bool closed = false;
+
+    uint64_t next_request = 0;
+    std::map<uint64_t, Pending> pending;
+    std::deque<std::string> replies;
+
+    void close() {
+        if(closed) {
+            return;
+        }
+        closed = true;
+        idle->cancel();
+        for(auto& request : pending) {
+            request.second.timeout->cancel();
+        }
+        pending.clear();
+        boost::system::error_code ignored;
+        socket->shutdown(tcp::socket::shutdown_both, ignored);
+        socket->close(ignored);
+    }
+
+    void send(nlohmann::json reply, const nlohmann::json& id) {
+        if(!id.is_null()) {
+            reply["id"] = id;
+        }
+        replies.push_back(reply.dump() + "\n");
+        if(!writing) {
+            write_next();
+        }
+    }
+
+    void write_next() {
+        if(closed) {
+            return;
+        }
+        if(replies.empty()) {
+            writing = false;
+            if((!persistent || eof) && pending.empty()) {
+                close();
+            }
+            return;
+        }
+        writing = true;
+        boost::asio::async_write(*socket, boost::asio::buffer(replies.front()),
+            [self = shared_from_this()](const boost::system::error_code& ec, size_t) {
+                if(ec) {
+                    self->close();
+                    return;
+                }
+                self->replies.pop_front();
+                self->write_next();
+            });
+    }
+
+    void arm_idle() {
+        idle->expires_after(SESSION_IDLE_TIMEOUT);
+        idle->async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+            if(ec || self->closed) {
+                return;
+            }
+            // Ждём PUBACK: его ответ ещё должен дойти
+            if(!self->pending.empty() || !self->replies.empty()) {
+                self->arm_idle();
+                return;
+            }
+            self->close();
+        });
+    }
+
+    void read_next() {
+        if(closed || !persistent || eof || reading || pending.size() >= SESSION_PIPELINE) {
+            return;
+        }
+        reading = true;
+        arm_idle();
+        boost::asio::async_read_until(*socket, input, '\n',
+            [self = shared_from_this()](const boost::system::error_code& ec, size_t) {
+                self->reading = false;
+                if(ec == boost::asio::error::eof && !self->closed) {
+                    // Последняя строка может быть без '\n'; ответы на принятые запросы
+                    // ещё уйдут, сокет закроет write_next
+                    self->eof = true;
+                    if(self->input.size() > 0) {
+                        std::istream is(&self->input);
+                        std::string line;
+                        std::getline(is, line);
+                        self->submit(line);
+                    }
+                    if(!self->writing) {
+                        self->write_next();
+                    }
+                    return;
+                }
+                if(ec || self->closed) {
+                    self->close();
+                    return;
+                }
+                std::istream is(&self->input);
+                std::string line;
+                std::getline(is, line);
+                self->submit(line);
+                self->read_next();
+            });
+    }
+
+    void answer(uint64_t request, const nlohmann::json& reply) {
+        auto it = pending.find(request);
+        if(closed || it == pending.end()) {
+            return;  // Уже ответили "timeout"
+        }
+        nlohmann::json id = std::move(it->second.id);
+        it->second.timeout->cancel();
+        pending.erase(it);
+        send(reply, id);
+        read_next();
+    }
+
+    void submit(const std::string& line) {
+        // Валидация JSON; документ нужен только ради "id"
+        nlohmann::json request = nlohmann::json::parse(line, nullptr, false);
+        if(request.is_discarded()) {
+            send({{"status", "invalid"}}, nullptr);
+            logger.invalid(client_ip);
+            return;
+        }
+        nlohmann::json id;
+        if(request.is_object() && request.contains("id")) {
+            id = request["id"];
+        }
+        logger.log(client_ip, line);
+
+        uint64_t number = next_request++;
+        Pending& entry = pending[number];
+        entry.id = std::move(id);
+        entry.timeout = std::make_unique<Timer>(socket->get_executor());
+        entry.timeout->expires_after(PUBLISH_TIMEOUT);
+        entry.timeout->async_wait([self = shared_from_this(), number](const boost::system::error_code& ec) {
+            if(!ec) {
+                self->answer(number, {{"status", "timeout"}});
+            }
+        });
+
+        // Ожидание места в окне - в пуле, не в strand
+        auto strand = socket->get_executor();
+        boost::asio::post(pool, [self = shared_from_this(), number, line, strand]() {
+            self->publisher.publish_async(self->topic, line, [self, number, strand](const PublishResult& result) {
+                boost::asio::post(strand, [self, number, result]() {
+                    self->answer(number, result_fields(result));
+                });
+            });
+        });
+    }
+
+public:
+    PublishSession(MqttPublisher& mqtt, PublishLog& log, boost::asio::thread_pool& publish_pool,
+                   const std::string& publish_topic, const std::string& first_request, std::string unread)
+        : publisher(mqtt), logger(log), pool(publish_pool), topic(publish_topic), first(first_request) {
+        std::ostream(&input) << unread;
+    }
+
+    static nlohmann::json result_fields(const PublishResult& result) {
+        nlohmann::json reply;
+        reply["status"] = result.delivered ? "delivered" : "failed";
+        if(!result.delivered) {
+            reply["error"] = result.error;
+        }
+        reply["latency_ms"] = result.latency.count() / 1000.0;
+        return reply;
+    }
+
+    // В strand сокета, после того как сервер отпустил соединение
+    void attach(tcp::socket& s, const std::string& ip) {
+        socket = std::make_unique<tcp::socket>(std::move(s));
+        idle = std::make_unique<Timer>(socket->get_executor());
+        client_ip = ip;
+        nlohmann::json request = nlohmann::json::parse(first, nullptr, false);
+        persistent = request.is_object() && request.contains("id");
+        submit(first);
+        read_next();
+    }
+};
+
+// Выполняется в пуле потоков сервера: соединение сразу передаётся PublishSession,
+// публикация и ответы идут уже без этого потока
+inline void handle_publish_request(const std::string& data, const std::string&, ResponseWriter& writer,
+                                   const std::string& topic, MqttPublisher& publisher, PublishLog& logger,
+                                   boost::asio::thread_pool& pool) {
+    auto session = std::make_shared<PublishSession>(publisher, logger, pool, topic, data, writer.take_unread());
+    writer.hand_over([session](boost::asio::ip::tcp::socket& socket, const std::string& client_ip) {
+        session->attach(socket, client_ip);
+    });
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+#include "sensor_data.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+
+// Подписки телефонов на новые показания: соединение после запроса подписки остаётся
+// открытым (ResponseWriter::hand_over), и каждая новая пачка строк фермы уходит во все её
+// подписки. Пачка кодируется один раз на формат (encoding), подписчик получает указатель
+// на общее сообщение. У подписчика ограниченная очередь: кто не успевает забирать данные
+// (очередь больше PUSH_QUEUE_ROWS строк или запись дольше PUSH_WRITE_TIMEOUT), отключается,
+// а после переподключения докачивает пропущенное по курсору.
+
+constexpr size_t PUSH_QUEUE_ROWS = 4096;
+constexpr std::chrono::seconds PUSH_WRITE_TIMEOUT{10};
+constexpr size_t MAX_SUBSCRIBERS = 20000;
+constexpr int PUSH_SEND_BUFFER = 64 * 1024;  // Буфер сокета в ядре: иначе медленный клиент копит мегабайты там
+
+struct PushStats {
+    size_t subscribers;
+    uint64_t subscribed;
+    uint64_t rejected;      // Подписчиков уже MAX_SUBSCRIBERS
+    uint64_t disconnected;  // Клиент закрыл соединение
+    uint64_t evicted;       // Не успевал забирать данные
+    uint64_t pushed_rows;
+    LatencyHistogram::Snapshot latency;  // От publish до отправки подписчику
+};
+
+inline std::ostream& operator<<(std::ostream& os, const PushStats& s) {
+    return os << "subscribers=" << s.subscribers
+              << " subscribed=" << s.subscribed
+              << " rejected=" << s.rejected
+              << " disconnected=" << s.disconnected
+              << " evicted=" << s.evicted
+              << " pushed_rows=" << s.pushed_rows
+              << " " << s.latency;
+}
+
+class PushHub {
+    using tcp = boost::asio::ip::tcp;
+    using clock = std::chrono::steady_clock;
+
+    struct Message {
+        std::vector<uint8_t> bytes;
+        size_t rows;
+        clock::time_point published;
+    };
+    using MessagePtr = std::shared_ptr<const Message>;
+
+    // Сокет и таймер живут в strand соединения; очередь разделена с потоком publish
+    class Subscriber : public std::enable_shared_from_this<Subscriber> {
+        PushHub& hub;
+        tcp::socket socket;
+        boost::asio::steady_timer timer;
+        uint8_t probe = 0;
+
+        std::mutex mutex;
+        std::deque<MessagePtr> queue;
+        size_t queued_rows = 0;
+        bool writing = false;
+        bool closed = false;
+        std::vector<MessagePtr> sending;
+
+        // Клиент ничего не присылает: чтение завершится, только когда он отключится
+        void watch() {
+            socket.async_read_some(boost::asio::buffer(&probe, 1),
+                [self = shared_from_this()](const boost::system::error_code& ec, size_t) {
+                    if(!ec) {
+                        self->watch();
+                        return;
+                    }
+                    if(ec != boost::asio::error::operation_aborted) {
+                        self->close(false);
+                    }
+                });
+        }
+
+        // В strand: всё накопленное одной записью
+        void pump() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(closed || queue.empty()) {
+                    writing = false;
+                    return;
+                }
+                sending.assign(queue.begin(), queue.end());
+                queue.clear();
+                queued_rows = 0;
+            }
+            std::vector<boost::asio::const_buffer> buffers;
+            buffers.reserve(sending.size());
+            for(const auto& message : sending) {
+                buffers.push_back(boost::asio::buffer(message->bytes));
+            }
+            timer.expires_after(PUSH_WRITE_TIMEOUT);
+            timer.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+                if(!ec) {
+                    self->close(true);
+                }
+            });
+            boost::asio::async_write(socket, buffers,
+                [self = shared_from_this()](const boost::system::error_code& ec, size_t) {
+                    self->timer.cancel();
+                    if(ec) {
+                        self->close(false);
+                        return;
+                    }
+                    auto now = clock::now();
+                    for(const auto& message : self->sending) {
+                        if(message->rows == 0) {
+                            continue;  // Заголовок подписки
+                        }
+                        self->hub.pushed_rows += message->rows;
+                        self->hub.latency.record(
+                            std::chrono::duration_cast<std::chrono::microseconds>(now - message->published));
+                    }
+                    self->sending.clear();
+                    self->pump();
+                });
+        }
+
+    public:
+        const std::string device;
+        const size_t encoding;
+
+        // header уходит первым, раньше любых строк
+        Subscriber(PushHub& owner, tcp::socket s, const std::string& device_id, size_t format, MessagePtr header)
+            : hub(owner), socket(std::move(s)), timer(socket.get_executor()), device(device_id), encoding(format) {
+            queue.push_back(std::move(header));
+        }
+
+        void start() {
+            boost::system::error_code ignored;
+            socket.set_option(tcp::socket::keep_alive(true), ignored);
+            socket.set_option(tcp::no_delay(true), ignored);
+            socket.set_option(boost::asio::socket_base::send_buffer_size(PUSH_SEND_BUFFER), ignored);
+            watch();
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!writing) {
+                writing = true;
+                boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+                    self->pump();
+                });
+            }
+        }
+
+        // Из потока publish; false - подписчик не успевает и отключается
+        bool push(MessagePtr message) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(closed) {
+                return true;
+            }
+            if(queued_rows + message->rows > PUSH_QUEUE_ROWS) {
+                closed = true;
+                boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+                    self->shutdown();
+                });
+                return false;
+            }
+            queued_rows += message->rows;
+            queue.push_back(std::move(message));
+            if(!writing) {
+                writing = true;
+                boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+                    self->pump();
+                });
+            }
+            return true;
+        }
+
+        // В strand
+        void close(bool evict) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(closed) {
+                    return;
+                }
+                closed = true;
+            }
+            ++(evict ? hub.evicted : hub.disconnected);
+            shutdown();
+        }
+
+        void shutdown() {
+            boost::system::error_code ignored;
+            timer.cancel();
+            socket.shutdown(tcp::socket::shutdown_both, ignored);
+            socket.close(ignored);
+            hub.remove(shared_from_this());
+        }
+    };
+
+public:
+    // Кодирует пачку строк для формата encoding в bytes
+    using Encoder = std::function<void(size_t encoding, const std::vector<SensorData>& rows,
+                                       std::vector<uint8_t>& bytes)>;
+
+    PushHub(size_t encodings, Encoder encode_rows) : encoding_count(encodings), encoder(std::move(encode_rows)) {}
+
+    PushHub(const PushHub&) = delete;
+    PushHub& operator=(const PushHub&) = delete;
+
+    // В strand сокета (из ResponseWriter::hand_over); header уходит подписчику первым
+    void subscribe(tcp::socket& socket, const std::string& device, size_t encoding,
+                   const std::vector<uint8_t>& header) {
+        auto message = std::make_shared<Message>();
+        message->bytes = header;
+        message->rows = 0;
+        message->published = clock::now();
+        auto subscriber = std::make_shared<Subscriber>(*this, std::move(socket), device, encoding, std::move(message));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(count >= MAX_SUBSCRIBERS) {
+                ++rejected;
+                return;  // Сокет закроется вместе с subscriber
+            }
+            devices[device].push_back(subscriber);
+            ++count;
+        }
+        ++subscribed;
+        subscriber->start();
+    }
+
+    // Новые строки фермы - всем её подписчикам
+    void publish(const std::string& device, const std::vector<SensorData>& rows) {
+        if(rows.empty()) {
+            return;
+        }
+        auto now = clock::now();
+        std::vector<MessagePtr> messages(encoding_count);
+        // push только ставит сообщение в очередь: список можно держать под блокировкой
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = devices.find(device);
+        if(it == devices.end()) {
+            return;
+        }
+        for(const auto& subscriber : it->second) {
+            MessagePtr& message = messages[subscriber->encoding];
+            if(!message) {
+                auto encoded = std::make_shared<Message>();
+                encoder(subscriber->encoding, rows, encoded->bytes);
+                encoded->rows = rows.size();
+                encoded->published = now;
+                message = std::move(encoded);
+            }
+            if(!subscriber->push(message)) {
+                ++evicted;
+            }
+        }
+    }
+
+    // Фермы, у которых есть подписчики
+    std::vector<std::string> subscribed_devices() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> result;
+        result.reserve(devices.size());
+        for(const auto& entry : devices) {
+            result.push_back(entry.first);
+        }
+        return result;
+    }
+
+    PushStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {count, subscribed.load(), rejected.load(), disconnected.load(), evicted.load(),
+                pushed_rows.load(), latency.snapshot()};
+    }
+
+    const LatencyHistogram& latency_histogram() const {
+        return latency;
+    }
+
+private:
+    size_t encoding_count;
+    Encoder encoder;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Subscriber>>> devices;
+    size_t count = 0;
+
+    std::atomic<uint64_t> subscribed{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> disconnected{0};
+    std::atomic<uint64_t> evicted{0};
+    std::atomic<uint64_t> pushed_rows{0};
+    LatencyHistogram latency;
+
+    void remove(const std::shared_ptr<Subscriber>& subscriber) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = devices.find(subscriber->device);
+        if(it == devices.end()) {
+            return;
+        }
+        auto& list = it->second;
+        for(size_t i = 0; i < list.size(); ++i) {
+            if(list[i] == subscriber) {
+                list[i] = std::move(list.back());
+                list.pop_back();
+                --count;
+                break;
+            }
+        }
+        if(list.empty()) {
+            devices.erase(it);
+        }
+    }
+};
+
+inline void write_metrics(MetricsWriter& out, PushHub& hub) {
+    PushStats s = hub.stats();
+    out.gauge("iop_push_subscribers", "Open subscriptions", static_cast<double>(s.subscribers));
+    out.counter("iop_push_subscribed_total", "Subscriptions accepted", s.subscribed);
+    out.counter("iop_push_rejected_total", "Subscriptions rejected at MAX_SUBSCRIBERS", s.rejected);
+    out.counter("iop_push_evicted_total", "Subscribers dropped for not keeping up", s.evicted);
+    out.counter("iop_push_rows_total", "Rows pushed to subscribers", s.pushed_rows);
+    out.histogram("iop_push_delivery_seconds", "From publish to sending to a subscriber", hub.latency_histogram());
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sqlite3.h>
+#include "sensor_data.h"
+
+// Агрегаты min/max/sum/count по каждой метрике за 1 минуту, 1 час и 1 сутки.
+// Поток-писатель шарда обновляет их в памяти за O(1) на показание и сливает
+// в таблицу sensor_rollups той же транзакцией, что и пачку сырых строк.
+
+constexpr size_t ROLLUP_LEVELS = 3;
+constexpr int64_t ROLLUP_RESOLUTIONS[ROLLUP_LEVELS] = {60, 3600, 86400};
+constexpr int64_t RAW_INTERVAL_ESTIMATE_SEC = 10;  // Период отправки данных контроллером
+
+inline int64_t rollup_bucket_start(int64_t timestamp, int64_t resolution) {
+    int64_t rem = timestamp % resolution;
+    return timestamp - (rem < 0 ? rem + resolution : rem);
+}
+
+// Изменения бакета с момента последнего слива в БД
+struct RollupBucket {
+    int64_t start = 0;
+    uint32_t count = 0;
+    double min[SENSOR_FIELDS_COUNT];
+    double max[SENSOR_FIELDS_COUNT];
+    double sum[SENSOR_FIELDS_COUNT];
+    uint32_t values[SENSOR_FIELDS_COUNT];   // Показаний, где метрика была (не SENSOR_MISSING)
+
+    void reset(int64_t bucket_start) {
+        start = bucket_start;
+        count = 0;
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            min[i] = std::numeric_limits<double>::infinity();
+            max[i] = -std::numeric_limits<double>::infinity();
+            sum[i] = 0;
+            values[i] = 0;
+        }
+    }
+
+    void add(const SensorData& row) {
+        ++count;
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            double value = sensor_field(row, i);
+            if(sensor_missing(value)) {
+                continue;
+            }
+            if(value < min[i]) min[i] = value;
+            if(value > max[i]) max[i] = value;
+            sum[i] += value;
+            ++values[i];
+        }
+    }
+};
+
+inline std::string rollup_column_list() {
+    std::string columns = "device_id, resolution, bucket_start, count";
+    for(const char* field : SENSOR_FIELDS) {
+        columns += std::string(", ") + field + "_min, " + field + "_max, " + field + "_sum, " + field + "_count";
+    }
+    return columns;
+}
+
+// Создаёт sensor_rollups; при первом создании заполняет её из уже накопленных сырых строк
+inline void ensure_rollup_schema(sqlite3* db) {
+    sqlite3_stmt* stmt;
+    bool exists = false;
+    if(sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'sensor_rollups';",
+                          -1, &stmt, nullptr) == SQLITE_OK) {
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    if(exists) {
+        // Таблицы до NULL-метрик: <метрика>_count нет, среднее считается по count
+        std::string probe = std::string("SELECT ") + SENSOR_FIELDS[0] + "_count FROM sensor_rollups LIMIT 0;";
+        if(sqlite3_prepare_v2(db, probe.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            return;
+        }
+        for(const char* field : SENSOR_FIELDS) {
+            std::string alter = std::string("ALTER TABLE sensor_rollups ADD COLUMN ") + field + "_count INTEGER;";
+            char* err = nullptr;
+            if(sqlite3_exec(db, alter.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+                std::string message = err ? err : sqlite3_errmsg(db);
+                sqlite3_free(err);
+                throw std::runtime_error(message);
+            }
+        }
+        return;
+    }
+
+    std::string sql = "CREATE TABLE sensor_rollups ("
+                      "device_id TEXT NOT NULL,"
+                      "resolution INTEGER NOT NULL,"
+                      "bucket_start INTEGER NOT NULL,"
+                      "count INTEGER NOT NULL";
+    for(const char* field : SENSOR_FIELDS) {
+        sql += std::string(",") + field + "_min REAL," + field + "_max REAL," + field + "_sum REAL," +
+               field + "_count INTEGER";
+    }
+    sql += ", PRIMARY KEY (device_id, resolution, bucket_start)) WITHOUT ROWID;";
+
+    for(int64_t resolution : ROLLUP_RESOLUTIONS) {
+        std::string r = std::to_string(resolution);
+        sql += "INSERT INTO sensor_rollups (" + rollup_column_list() + ") "
+               "SELECT device_id, " + r + ", timestamp_unix - timestamp_unix % " + r + ", COUNT(*)";
+        for(const char* field : SENSOR_FIELDS) {
+            std::string f = field;
+            sql += ", MIN(" + f + "), MAX(" + f + "), SUM(" + f + "), COUNT(" + f + ")";
+        }
+        sql += " FROM sensor_data GROUP BY device_id, timestamp_unix - timestamp_unix % " + r + ";";
+    }
+
+    char* err = nullptr;
+    std::string transaction = "BEGIN;" + sql + "COMMIT;";
+    if(sqlite3_exec(db, transaction.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        std::string message = err ? err : sqlite3_errmsg(db);
+        sqlite3_free(err);
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        throw std::runtime_error(message);
+    }
+}
+
+class RollupAccumulator {
+    struct DeviceRollups {
+        RollupBucket open[ROLLUP_LEVELS];
+        bool started = false;
+    };
+
+    std::unordered_map<std::string, DeviceRollups> devices;
+    // Бакеты, закрытые с последнего слива (ферма перешла в следующую минуту/час/сутки)
+    std::vector<std::pair<std::string, std::pair<int64_t, RollupBucket>>> closed;
+    sqlite3_stmt* upsert = nullptr;
+
+    void bind_and_step(sqlite3* db, const std::string& device, int64_t resolution, const RollupBucket& bucket) {
+        sqlite3_bind_text(upsert, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(upsert, 2, resolution);
+        sqlite3_bind_int64(upsert, 3, bucket.start);
+        sqlite3_bind_int64(upsert, 4, bucket.count);
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            int base = 5 + static_cast<int>(i) * 4;
+            sqlite3_bind_double(upsert, base, bucket.min[i]);
+            sqlite3_bind_double(upsert, base + 1, bucket.max[i]);
+            sqlite3_bind_double(upsert, base + 2, bucket.sum[i]);
+            sqlite3_bind_int64(upsert, base + 3, bucket.values[i]);
+        }
+        int rc = sqlite3_step(upsert);
+        sqlite3_reset(upsert);
+        if(rc != SQLITE_DONE) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+    }
+
+public:
+    explicit RollupAccumulator(sqlite3* db) {
+        ensure_rollup_schema(db);
+        // Слияние с уже записанным бакетом: после рестарта сервиса недописанная
+        // минута продолжается, а не перезаписывается
+        std::string sql = "INSERT INTO sensor_rollups (" + rollup_column_list() + ") VALUES (?, ?, ?, ?";
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            sql += ", ?, ?, ?, ?";
+        }
+        sql += ") ON CONFLICT (device_id, resolution, bucket_start) DO UPDATE SET count = count + excluded.count";
+        for(const char* field : SENSOR_FIELDS) {
+            std::string f = field;
+            sql += ", " + f + "_min = MIN(" + f + "_min, excluded." + f + "_min)"
+                   ", " + f + "_max = MAX(" + f + "_max, excluded." + f + "_max)"
+                   ", " + f + "_sum = " + f + "_sum + excluded." + f + "_sum"
+                   ", " + f + "_count = COALESCE(" + f + "_count, count) + excluded." + f + "_count";
+        }
+        sql += ";";
+        if(sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &upsert, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+    }
+
+    ~RollupAccumulator() {
+        sqlite3_finalize(upsert);
+    }
+
+    RollupAccumulator(const RollupAccumulator&) = delete;
+    RollupAccumulator& operator=(const RollupAccumulator&) = delete;
+
+    void add(const std::string& device, const SensorData& row) {
+        DeviceRollups& rollups = devices[device];
+        for(size_t level = 0; level < ROLLUP_LEVELS; ++level) {
+            RollupBucket& bucket = rollups.open[level];
+            int64_t start = rollup_bucket_start(row.timestamp_unix, ROLLUP_RESOLUTIONS[level]);
+            if(!rollups.started) {
+                bucket.reset(start);
+            }
+            else if(bucket.start != start) {
+                if(bucket.count > 0) {
+                    closed.push_back({device, {ROLLUP_RESOLUTIONS[level], bucket}});
+                }
+                bucket.reset(start);
+            }
+            bucket.add(row);
+        }
+        rollups.started = true;
+    }
+
+    // Вызывается внутри транзакции пачки
+    void flush(sqlite3* db) {
+        for(const auto& entry : closed) {
+            bind_and_step(db, entry.first, entry.second.first, entry.second.second);
+        }
+        for(const auto& entry : devices) {
+            for(size_t level = 0; level < ROLLUP_LEVELS; ++level) {
+                if(entry.second.open[level].count > 0) {
+                    bind_and_step(db, entry.first, ROLLUP_RESOLUTIONS[level], entry.second.open[level]);
+                }
+            }
+        }
+    }
+
+    // После COMMIT (или отката пачки) изменения считаются слитыми
+    void clear() {
+        closed.clear();
+        for(auto& entry : devices) {
+            for(auto& bucket : entry.second.open) {
+                bucket.reset(bucket.start);
+            }
+        }
+    }
+};
+
+struct RollupRow {
+    int64_t bucket_start;
+    uint32_t count;
+    double min[SENSOR_FIELDS_COUNT];
+    double max[SENSOR_FIELDS_COUNT];
+    double avg[SENSOR_FIELDS_COUNT];
+};
+
+// Наиболее подробное разрешение, при котором диапазон укладывается в max_points точек.
+// 0 - сырые строки; если не укладывается даже в сутки, берутся сутки.
+inline int64_t pick_resolution(int64_t unix_from, int64_t unix_to, size_t max_points) {
+    int64_t range = unix_to - unix_from + 1;
+    if(max_points == 0 || range / RAW_INTERVAL_ESTIMATE_SEC <= static_cast<int64_t>(max_points)) {
+        return 0;
+    }
+    for(int64_t resolution : ROLLUP_RESOLUTIONS) {
+        if((range + resolution - 1) / resolution <= static_cast<int64_t>(max_points)) {
+            return resolution;
+        }
+    }
+    return ROLLUP_RESOLUTIONS[ROLLUP_LEVELS - 1];
+}
+
+template <typename F>
+bool scan_rollups(sqlite3* db, const std::string& device, int64_t resolution,
+                  int64_t unix_from, int64_t unix_to, F&& on_bucket) {
+    std::string sql = "SELECT bucket_start, count";
+    for(const char* field : SENSOR_FIELDS) {
+        std::string f = field;
+        sql += ", " + f + "_min, " + f + "_max, " + f + "_sum, COALESCE(" + f + "_count, count)";
+    }
+    sql += " FROM sensor_rollups WHERE device_id = ? AND resolution = ? "
+           "AND bucket_start BETWEEN ? AND ? ORDER BY bucket_start;";
+    sqlite3_stmt* stmt;
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return true;  // Агрегатов ещё нет: база старой версии
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, resolution);
+    sqlite3_bind_int64(stmt, 3, rollup_bucket_start(unix_from, resolution));
+    sqlite3_bind_int64(stmt, 4, unix_to);
+
+    bool completed = true;
+    RollupRow row{};
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        row.bucket_start = sqlite3_column_int64(stmt, 0);
+        row.count = static_cast<uint32_t>(sqlite3_column_int64(stmt, 1));
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            int base = 2 + static_cast<int>(i) * 4;
+            int64_t values = sqlite3_column_int64(stmt, base + 3);
+            if(values == 0) {
+                row.min[i] = row.max[i] = row.avg[i] = SENSOR_MISSING;
+                continue;
+            }
+            row.min[i] = sqlite3_column_double(stmt, base);
+            row.max[i] = sqlite3_column_double(stmt, base + 1);
+            row.avg[i] = sqlite3_column_double(stmt, base + 2) / values;
+        }
+        if(!on_bucket(row)) {
+            completed = false;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return completed;
+}
+
+inline size_t count_rollups(sqlite3* db, const std::string& device, int64_t resolution,
+                           int64_t unix_from, int64_t unix_to) {
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT COUNT(*) FROM sensor_rollups WHERE device_id = ? AND resolution = ? "
+                      "AND bucket_start BETWEEN ? AND ?;";
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, resolution);
+    sqlite3_bind_int64(stmt, 3, rollup_bucket_start(unix_from, resolution));
+    sqlite3_bind_int64(stmt, 4, unix_to);
+    size_t count = sqlite3_step(stmt) == SQLITE_ROW ? static_cast<size_t>(sqlite3_column_int64(stmt, 0)) : 0;
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+// Минутные агрегаты нужны только для коротких диапазонов; часовые и суточные хранятся всегда
+constexpr int64_t MINUTE_ROLLUP_RETENTION_SEC = 31 * 86400;
+
+inline void prune_rollups(sqlite3* db, const std::string& device, int64_t now) {
+    sqlite3_stmt* stmt;
+    const char* sql = "DELETE FROM sensor_rollups "
+                      "WHERE device_id = ? AND resolution = 60 AND bucket_start < ?;";
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, now - MINUTE_ROLLUP_RETENTION_SEC);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "sensor_data.h"
+
+// Проекция и условия запроса истории: "fields" - какие метрики вернуть, "where" - условия
+// вида "water_level < 10" (все должны выполняться). Условия переводятся в WHERE запроса
+// к sensor_data (partitions.h), а в блоках и кольце проверяются после декодирования
+// только нужных столбцов (columns()).
+
+constexpr size_t MAX_ROW_PREDICATES = 4;
+
+enum class CompareOp : uint8_t {
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual
+};
+
+// Как в SQL, в том же порядке, что CompareOp
+constexpr const char* COMPARE_OP_SQL[] = {"<", "<=", ">", ">=", "=", "!="};
+
+inline bool sensor_field_index(const std::string& name, size_t& index) {
+    for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+        if(name == SENSOR_FIELDS[i]) {
+            index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct RowPredicate {
+    size_t field;
+    CompareOp op;
+    double value;
+
+    // Как WHERE в SQLite: NULL (SENSOR_MISSING) не проходит ни одно сравнение, и "!=" тоже,
+    // иначе ответ зависел бы от того, из месяца, блоков или кольца читается диапазон
+    bool matches(const SensorData& row) const {
+        double x = sensor_field(row, field);
+        if(sensor_missing(x)) {
+            return false;
+        }
+        switch(op) {
+            case CompareOp::Less: return x < value;
+            case CompareOp::LessEqual: return x <= value;
+            case CompareOp::Greater: return x > value;
+            case CompareOp::GreaterEqual: return x >= value;
+            case CompareOp::Equal: return x == value;
+            case CompareOp::NotEqual: return x != value;
+        }
+        return false;
+    }
+};
+
+// "water_level < 10", "humidity>=40.5"; false, если поле, операция или число не разобраны
+inline bool parse_row_predicate(const std::string& text, RowPredicate& predicate) {
+    size_t op_pos = text.find_first_of("<>=!");
+    if(op_pos == std::string::npos) {
+        return false;
+    }
+    size_t op_end = text.find_first_not_of("<>=!", op_pos);
+    std::string name = text.substr(0, op_pos);
+    std::string op = text.substr(op_pos, op_end == std::string::npos ? std::string::npos : op_end - op_pos);
+    std::string number = op_end == std::string::npos ? std::string() : text.substr(op_end);
+    auto trim = [](std::string& s) {
+        size_t first = s.find_first_not_of(" \t");
+        size_t last = s.find_last_not_of(" \t");
+        s = first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+    };
+    trim(name);
+    trim(number);
+    if(!sensor_field_index(name, predicate.field) || number.empty()) {
+        return false;
+    }
+    if(op == "<") predicate.op = CompareOp::Less;
+    else if(op == "<=") predicate.op = CompareOp::LessEqual;
+    else if(op == ">") predicate.op = CompareOp::Greater;
+    else if(op == ">=") predicate.op = CompareOp::GreaterEqual;
+    else if(op == "=" || op == "==") predicate.op = CompareOp::Equal;
+    else if(op == "!=") predicate.op = CompareOp::NotEqual;
+    else return false;
+    char* end = nullptr;
+    predicate.value = std::strtod(number.c_str(), &end);
+    return end == number.c_str() + number.size() && std::isfinite(predicate.value);
+}
+
+// Имена метрик "fields" в маску; false - неизвестное имя
+inline bool parse_field_mask(const std::vector<std::string>& names, FieldMask& fields) {
+    fields = 0;
+    for(const auto& name : names) {
+        size_t index;
+        if(!sensor_field_index(name, index)) {
+            return false;
+        }
+        fields |= static_cast<FieldMask>(1u << index);
+    }
+    return true;
+}
+
+struct RowFilter {
+    FieldMask fields = ALL_SENSOR_FIELDS;
+    std::vector<RowPredicate> predicates;
+
+    bool projected() const { return fields != ALL_SENSOR_FIELDS; }
+    bool filtered() const { return !predicates.empty(); }
+    bool trivial() const { return !projected() && !filtered(); }
+
+    // Столбцы, которые нужно прочитать: запрошенные и те, что в условиях
+    FieldMask columns() const {
+        FieldMask mask = fields;
+        for(const auto& predicate : predicates) {
+            mask |= static_cast<FieldMask>(1u << predicate.field);
+        }
+        return mask;
+    }
+
+    bool matches(const SensorData& row) const {
+        for(const auto& predicate : predicates) {
+            if(!predicate.matches(row)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// "fields" (нет - все метрики) и "where" запроса; false - неизвестное поле, условие не
+// разобрано или условий больше MAX_ROW_PREDICATES
+inline bool parse_row_filter(const std::vector<std::string>* fields, const std::vector<std::string>& where,
+                             RowFilter& filter) {
+    RowFilter parsed;
+    if(fields && !parse_field_mask(*fields, parsed.fields)) {
+        return false;
+    }
+    if(where.size() > MAX_ROW_PREDICATES) {
+        return false;
+    }
+    for(const auto& text : where) {
+        RowPredicate predicate;
+        if(!parse_row_predicate(text, predicate)) {
+            return false;
+        }
+        parsed.predicates.push_back(predicate);
+    }
+    filter = std::move(parsed);
+    return true;
+}
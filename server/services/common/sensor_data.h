@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// Одно показание фермы в том виде, в каком оно хранится в sensor_data
+#pragma pack(push, 1)
+struct SensorData {
+    int64_t timestamp_unix;
+    double temperature_DHT22;
+    double temperature_DS18B20;
+    double humidity;
+    double water_level;
+    double soil_moisture;
+    double light_intensity;
+};
+#pragma pack(pop)
+
+constexpr size_t SENSOR_FIELDS_COUNT = 6;
+
+// Имена метрик совпадают с ключами JSON от контроллера и столбцами sensor_data
+constexpr const char* SENSOR_FIELDS[SENSOR_FIELDS_COUNT] = {
+    "temperature_DHT22",
+    "temperature_DS18B20",
+    "humidity",
+    "water_level",
+    "soil_moisture",
+    "light_intensity"
+};
+
+constexpr double SensorData::* SENSOR_MEMBERS[SENSOR_FIELDS_COUNT] = {
+    &SensorData::temperature_DHT22,
+    &SensorData::temperature_DS18B20,
+    &SensorData::humidity,
+    &SensorData::water_level,
+    &SensorData::soil_moisture,
+    &SensorData::light_intensity
+};
+
+inline double sensor_field(const SensorData& data, size_t index) {
+    return data.*SENSOR_MEMBERS[index];
+}
+
+inline void set_sensor_field(SensorData& data, size_t index, double value) {
+    data.*SENSOR_MEMBERS[index] = value;
+}
+
+// Метрика, которой не было в показании (датчик не ответил): в sensor_data - NULL,
+// в JSON - null, агрегаты её пропускают
+constexpr double SENSOR_MISSING = std::numeric_limits<double>::quiet_NaN();
+
+inline bool sensor_missing(double value) {
+    return std::isnan(value);
+}
+
+// Время устройства принимается, если не убегает вперёд серверного больше чем на столько
+constexpr int64_t MAX_DEVICE_CLOCK_SKEW_SEC = 300;
+
+// Набор метрик запроса: бит i - SENSOR_FIELDS[i]; время передаётся всегда
+using FieldMask = uint8_t;
+constexpr FieldMask ALL_SENSOR_FIELDS = (1u << SENSOR_FIELDS_COUNT) - 1;
+
+inline bool has_sensor_field(FieldMask fields, size_t index) {
+    return (fields >> index) & 1;
+}
+
+inline size_t sensor_field_count(FieldMask fields) {
+    return static_cast<size_t>(__builtin_popcount(fields));
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <string>
+#include <sqlite3.h>
+#include "sensor_data.h"
+#include "row_filter.h"
+#include "device_shards.h"
+#include "partitions.h"
+#include "sqlite_pool.h"
+#include "block_store.h"
+#include "rollups.h"
+#include "downsample.h"
+
+// Чтение истории устройства для сервисов-читателей: закрытые сутки берутся из
+// блоков (blocks/), хвост после sealed_until - из месячных файлов шарда.
+class SensorHistory {
+    DeviceDirectory directory;
+    ShardConnections shards;
+    BlockStore blocks;
+
+public:
+    // connections_per_shard - сколько потоков могут читать шард одновременно
+    SensorHistory(const std::string& db_path, size_t shard_count, const std::string& blocks_dir,
+                  size_t connections_per_shard = READ_POOL_SIZE)
+        : directory(db_path, shard_count, true), shards(db_path, connections_per_shard), blocks(blocks_dir) {}
+
+    // Показания [from, to] по возрастанию времени; on_row возвращает false, чтобы остановиться.
+    // filter: читаются только нужные ему столбцы (в остальных полях строки нули), строки не
+    // по условиям отсеиваются в WHERE месячных файлов и при декодировании блоков
+    template <typename F>
+    void scan(const std::string& device, int64_t from, int64_t to, const RowFilter& filter, F&& on_row) {
+        size_t shard;
+        if(!directory.find_shard(device, shard)) {
+            return;
+        }
+        ReadPool::Lease db = shards.get(shard);
+        int64_t horizon = sealed_until(db->handle(), device);
+        if(from < horizon && !blocks.scan(device, from, std::min(to, horizon - 1), filter, on_row)) {
+            return;
+        }
+        if(to >= horizon) {
+            scan_partitions(*db, shards.partitions(shard), device, std::max(from, horizon), to, filter, on_row);
+        }
+    }
+
+    template <typename F>
+    void scan(const std::string& device, int64_t from, int64_t to, F&& on_row) {
+        scan(device, from, to, RowFilter(), on_row);
+    }
+
+    // Для графиков: если диапазон не укладывается в max_points сырых точек, отдаются
+    // средние по агрегатам подходящего разрешения (время точки - начало бакета).
+    // Возвращает выбранное разрешение в секундах, 0 - сырые строки.
+    // Условия filter для агрегатов проверяются по средним бакета.
+    template <typename F>
+    int64_t scan_with_budget(const std::string& device, int64_t from, int64_t to,
+                             size_t max_points, const RowFilter& filter, F&& on_row) {
+        int64_t resolution = pick_resolution(from, to, max_points);
+        if(resolution == 0) {
+            scan(device, from, to, filter, on_row);
+            return 0;
+        }
+        size_t shard;
+        if(!directory.find_shard(device, shard)) {
+            return resolution;
+        }
+        SensorData row{};
+        ReadPool::Lease db = shards.get(shard);
+        // Условия проверяются по средним; метрика без значений в бакете (SENSOR_MISSING)
+        // условие не проходит, как NULL в сырых строках
+        scan_rollups(db->handle(), device, resolution, from, to, [&](const RollupRow& bucket) {
+            row.timestamp_unix = bucket.bucket_start;
+            for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+                set_sensor_field(row, i, bucket.avg[i]);
+            }
+            return !filter.matches(row) || on_row(row);
+        });
+        return resolution;
+    }
+
+    template <typename F>
+    int64_t scan_with_budget(const std::string& device, int64_t from, int64_t to,
+                             size_t max_points, F&& on_row) {
+        return scan_with_budget(device, from, to, max_points, RowFilter(), on_row);
+    }
+
+    // Прореживание за один проход по сырым строкам диапазона (common/downsample.h):
+    // on_point получает не больше max_points точек по порядку
+    template <typename F>
+    void scan_downsampled(const std::string& device, int64_t from, int64_t to, size_t max_points,
+                          DownsampleMode mode, F&& on_point, const RowFilter& filter = RowFilter()) {
+        Downsampler<F&> sampler(mode, from, to, max_points, on_point);
+        scan(device, from, to, filter, [&sampler](const SensorData& row) {
+            sampler.add(row);
+            return true;
+        });
+        sampler.finish();
+    }
+
+    // Сколько точек отдаст scan_with_budget с теми же аргументами, без чтения самих строк.
+    // Строки, дописанные между count и scan, могут добавиться в конце диапазона.
+    size_t count_with_budget(const std::string& device, int64_t from, int64_t to, size_t max_points,
+                             const RowFilter& filter = RowFilter()) {
+        int64_t resolution = pick_resolution(from, to, max_points);
+        // Бакетов не больше max_points: с условиями их дешевле пройти, чем считать в SQL по средним
+        if(resolution != 0 && filter.filtered()) {
+            size_t count = 0;
+            scan_with_budget(device, from, to, max_points, filter, [&count](const SensorData&) {
+                ++count;
+                return true;
+            });
+            return count;
+        }
+        size_t shard;
+        if(!directory.find_shard(device, shard)) {
+            return 0;
+        }
+        ReadPool::Lease db = shards.get(shard);
+        if(resolution != 0) {
+            return count_rollups(db->handle(), device, resolution, from, to);
+        }
+        int64_t horizon = sealed_until(db->handle(), device);
+        size_t count = 0;
+        if(from < horizon) {
+            count += blocks.count(device, from, std::min(to, horizon - 1), filter);
+        }
+        if(to >= horizon) {
+            count += count_partitions(*db, shards.partitions(shard), device, std::max(from, horizon), to, filter);
+        }
+        return count;
+    }
+
+    // Неизвестные ключи показаний [from, to] (таблица sensor_extra), по времени, не больше limit.
+    // on_row(timestamp, seq (-1 - без номера), extra как пришёл) возвращает false, чтобы остановиться
+    template <typename F>
+    void scan_extra(const std::string& device, int64_t from, int64_t to, size_t limit, F&& on_row) {
+        size_t shard;
+        if(!directory.find_shard(device, shard)) {
+            return;
+        }
+        ReadPool::Lease db = shards.get(shard);
+        sqlite3_stmt* stmt = db->statement("SELECT timestamp_unix, seq, extra FROM sensor_extra "
+                                           "WHERE device_id = ? AND timestamp_unix BETWEEN ? AND ? "
+                                           "ORDER BY timestamp_unix LIMIT ?;");
+        if(!stmt) {
+            return;  // Таблицы ещё нет: data_server_farm старой версии
+        }
+        sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, from);
+        sqlite3_bind_int64(stmt, 3, to);
+        sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(limit));
+        while(sqlite3_step(stmt) == SQLITE_ROW) {
+            int64_t seq = sqlite3_column_type(stmt, 1) == SQLITE_NULL ? -1 : sqlite3_column_int64(stmt, 1);
+            std::string extra(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
+                              static_cast<size_t>(sqlite3_column_bytes(stmt, 2)));
+            if(!on_row(sqlite3_column_int64(stmt, 0), seq, extra)) {
+                break;
+            }
+        }
+        sqlite3_reset(stmt);
+    }
+
+    // До этого момента история устройства лежит в блоках и больше не меняется; 0 - блоков нет
+    int64_t sealed_horizon(const std::string& device) {
+        size_t shard;
+        if(!directory.find_shard(device, shard)) {
+            return 0;
+        }
+        ReadPool::Lease db = shards.get(shard);
+        return sealed_until(db->handle(), device);
+    }
+
+    bool latest(const std::string& device, SensorData& data) {
+        size_t shard;
+        if(!directory.find_shard(device, shard)) {
+            return false;
+        }
+        ReadPool::Lease db = shards.get(shard);
+        bool found = latest_in_partitions(*db, shards.partitions(shard), device, data);
+        // Ферма давно молчит и её сырые строки уже перенесены в блоки
+        if(!found) {
+            int64_t horizon = sealed_until(db->handle(), device);
+            found = horizon > 0 && blocks.latest(device, horizon, data);
+        }
+        return found;
+    }
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "sensor_data.h"
+
+// Разбор показания контроллера за один проход без DOM: сканер идёт по тексту, значения
+// известных ключей (SENSOR_FIELDS, "timestamp", "seq") сразу пишутся в SensorPayload,
+// остальные ключи копируются как есть в extra. Метрика, которой нет или которая не число
+// (null, строка, вне диапазона double), остаётся SENSOR_MISSING - в sensor_data это NULL,
+// показание не теряется. Нецелые "timestamp"/"seq" считаются отсутствующими.
+// Весь текст проверяется по грамматике JSON: битое сообщение - std::runtime_error.
+
+constexpr int SENSOR_PARSER_MAX_DEPTH = 64;   // Вложенность значений неизвестных ключей
+
+struct SensorPayload {
+    SensorData row;
+    FieldMask present;       // Какие метрики пришли числами
+    bool has_timestamp;      // "timestamp" и "seq" - целые
+    bool has_seq;
+    int64_t timestamp;
+    int64_t seq;
+    std::string extra;       // Неизвестные ключи: {"key":value,...}, пусто - их не было
+};
+
+class SensorPayloadScanner {
+    const char* pos;
+    const char* end;
+
+    [[noreturn]] void fail(const char* what) const {
+        throw std::runtime_error(std::string("Bad sensor payload: ") + what);
+    }
+
+    void skip_spaces() {
+        while(pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')) {
+            ++pos;
+        }
+    }
+
+    void expect(char c, const char* what) {
+        skip_spaces();
+        if(pos >= end || *pos != c) {
+            fail(what);
+        }
+        ++pos;
+    }
+
+    // pos на открывающей кавычке; возвращает содержимое без кавычек, escape не раскрываются
+    std::pair<const char*, size_t> scan_string() {
+        const char* start = ++pos;
+        while(pos < end && *pos != '"') {
+            unsigned char c = static_cast<unsigned char>(*pos);
+            if(c < 0x20) {
+                fail("control character in string");
+            }
+            if(c == '\\') {
+                if(++pos >= end) {
+                    break;
+                }
+                if(*pos == 'u') {
+                    for(int i = 0; i < 4; ++i) {
+                        if(++pos >= end || !std::isxdigit(static_cast<unsigned char>(*pos))) {
+                            fail("bad \\u escape");
+                        }
+                    }
+                }
+                else if(!std::strchr("\"\\/bfnrt", *pos)) {
+                    fail("bad escape");
+                }
+            }
+            ++pos;
+        }
+        if(pos >= end) {
+            fail("unterminated string");
+        }
+        return {start, static_cast<size_t>(pos++ - start)};
+    }
+
+    // Число по грамматике JSON; integer - без дробной части и экспоненты
+    std::pair<const char*, size_t> scan_number(bool& integer) {
+        const char* start = pos;
+        auto digits = [this]() {
+            const char* from = pos;
+            while(pos < end && *pos >= '0' && *pos <= '9') {
+                ++pos;
+            }
+            return pos - from;
+        };
+        if(pos < end && *pos == '-') {
+            ++pos;
+        }
+        if(pos < end && *pos == '0') {
+            ++pos;
+        }
+        else if(digits() == 0) {
+            fail("bad number");
+        }
+        integer = true;
+        if(pos < end && *pos == '.') {
+            ++pos;
+            integer = false;
+            if(digits() == 0) {
+                fail("bad number");
+            }
+        }
+        if(pos < end && (*pos == 'e' || *pos == 'E')) {
+            ++pos;
+            integer = false;
+            if(pos < end && (*pos == '+' || *pos == '-')) {
+                ++pos;
+            }
+            if(digits() == 0) {
+                fail("bad number");
+            }
+        }
+        return {start, static_cast<size_t>(pos - start)};
+    }
+
+    void scan_literal(const char* word) {
+        size_t length = std::strlen(word);
+        if(static_cast<size_t>(end - pos) < length || std::memcmp(pos, word, length) != 0) {
+            fail("unexpected character");
+        }
+        pos += length;
+    }
+
+    // Значение неизвестного ключа: только проверка, копирует вызывающий
+    void skip_value(int depth) {
+        skip_spaces();
+        if(pos >= end) {
+            fail("unexpected end");
+        }
+        if(depth > SENSOR_PARSER_MAX_DEPTH) {
+            fail("nesting too deep");
+        }
+        char c = *pos;
+        if(c == '"') {
+            scan_string();
+        }
+        else if(c == '{' || c == '[') {
+            char close = c == '{' ? '}' : ']';
+            ++pos;
+            skip_spaces();
+            if(pos < end && *pos == close) {
+                ++pos;
+                return;
+            }
+            while(true) {
+                if(c == '{') {
+                    skip_spaces();
+                    if(pos >= end || *pos != '"') {
+                        fail("expected key");
+                    }
+                    scan_string();
+                    expect(':', "expected ':'");
+                }
+                skip_value(depth + 1);
+                skip_spaces();
+                if(pos < end && *pos == ',') {
+                    ++pos;
+                    continue;
+                }
+                expect(close, "expected ',' or closing bracket");
+                return;
+            }
+        }
+        else if(c == 't') {
+            scan_literal("true");
+        }
+        else if(c == 'f') {
+            scan_literal("false");
+        }
+        else if(c == 'n') {
+            scan_literal("null");
+        }
+        else {
+            bool integer;
+            scan_number(integer);
+        }
+    }
+
+    // Индекс в SENSOR_FIELDS, -2 - "timestamp", -3 - "seq", -1 - неизвестный ключ
+    static int known_key(const char* key, size_t length) {
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            if(std::strlen(SENSOR_FIELDS[i]) == length && std::memcmp(SENSOR_FIELDS[i], key, length) == 0) {
+                return static_cast<int>(i);
+            }
+        }
+        if(length == 9 && std::memcmp(key, "timestamp", 9) == 0) {
+            return -2;
+        }
+        if(length == 3 && std::memcmp(key, "seq", 3) == 0) {
+            return -3;
+        }
+        return -1;
+    }
+
+    // Число вне диапазона from_chars: исчезающе малое (1e-400, денормали) - как у strtod,
+    // 0 или денормаль; слишком большое (1e999) - false
+    static bool parse_out_of_range(const char* text, size_t length, double& value) {
+        char buffer[64];
+        if(length >= sizeof(buffer)) {
+            return false;
+        }
+        std::memcpy(buffer, text, length);
+        buffer[length] = '\0';
+        value = std::strtod(buffer, nullptr);
+        return std::isfinite(value);
+    }
+
+    // Значение известного ключа: число разбирается на месте, всё остальное (null, строка,
+    // объект) проверяется и пропускается - ключ остаётся отсутствующим
+    void read_known(int key, SensorPayload& out) {
+        if(pos >= end || !(*pos == '-' || (*pos >= '0' && *pos <= '9'))) {
+            skip_value(1);
+            return;
+        }
+        bool integer;
+        auto number = scan_number(integer);
+        if(key >= 0) {
+            double value;
+            if(std::from_chars(number.first, number.first + number.second, value).ec != std::errc() &&
+               !parse_out_of_range(number.first, number.second, value)) {
+                return;
+            }
+            set_sensor_field(out.row, static_cast<size_t>(key), value);
+            out.present |= static_cast<FieldMask>(1u << key);
+            return;
+        }
+        int64_t value;
+        if(!integer || std::from_chars(number.first, number.first + number.second, value).ec != std::errc()) {
+            return;
+        }
+        (key == -2 ? out.has_timestamp : out.has_seq) = true;
+        (key == -2 ? out.timestamp : out.seq) = value;
+    }
+
+public:
+    // extra у out переиспользуется между вызовами
+    void scan(const char* data, size_t size, SensorPayload& out) {
+        pos = data;
+        end = data + size;
+        out.row = SensorData{};
+        for(size_t i = 0; i < SENSOR_FIELDS_COUNT; ++i) {
+            set_sensor_field(out.row, i, SENSOR_MISSING);
+        }
+        out.present = 0;
+        out.has_timestamp = out.has_seq = false;
+        out.timestamp = out.seq = 0;
+        out.extra.clear();
+
+        expect('{', "not a JSON object");
+        skip_spaces();
+        if(pos < end && *pos == '}') {
+            ++pos;
+        }
+        else {
+            while(true) {
+                skip_spaces();
+                if(pos >= end || *pos != '"') {
+                    fail("expected key");
+                }
+                const char* key_start = pos;
+                auto key = scan_string();
+                expect(':', "expected ':'");
+                int field = known_key(key.first, key.second);
+                if(field >= 0) {
+                    // Повтор ключа: как у nlohmann, действует последнее значение
+                    set_sensor_field(out.row, static_cast<size_t>(field), SENSOR_MISSING);
+                    out.present &= static_cast<FieldMask>(~(1u << field));
+                }
+                else if(field == -2) {
+                    out.has_timestamp = false;
+                }
+                else if(field == -3) {
+                    out.has_seq = false;
+                }
+                skip_spaces();
+                const char* value_start = pos;
+                if(field != -1) {
+                    read_known(field, out);
+                }
+                else {
+                    skip_value(1);
+                    out.extra += out.extra.empty() ? '{' : ',';
+                    out.extra.append(key_start, key.second + 2);
+                    out.extra += ':';
+                    out.extra.append(value_start, static_cast<size_t>(pos - value_start));
+                }
+                skip_spaces();
+                if(pos < end && *pos == ',') {
+                    ++pos;
+                    continue;
+                }
+                expect('}', "expected ',' or '}'");
+                break;
+            }
+        }
+        skip_spaces();
+        if(pos != end) {
+            fail("trailing characters");
+        }
+        if(!out.extra.empty()) {
+            out.extra += '}';
+        }
+    }
+};
+
+inline void scan_sensor_payload(const std::string& payload, SensorPayload& out) {
+    SensorPayloadScanner scanner;
+    scanner.scan(payload.data(), payload.size(), out);
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sqlite3.h>
+
+// Пул соединений только для чтения к одному файлу SQLite. Поток пула забирает
+// соединение на время запроса и возвращает его: читатели не делят один sqlite3*
+// (его мьютекс сериализовал все запросы сервиса), а с писателем их разводит WAL.
+// У каждого соединения - кэш подготовленных запросов, общий для всего кода чтения.
+
+constexpr int64_t READ_MMAP_SIZE = 256ll * 1024 * 1024;
+constexpr size_t READ_POOL_SIZE = 8;  // Не меньше потоков-читателей сервиса
+constexpr size_t READ_STATEMENT_CACHE = 64;  // Запросы с проекцией и условиями клиента собираются на лету
+
+class ReadConnection {
+    sqlite3* db = nullptr;
+    std::unordered_map<std::string, sqlite3_stmt*> statements;
+
+public:
+    // uri - путь или file:-URI (immutable=1 для закрытых месячных файлов)
+    explicit ReadConnection(const std::string& uri) {
+        if(sqlite3_open_v2(uri.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX,
+                           nullptr) != SQLITE_OK) {
+            std::string message = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            throw std::runtime_error(message);
+        }
+        sqlite3_busy_timeout(db, 5000);
+        // Страницы читаются из отображения файла, без копии в кэш каждого соединения
+        std::string mmap = "PRAGMA mmap_size=" + std::to_string(READ_MMAP_SIZE) + ";";
+        sqlite3_exec(db, mmap.c_str(), nullptr, nullptr, nullptr);
+    }
+
+    ~ReadConnection() {
+        for(auto& entry : statements) {
+            sqlite3_finalize(entry.second);
+        }
+        sqlite3_close(db);
+    }
+
+    ReadConnection(const ReadConnection&) = delete;
+    ReadConnection& operator=(const ReadConnection&) = delete;
+
+    sqlite3* handle() const { return db; }
+
+    // Сброшенный запрос из кэша, подготавливается при первом обращении;
+    // nullptr, если его нельзя подготовить (например, в файле нет таблицы)
+    sqlite3_stmt* statement(const std::string& sql) {
+        auto it = statements.find(sql);
+        if(it != statements.end()) {
+            sqlite3_reset(it->second);
+            sqlite3_clear_bindings(it->second);
+            return it->second;
+        }
+        // Соединение у одного потока, запросы из кэша между вызовами не используются
+        if(statements.size() >= READ_STATEMENT_CACHE) {
+            for(auto& entry : statements) {
+                sqlite3_finalize(entry.second);
+            }
+            statements.clear();
+        }
+        sqlite3_stmt* stmt = nullptr;
+        if(sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+            return nullptr;
+        }
+        statements.emplace(sql, stmt);
+        return stmt;
+    }
+};
+
+class ReadPool : public std::enable_shared_from_this<ReadPool> {
+    std::string uri;
+    size_t max_size;
+    size_t opened = 0;
+    std::vector<std::unique_ptr<ReadConnection>> idle;
+    std::mutex mutex;
+    std::condition_variable available;
+
+    void give_back(std::unique_ptr<ReadConnection> connection) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(std::move(connection));
+        }
+        available.notify_one();
+    }
+
+public:
+    // Соединение на время запроса; возвращается в пул деструктором
+    class Lease {
+        std::shared_ptr<ReadPool> pool;
+        std::unique_ptr<ReadConnection> connection;
+
+    public:
+        Lease() = default;
+        Lease(std::shared_ptr<ReadPool> owner, std::unique_ptr<ReadConnection> c)
+            : pool(std::move(owner)), connection(std::move(c)) {}
+        Lease(Lease&&) = default;
+        Lease& operator=(Lease&& other) {
+            release();
+            pool = std::move(other.pool);
+            connection = std::move(other.connection);
+            return *this;
+        }
+        ~Lease() { release(); }
+
+        void release() {
+            if(pool && connection) {
+                pool->give_back(std::move(connection));
+            }
+            pool.reset();
+        }
+
+        explicit operator bool() const { return connection != nullptr; }
+        ReadConnection* operator->() const { return connection.get(); }
+        ReadConnection& operator*() const { return *connection; }
+    };
+
+    ReadPool(const std::string& path_or_uri, size_t size = READ_POOL_SIZE)
+        : uri(path_or_uri), max_size(size ? size : 1) {}
+
+    ReadPool(const ReadPool&) = delete;
+    ReadPool& operator=(const ReadPool&) = delete;
+
+    // Свободное соединение; новое открывается, пока их меньше max_size, иначе ждём
+    Lease checkout() {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return !idle.empty() || opened < max_size; });
+        if(!idle.empty()) {
+            std::unique_ptr<ReadConnection> connection = std::move(idle.back());
+            idle.pop_back();
+            return Lease(shared_from_this(), std::move(connection));
+        }
+        ++opened;
+        lock.unlock();
+        try {
+            return Lease(shared_from_this(), std::make_unique<ReadConnection>(uri));
+        }
+        catch(...) {
+            lock.lock();
+            --opened;
+            available.notify_one();
+            throw;
+        }
+    }
+};
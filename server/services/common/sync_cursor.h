@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "sensor_data.h"
+
+// Курсор докачки истории для телефона ("cursor" в запросе logs_to_phone).
+// Клиент не разбирает курсор, а возвращает его как есть: следующая страница начинается
+// сразу после последней отданной строки. Внутри - время последней строки и сколько строк
+// с этим временем уже отдано (одна секунда может содержать несколько показаний с разным
+// seq), плюс хеш device_id, чтобы курсор одной фермы не применился к другой.
+// Строка - 32 hex-символа: int64 время, uint32 число строк, uint32 хеш.
+
+constexpr size_t SYNC_CURSOR_LENGTH = 32;
+
+struct SyncCursor {
+    int64_t timestamp = 0;
+    uint32_t skip = 0;       // Строк с временем timestamp, которые клиент уже получил
+
+    // Продвигает курсор за отданную строку; строки идут по возрастанию времени
+    void advance(const SensorData& row) {
+        if(row.timestamp_unix == timestamp) {
+            ++skip;
+        }
+        else {
+            timestamp = row.timestamp_unix;
+            skip = 1;
+        }
+    }
+};
+
+inline uint32_t sync_device_hash(const std::string& device) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for(unsigned char c : device) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+inline std::string encode_sync_cursor(const SyncCursor& cursor, const std::string& device) {
+    static const char HEX[] = "0123456789abcdef";
+    uint64_t parts[2] = {
+        static_cast<uint64_t>(cursor.timestamp),
+        (static_cast<uint64_t>(cursor.skip) << 32) | sync_device_hash(device)
+    };
+    std::string out;
+    out.reserve(SYNC_CURSOR_LENGTH);
+    for(uint64_t part : parts) {
+        for(int shift = 60; shift >= 0; shift -= 4) {
+            out.push_back(HEX[(part >> shift) & 0xF]);
+        }
+    }
+    return out;
+}
+
+// false - курсор испорчен или выдан для другой фермы
+inline bool decode_sync_cursor(const std::string& text, const std::string& device, SyncCursor& cursor) {
+    if(text.size() != SYNC_CURSOR_LENGTH) {
+        return false;
+    }
+    uint64_t parts[2] = {0, 0};
+    for(size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        uint64_t digit;
+        if(c >= '0' && c <= '9') {
+            digit = c - '0';
+        }
+        else if(c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        }
+        else {
+            return false;
+        }
+        parts[i / 16] = (parts[i / 16] << 4) | digit;
+    }
+    if(static_cast<uint32_t>(parts[1]) != sync_device_hash(device)) {
+        return false;
+    }
+    cursor.timestamp = static_cast<int64_t>(parts[0]);
+    cursor.skip = static_cast<uint32_t>(parts[1] >> 32);
+    return true;
+}
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <lz4.h>
+#include <zstd.h>
+#include "sensor_data.h"
+
+// Формат ответа v2 для телефона ("format": 2 в запросе; v1 - 56 байт на показание).
+// Заголовок "IOP2" и байт версии, затем независимые кадры до WIRE_FRAME_ROWS показаний:
+//   uint32 raw_size, uint32 stored_size, uint8 codec, stored_size байт кадра
+// Конец ответа - uint32 0 и uint32 общее число показаний. uint32 - в сетевом порядке.
+//
+// Кадр до сжатия хранится по столбцам:
+//   varint n, 6 байт режимов полей,
+//   n меток времени - zigzag varint разности с предыдущей (первая - от 0),
+//   по каждому полю n значений:
+//     режим k <= WIRE_MAX_DECIMALS - zigzag varint разности value * 10^k (все значения
+//       кадра точно представимы с k знаками, например 24.4 или 23.9375);
+//     режим WIRE_XOR - XOR с предыдущим значением: байт (ведущие нулевые байты << 4 |
+//       хвостовые нулевые байты), затем оставшиеся байты от старшего к младшему.
+// Декодирование восстанавливает double побитно.
+//
+// Запрос с "fields" (только часть метрик): версия WIRE_VERSION_FIELDS, за ней байт - битовая
+// маска полей (бит i - SENSOR_FIELDS[i]); в кадре режимы и столбцы только этих полей.
+
+constexpr uint8_t WIRE_VERSION = 2;
+constexpr uint8_t WIRE_VERSION_FIELDS = 3;
+constexpr size_t WIRE_FRAME_ROWS = 512;
+constexpr unsigned WIRE_MAX_DECIMALS = 6;
+constexpr uint8_t WIRE_XOR = 0x80;
+constexpr size_t WIRE_FRAME_HEADER = 2 * sizeof(uint32_t) + 1;
+constexpr int WIRE_ZSTD_LEVEL = 1;
+
+enum class WireCodec : uint8_t {
+    None = 0,
+    Lz4 = 1,
+    Zstd = 2
+};
+
+// "none" / "lz4" / "zstd"; false для неизвестного имени
+inline bool parse_wire_codec(const std::string& name, WireCodec& codec) {
+    if(name == "none") {
+        codec = WireCodec::None;
+    }
+    else if(name == "lz4") {
+        codec = WireCodec::Lz4;
+    }
+    else if(name == "zstd") {
+        codec = WireCodec::Zstd;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+inline void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while(value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void put_uint32(uint8_t* out, uint32_t value) {
+    value = htonl(value);
+    std::memcpy(out, &value, sizeof(value));
+}
+
+inline uint32_t get_uint32(const uint8_t* in) {
+    uint32_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return ntohl(value);
+}
+
+constexpr double WIRE_POW10[WIRE_MAX_DECIMALS + 1] = {1, 10, 100, 1e3, 1e4, 1e5, 1e6};
+
+// Значение с decimals знаками после запятой точно (побитно) восстанавливается из целого
+inline bool wire_scaled(double value, unsigned decimals, int64_t& scaled) {
+    double x = value * WIRE_POW10[decimals];
+    if(!(std::fabs(x) < 9007199254740992.0)) {  // 2^53; заодно отсекает NaN и бесконечность
+        return false;
+    }
+    scaled = std::llround(x);
+    double back = static_cast<double>(scaled) / WIRE_POW10[decimals];
+    return std::memcmp(&back, &value, sizeof(value)) == 0;
+}
+
+// Собирает показания в кадр; буферы выделяются один раз на ответ
+class WireEncoder {
+    WireCodec codec;
+    std::vector<size_t> fields;
+    SensorData rows[WIRE_FRAME_ROWS];
+    size_t count = 0;
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> packed;
+    ZSTD_CCtx* zstd = nullptr;
+
+    uint8_t pick_mode(size_t field) const {
+        unsigned decimals = 0;
+        int64_t scaled;
+        for(size_t i = 0; i < count; ++i) {
+            double value = sensor_field(rows[i], field);
+            while(!wire_scaled(value, decimals, scaled)) {
+                if(++decimals > WIRE_MAX_DECIMALS) {
+                    return WIRE_XOR;
+                }
+            }
+        }
+        return static_cast<uint8_t>(decimals);
+    }
+
+    void put_xor(uint64_t x) {
+        unsigned leading = x ? static_cast<unsigned>(__builtin_clzll(x)) / 8 : 8;
+        unsigned trailing = x ? static_cast<unsigned>(__builtin_ctzll(x)) / 8 : 0;
+        raw.push_back(static_cast<uint8_t>(leading << 4 | trailing));
+        for(int shift = 56 - static_cast<int>(leading) * 8; shift >= static_cast<int>(trailing) * 8; shift -= 8) {
+            raw.push_back(static_cast<uint8_t>(x >> shift));
+        }
+    }
+
+    // Несжатый кадр в raw после места под заголовок
+    void encode_columns() {
+        raw.resize(WIRE_FRAME_HEADER);
+        put_varint(raw, count);
+        uint8_t modes[SENSOR_FIELDS_COUNT];
+        for(size_t f : fields) {
+            modes[f] = pick_mode(f);
+            raw.push_back(modes[f]);
+        }
+        int64_t prev_ts = 0;
+        for(size_t i = 0; i < count; ++i) {
+            put_varint(raw, zigzag(rows[i].timestamp_unix - prev_ts));
+            prev_ts = rows[i].timestamp_unix;
+        }
+        for(size_t f : fields) {
+            if(modes[f] == WIRE_XOR) {
+                uint64_t prev = 0;
+                for(size_t i = 0; i < count; ++i) {
+                    double value = sensor_field(rows[i], f);
+                    uint64_t bits;
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    put_xor(bits ^ prev);
+                    prev = bits;
+                }
+                continue;
+            }
+            int64_t prev = 0;
+            int64_t scaled = 0;
+            for(size_t i = 0; i < count; ++i) {
+                wire_scaled(sensor_field(rows[i], f), modes[f], scaled);
+                put_varint(raw, zigzag(scaled - prev));
+                prev = scaled;
+            }
+        }
+    }
+
+    // Сжатие в packed; false, если сжатый кадр не меньше исходного
+    bool compress(size_t raw_size) {
+        const char* src = reinterpret_cast<const char*>(raw.data() + WIRE_FRAME_HEADER);
+        size_t stored = 0;
+        if(codec == WireCodec::Lz4) {
+            packed.resize(WIRE_FRAME_HEADER + LZ4_compressBound(static_cast<int>(raw_size)));
+            int n = LZ4_compress_default(src, reinterpret_cast<char*>(packed.data() + WIRE_FRAME_HEADER),
+                                         static_cast<int>(raw_size), static_cast<int>(packed.size() - WIRE_FRAME_HEADER));
+            stored = n > 0 ? static_cast<size_t>(n) : 0;
+        }
+        else if(codec == WireCodec::Zstd) {
+            packed.resize(WIRE_FRAME_HEADER + ZSTD_compressBound(raw_size));
+            size_t n = ZSTD_compressCCtx(zstd, packed.data() + WIRE_FRAME_HEADER, packed.size() - WIRE_FRAME_HEADER,
+                                         src, raw_size, WIRE_ZSTD_LEVEL);
+            stored = ZSTD_isError(n) ? 0 : n;
+        }
+        if(stored == 0 || stored >= raw_size) {
+            return false;
+        }
+        packed.resize(WIRE_FRAME_HEADER + stored);
+        put_uint32(packed.data(), static_cast<uint32_t>(raw_size));
+        put_uint32(packed.data() + sizeof(uint32_t), static_cast<uint32_t>(stored));
+        packed[2 * sizeof(uint32_t)] = static_cast<uint8_t>(codec);
+        return true;
+    }
+
+public:
+    explicit WireEncoder(WireCodec c = WireCodec::None, FieldMask mask = ALL_SENSOR_FIELDS) : codec(c) {
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            if(has_sensor_field(mask, f)) {
+                fields.push_back(f);
+            }
+        }
+        raw.reserve(WIRE_FRAME_HEADER + 16 + WIRE_FRAME_ROWS * (10 + SENSOR_FIELDS_COUNT * 9));
+        if(codec == WireCodec::Zstd) {
+            zstd = ZSTD_createCCtx();
+            if(!zstd) {
+                throw std::runtime_error("Cannot create zstd context");
+            }
+        }
+    }
+
+    ~WireEncoder() { ZSTD_freeCCtx(zstd); }
+
+    WireEncoder(const WireEncoder&) = delete;
+    WireEncoder& operator=(const WireEncoder&) = delete;
+
+    // true - кадр заполнен, пора вызвать frame()
+    bool add(const SensorData& row) {
+        rows[count++] = row;
+        return count == WIRE_FRAME_ROWS;
+    }
+
+    size_t pending() const { return count; }
+
+    // Кадр с заголовком из накопленных показаний; действителен до следующего вызова
+    const std::vector<uint8_t>& frame() {
+        encode_columns();
+        count = 0;
+        size_t raw_size = raw.size() - WIRE_FRAME_HEADER;
+        if(codec != WireCodec::None && compress(raw_size)) {
+            return packed;
+        }
+        put_uint32(raw.data(), static_cast<uint32_t>(raw_size));
+        put_uint32(raw.data() + sizeof(uint32_t), static_cast<uint32_t>(raw_size));
+        raw[2 * sizeof(uint32_t)] = static_cast<uint8_t>(WireCodec::None);
+        return raw;
+    }
+};
+
+constexpr char WIRE_MAGIC[4] = {'I', 'O', 'P', '2'};
+constexpr size_t WIRE_HEADER_SIZE = sizeof(WIRE_MAGIC) + 1;
+
+inline size_t wire_header_size(FieldMask fields = ALL_SENSOR_FIELDS) {
+    return WIRE_HEADER_SIZE + (fields == ALL_SENSOR_FIELDS ? 0 : 1);
+}
+
+// wire_header_size(fields) байт
+inline void wire_header(uint8_t* out, FieldMask fields = ALL_SENSOR_FIELDS) {
+    std::memcpy(out, WIRE_MAGIC, sizeof(WIRE_MAGIC));
+    if(fields == ALL_SENSOR_FIELDS) {
+        out[sizeof(WIRE_MAGIC)] = WIRE_VERSION;
+        return;
+    }
+    out[sizeof(WIRE_MAGIC)] = WIRE_VERSION_FIELDS;
+    out[WIRE_HEADER_SIZE] = fields;
+}
+
+// Разбор кадра для клиентов на C++ (нагрузочные тесты, бенчмарки).
+// data - stored_size байт после заголовка кадра; показания дописываются в out,
+// fields - маска из заголовка ответа (поля вне её остаются нулями).
+class WireDecoder {
+    std::vector<uint8_t> scratch;
+    const uint8_t* pos = nullptr;
+    const uint8_t* end = nullptr;
+
+    uint8_t byte() {
+        if(pos == end) {
+            throw std::runtime_error("Truncated wire frame");
+        }
+        return *pos++;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for(unsigned shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            value |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if(!(b & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Bad varint in wire frame");
+    }
+
+public:
+    void decode(const uint8_t* data, size_t stored_size, size_t raw_size, WireCodec codec,
+                std::vector<SensorData>& out, FieldMask fields = ALL_SENSOR_FIELDS) {
+        if(codec == WireCodec::None) {
+            pos = data;
+            end = data + stored_size;
+        }
+        else {
+            scratch.resize(raw_size);
+            size_t n = 0;
+            if(codec == WireCodec::Lz4) {
+                int r = LZ4_decompress_safe(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(scratch.data()),
+                                            static_cast<int>(stored_size), static_cast<int>(raw_size));
+                n = r < 0 ? 0 : static_cast<size_t>(r);
+            }
+            else if(codec == WireCodec::Zstd) {
+                size_t r = ZSTD_decompress(scratch.data(), raw_size, data, stored_size);
+                n = ZSTD_isError(r) ? 0 : r;
+            }
+            if(n != raw_size) {
+                throw std::runtime_error("Cannot decompress wire frame");
+            }
+            pos = scratch.data();
+            end = pos + raw_size;
+        }
+
+        size_t count = varint();
+        uint8_t modes[SENSOR_FIELDS_COUNT];
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            if(!has_sensor_field(fields, f)) {
+                continue;
+            }
+            modes[f] = byte();
+            if(modes[f] > WIRE_MAX_DECIMALS && modes[f] != WIRE_XOR) {
+                throw std::runtime_error("Unknown value mode in wire frame");
+            }
+        }
+        size_t first = out.size();
+        out.resize(first + count, SensorData{});
+        int64_t ts = 0;
+        for(size_t i = 0; i < count; ++i) {
+            ts += unzigzag(varint());
+            out[first + i].timestamp_unix = ts;
+        }
+        for(size_t f = 0; f < SENSOR_FIELDS_COUNT; ++f) {
+            if(!has_sensor_field(fields, f)) {
+                continue;
+            }
+            uint64_t prev_bits = 0;
+            int64_t prev_scaled = 0;
+            for(size_t i = 0; i < count; ++i) {
+                double value;
+                if(modes[f] == WIRE_XOR) {
+                    uint8_t control = byte();
+                    unsigned leading = control >> 4;
+                    unsigned trailing = control & 0x0F;
+                    if(leading + trailing > 8) {
+                        throw std::runtime_error("Bad XOR control in wire frame");
+                    }
+                    uint64_t x = 0;
+                    for(unsigned b = leading; b < 8 - trailing; ++b) {
+                        x = x << 8 | byte();
+                    }
+                    prev_bits ^= trailing < 8 ? x << (trailing * 8) : 0;
+                    std::memcpy(&value, &prev_bits, sizeof(value));
+                }
+                else {
+                    prev_scaled += unzigzag(varint());
+                    value = static_cast<double>(prev_scaled) / WIRE_POW10[modes[f]];
+                }
+                set_sensor_field(out[first + i], f, value);
+            }
+        }
+    }
+};
@@ -1 +1 @@
-g++ config.cpp -o CONFIG     -lboost_system     -lboost_thread     -lpaho-mqttpp3     -lpaho-mqtt3as
+g++ -std=c++17 -pthread -o CONFIG config.cpp -I/usr/include/boost -lboost_system -lboost_thread -lpaho-mqttpp3 -lpaho-mqtt3as
@@ -1,103 +1,125 @@
 #include <iostream>
 #include <sqlite3.h>
 #include <mqtt/async_client.h>
-#include <nlohmann/json.hpp>
 #include <chrono>
 #include <thread>
+#include <memory>
 #include <unistd.h>
+#include "../common/ingest_pipeline.h"
+#include "../common/device_shards.h"
+#include "../common/block_store.h"
+#include "../common/hot_ring.h"
+#include "../common/access_log.h"
+#include "../common/metrics.h"
 
 using namespace std;
-using json = nlohmann::json;
 
 const string MQTT_BROKER = "tcp://localhost:1883";
-const string MQTT_TOPIC = "/farm001/data";
-const string DB_FILE = "/home/tovarichkek/services/data_server_farm/data.db";
+const string MQTT_TOPIC = "/+/data";  // Все фермы: /farm001/data, /farm002/data, ...
+const string MQTT_DATA_SUFFIX = "/data";
+const string DB_FILE = "/home/tovarichkek/services/data_server_farm/data.db";  // Сырые строки - в data.YYYYMM.db рядом
+const string BLOCKS_DIR = "/home/tovarichkek/services/data_server_farm/blocks";
+const size_t SHARD_COUNT = 4;  // Потоков-писателей и файлов БД (data.db, data_1.db, ...)
+const int SEAL_INTERVAL_SEC = 600;  // Как часто закрытые сутки переносятся в блоки
+const int64_t SEAL_GRACE_SEC = 300;  // Сутки закрываются не сразу: в очередях могут быть их последние строки
+const int64_t RAW_RETENTION_SEC = 7 * 86400;  // Сколько сырых строк держать в SQLite после переноса
+const int STATS_INTERVAL_SEC = 60;
+const int METRICS_PORT = 9100;  // Метрики: GET http://127.0.0.1:9100/metrics
+const string INGEST_LOG_FILE = "/var/log/farm_data.log";  // Отброшенные и неразобранные сообщения
 
 class MQTTListener : public virtual mqtt::callback {
-    sqlite3* db;
-    
-    void create_table() {
-        const char* sql = 
-            "CREATE TABLE IF NOT EXISTS sensor_data ("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "timestamp_unix INTEGER,"
-            "temperature_DHT22 REAL,"
-            "temperature_DS18B20 REAL,"
-            "humidity REAL,"
-            "water_level REAL,"
-            "soil_moisture REAL,"
-            "light_intensity REAL);";
-            
-        if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
-            throw runtime_error(sqlite3_errmsg(db));
-        }
-    }
+    ShardedIngest& ingest;
+    AccessLog& ingest_log;  // Колбэк Paho не ждёт journald на каждом отброшенном сообщении
 
 public:
-    MQTTListener() {
-        if (sqlite3_open(DB_FILE.c_str(), &db) != SQLITE_OK) {
-            throw runtime_error(sqlite3_errmsg(db));
-        }
-        create_table();
-    }
-
-    ~MQTTListener() {
-        sqlite3_close(db);
-    }
+    MQTTListener(ShardedIngest& ingest, AccessLog& ingest_log) : ingest(ingest), ingest_log(ingest_log) {}
 
     void message_arrived(mqtt::const_message_ptr msg) override {
         try {
-            auto j = json::parse(msg->get_payload());
-            
-            // Получаем текущее время в Unix time
-            auto now = chrono::system_clock::now();
-            auto timestamp = chrono::duration_cast<chrono::seconds>(
-                now.time_since_epoch()).count();
-            
-            sqlite3_stmt* stmt;
-            const char* sql = "INSERT INTO sensor_data (timestamp_unix, "
-                "temperature_DHT22, temperature_DS18B20, humidity, "
-                "water_level, soil_moisture, light_intensity) "
-                "VALUES (?, ?, ?, ?, ?, ?, ?);";
-            
-            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-                cerr << "Prepare error: " << sqlite3_errmsg(db) << endl;
+            string device;
+            if (!device_from_topic(msg->get_topic(), MQTT_DATA_SUFFIX, device)) {
+                ingest_log.log("Topic: " + msg->get_topic() + " | Ignored: unexpected topic");
                 return;
             }
-            
-            // Привязываем параметры
-            sqlite3_bind_int64(stmt, 1, timestamp);
-            sqlite3_bind_double(stmt, 2, j["temperature_DHT22"].get<double>());
-            sqlite3_bind_double(stmt, 3, j["temperature_DS18B20"].get<double>());
-            sqlite3_bind_double(stmt, 4, j["humidity"].get<double>());
-            sqlite3_bind_double(stmt, 5, j["water_level"].get<double>());
-            sqlite3_bind_double(stmt, 6, j["soil_moisture"].get<double>());
-            sqlite3_bind_double(stmt, 7, j["light_intensity"].get<double>());
-            
-            if (sqlite3_step(stmt) != SQLITE_DONE) {
-                cerr << "Insert error: " << sqlite3_errmsg(db) << endl;
+
+            // Время прихода: для строк без времени устройства и для замера задержки
+            auto now = chrono::system_clock::now();
+            auto received_at = chrono::duration_cast<chrono::seconds>(
+                now.time_since_epoch()).count();
+
+            // В БД пишет поток конвейера шарда, здесь только разбор и постановка в очередь.
+            // Повтор retained-сообщения после переподключения отсекается уникальным ключом.
+            int64_t sequence;
+            string extra;
+            SensorData data = parse_sensor_payload(msg->get_payload(), received_at, sequence, extra);
+            if (!ingest.submit(device, data, sequence, received_at, move(extra))) {
+                ingest_log.log("Device: " + device + " | Dropped: ingest queue full");
             }
-            
-            sqlite3_finalize(stmt);
         }
         catch (const exception& e) {
-            cerr << "Error processing message: " << e.what() << endl;
+            ingest_log.log("Topic: " + msg->get_topic() + " | Error: " + e.what());
         }
     }
 };
 
 int main() {
     try {
+        DeviceDirectory directory(DB_FILE, SHARD_COUNT);
+
+        // Свежие строки для logs_to_phone; без разделяемой памяти сервис работает как раньше
+        unique_ptr<HotRingWriter> hot_ring;
+        try {
+            hot_ring = make_unique<HotRingWriter>();
+        }
+        catch (const exception& e) {
+            cerr << "Hot ring disabled: " << e.what() << endl;
+        }
+        IngestOptions options;
+        options.hot_ring = hot_ring.get();
+        ShardedIngest ingest(DB_FILE, directory, options);
+        AccessLog ingest_log(INGEST_LOG_FILE);
+        MQTTListener listener(ingest, ingest_log);
+        MetricsRegistry metrics;
+        metrics.add([&ingest, &ingest_log](MetricsWriter& out) {
+            write_metrics(out, ingest);
+            write_metrics(out, ingest_log);
+        });
+        MetricsServer metrics_server(metrics, METRICS_PORT);
         mqtt::async_client client(MQTT_BROKER, "mqtt2sql");
-        MQTTListener listener;
-        
+
         client.set_callback(listener);
         client.connect()->wait();
         client.subscribe(MQTT_TOPIC, 1);
-        
-        cout << "Service started. Press Enter to exit..." << endl;
+
+        // Перенос закрытых суток в сжатые блоки, закрытие прошлых месяцев и удаление старых
+        BlockStore blocks(BLOCKS_DIR);
+        thread sealer([&directory, &blocks]() {
+            while (true) {
+                try {
+                    int64_t now = chrono::duration_cast<chrono::seconds>(
+                        chrono::system_clock::now().time_since_epoch()).count();
+                    SealStats s = seal_all(directory, DB_FILE, blocks, now - SEAL_GRACE_SEC, RAW_RETENTION_SEC);
+                    if (s.blocks || s.pruned_rows || s.dropped_partitions) {
+                        cout << "Sealed " << s.blocks << " blocks (" << s.rows << " rows, "
+                             << s.bytes << " bytes), pruned " << s.pruned_rows << " rows, dropped "
+                             << s.dropped_partitions << " monthly partitions" << endl;
+                    }
+                }
+                catch (const exception& e) {
+                    cerr << "Block sealing error: " << e.what() << endl;
+                }
+                this_thread::sleep_for(chrono::seconds(SEAL_INTERVAL_SEC));
+            }
+        });
+        sealer.detach();
+
+        cout << "Service started with " << ingest.shard_count() << " shards" << endl;
         while(true){
-		sleep(1);
+		sleep(STATS_INTERVAL_SEC);
+		for (size_t i = 0; i < ingest.shard_count(); ++i) {
+			cout << "Ingest shard " << i << ": " << ingest.stats(i) << endl;
+		}
+		cout << "Ingest log: " << ingest_log.stats() << endl;
 	}
 
         client.unsubscribe(MQTT_TOPIC)->wait();
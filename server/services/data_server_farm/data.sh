@@ -1 +1,2 @@
-g++ -std=c++17 -o DATA data.cpp     -lsqlite3     -lpaho-mqttpp3     -lpaho-mqtt3a    -lpthread
+g++ -std=c++17 -o DATA data.cpp     -lboost_system     -lsqlite3     -lpaho-mqttpp3     -lpaho-mqtt3a    -lpthread
+g++ -std=c++17 -O2 -o MIGRATE_BLOCKS migrate_blocks.cpp     -lsqlite3    -lpthread
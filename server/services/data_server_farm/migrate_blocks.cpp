@@ -0,0 +1,163 @@
+// Перенос накопленной истории из sensor_data в сжатые блоки (blocks/).
+// Закрываются все полные сутки; перед удалением сырых строк блоки
+// перечитываются и сверяются с SQLite строка в строку.
+//
+//   ./MIGRATE_BLOCKS [--prune] [db_path] [blocks_dir]
+//
+// --prune: удалить перенесённые строки из SQLite (месячные файлы - целиком) и сделать VACUUM
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <sqlite3.h>
+#include "../common/ingest_pipeline.h"
+#include "../common/device_shards.h"
+#include "../common/partitions.h"
+#include "../common/block_store.h"
+
+using namespace std;
+
+const string DB_FILE = "/home/tovarichkek/services/data_server_farm/data.db";
+const string BLOCKS_DIR = "/home/tovarichkek/services/data_server_farm/blocks";
+const size_t SHARD_COUNT = 4;  // Как в data.cpp
+
+sqlite3* open_db(const string& path) {
+    sqlite3* db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        string message = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        throw runtime_error(message);
+    }
+    sqlite3_busy_timeout(db, 5000);
+    return db;
+}
+
+int64_t file_size(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+bool same_value(double a, double b) {
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// Сравнивает блоки устройства с сырыми строками шарда на [0, until)
+bool verify_device(sqlite3* db, PartitionReaders& partitions, const BlockStore& store,
+                   const string& device, int64_t until, size_t& rows) {
+    vector<SensorData> raw;
+    scan_partitions(db, partitions, device, 0, until - 1, [&raw](const SensorData& row) {
+        raw.push_back(row);
+        return true;
+    });
+    if (raw.empty()) {
+        return true;
+    }
+    // Более ранние строки могли быть удалены прошлым запуском с --prune
+    size_t next = 0;
+    bool ok = true;
+    store.scan(device, raw.front().timestamp_unix, until - 1, [&](const SensorData& row) {
+        bool match = next < raw.size() && raw[next].timestamp_unix == row.timestamp_unix;
+        for (size_t i = 0; match && i < SENSOR_FIELDS_COUNT; ++i) {
+            match = same_value(sensor_field(raw[next], i), sensor_field(row, i));
+        }
+        if (!match) {
+            cerr << device << ": mismatch at " << row.timestamp_unix << endl;
+            ok = false;
+            return false;
+        }
+        ++rows;
+        ++next;
+        return true;
+    });
+    if (ok && next < raw.size()) {
+        cerr << device << ": blocks are missing rows from " << raw[next].timestamp_unix << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    bool prune = false;
+    vector<string> positional;
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--prune") {
+            prune = true;
+        }
+        else {
+            positional.push_back(argv[i]);
+        }
+    }
+    string db_path = positional.size() > 0 ? positional[0] : DB_FILE;
+    string blocks_dir = positional.size() > 1 ? positional[1] : BLOCKS_DIR;
+
+    try {
+        DeviceDirectory directory(db_path, SHARD_COUNT);
+        int64_t sqlite_bytes = 0;
+        for (size_t shard = 0; shard < directory.total_shards(); ++shard) {
+            string path = shard_db_path(db_path, shard);
+            if (file_size(path) == 0 && directory.devices_in_shard(shard).empty()) {
+                continue;
+            }
+            sqlite3* db = open_db(path);
+            ensure_sensor_schema(db);
+            sqlite3_close(db);
+            sqlite_bytes += file_size(path);
+        }
+
+        BlockStore store(blocks_dir);
+        int64_t now = chrono::duration_cast<chrono::seconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        // Сырые строки здесь не трогаем: сначала сверка
+        SealStats sealed = seal_all(directory, db_path, store, now, -1);
+        cout << "Sealed " << sealed.blocks << " blocks, " << sealed.rows << " rows, "
+             << sealed.bytes << " bytes" << endl;
+
+        size_t verified = 0;
+        bool ok = true;
+        for (size_t shard = 0; shard < directory.total_shards(); ++shard) {
+            auto devices = directory.devices_in_shard(shard);
+            if (devices.empty()) {
+                continue;
+            }
+            string path = shard_db_path(db_path, shard);
+            sqlite3* db = open_db(path);
+            PartitionReaders partitions(path);
+            for (const auto& device : devices) {
+                ok = verify_device(db, partitions, store, device, sealed_until(db, device), verified) && ok;
+            }
+            sqlite3_close(db);
+        }
+        cout << "Verified " << verified << " rows: " << (ok ? "OK" : "FAILED") << endl;
+        if (!ok) {
+            return 1;
+        }
+
+        if (sealed.rows > 0) {
+            cout << "SQLite: " << sqlite_bytes << " bytes total, blocks: " << sealed.bytes
+                 << " bytes (" << static_cast<double>(sealed.bytes) / sealed.rows << " bytes/row)" << endl;
+        }
+
+        if (prune) {
+            seal_all(directory, db_path, store, now, 0);
+            int64_t after = 0;
+            for (size_t shard = 0; shard < directory.total_shards(); ++shard) {
+                string path = shard_db_path(db_path, shard);
+                if (file_size(path) == 0) {
+                    continue;
+                }
+                sqlite3* db = open_db(path);
+                exec_sql(db, "VACUUM;");
+                sqlite3_close(db);
+                after += file_size(path);
+            }
+            cout << "Pruned migrated rows, SQLite: " << sqlite_bytes << " -> " << after << " bytes" << endl;
+        }
+    }
+    catch (const exception& e) {
+        cerr << "Migration failed: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
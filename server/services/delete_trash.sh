@@ -1,5 +1,3 @@
-pkill COMMAND
-pkill CONFIG
+pkill GATEWAY
 pkill DATA
-pkill LOGS
 pkill LOGGER
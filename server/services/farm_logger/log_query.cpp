@@ -0,0 +1,111 @@
+// Поиск по журналу прошивки, который пишет logger.cpp (common/log_store.h).
+// Открываются только часы диапазона, блоки без нужного уровня или модуля
+// отсекаются по .idx без распаковки.
+//
+//   ./LOG_QUERY [--device farm001] [--last 6h | --from unix_time --to unix_time]
+//               [--level ERROR,WARN] [--module MQTT] [--grep text] [--limit N] [--dir path]
+//
+// --last: 30m, 6h, 2d; без диапазона - последние сутки. Сводка (время, прочитанные блоки) - в stderr
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <sstream>
+#include "../common/log_store.h"
+
+using namespace std;
+
+const string LOG_STORE_DIR = "/home/tovarichkek/services/farm_logger/logs";  // Как в logger.cpp
+const string DEFAULT_DEVICE = "farm001";
+
+int64_t parse_duration_ms(const string& text) {
+    size_t used = 0;
+    int64_t value = stoll(text, &used);
+    string unit = text.substr(used);
+    if (unit.empty() || unit == "s") return value * 1000;
+    if (unit == "m") return value * 60 * 1000;
+    if (unit == "h") return value * 3600 * 1000;
+    if (unit == "d") return value * 86400 * 1000;
+    throw runtime_error("Bad duration: " + text);
+}
+
+uint8_t parse_levels(const string& text) {
+    uint8_t levels = 0;
+    stringstream names(text);
+    string name;
+    while (getline(names, name, ',')) {
+        LogLevel level;
+        if (!parse_log_level(name, level)) {
+            throw runtime_error("Unknown level: " + name);
+        }
+        levels |= log_level_bit(level);
+    }
+    return levels;
+}
+
+string format_time(int64_t time_ms) {
+    time_t seconds = static_cast<time_t>(time_ms / 1000);
+    tm local;
+    localtime_r(&seconds, &local);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+    char millis[8];
+    snprintf(millis, sizeof(millis), ".%03d", static_cast<int>(time_ms % 1000));
+    return string(buffer) + millis;
+}
+
+int main(int argc, char* argv[]) {
+    string dir = LOG_STORE_DIR;
+    LogQuery query;
+    query.device = DEFAULT_DEVICE;
+    int64_t now_ms = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    query.from_ms = now_ms - 86400 * 1000;
+    size_t limit = SIZE_MAX;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (i + 1 >= argc) {
+                throw runtime_error("Missing value for " + arg);
+            }
+            string value = argv[++i];
+            if (arg == "--device") query.device = value;
+            else if (arg == "--last") query.from_ms = now_ms - parse_duration_ms(value);
+            else if (arg == "--from") query.from_ms = stoll(value) * 1000;
+            else if (arg == "--to") query.to_ms = stoll(value) * 1000 + 999;
+            else if (arg == "--level") query.levels = parse_levels(value);
+            else if (arg == "--module") query.module = value;
+            else if (arg == "--grep") query.contains = value;
+            else if (arg == "--limit") limit = stoul(value);
+            else if (arg == "--dir") dir = value;
+            else throw runtime_error("Unknown option: " + arg);
+        }
+
+        auto started = chrono::steady_clock::now();
+        LogStoreReader reader(dir);
+        size_t printed = 0;
+        LogQueryStats stats = reader.query(query, [&](const LogRecord& record) {
+            if (printed >= limit) {
+                return false;
+            }
+            cout << format_time(record.time_ms) << " [" << LOG_LEVEL_NAMES[static_cast<size_t>(record.level)] << "] ";
+            if (!record.module.empty()) {
+                cout << "[" << record.module << "] ";
+            }
+            cout << record.text << '\n';
+            return ++printed < limit;
+        });
+        cout.flush();
+        auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+        cerr << "Matched " << stats.matched << " in " << elapsed << " ms: segments=" << stats.segments
+             << " blocks=" << stats.blocks_read << "/" << stats.blocks
+             << " records_read=" << stats.records_read << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,22 +1,48 @@
 #include <iostream>
+#include <sstream>
 #include <cstdlib>
 #include <string>
 #include <cstring>
 #include <syslog.h>
 #include <mqtt/async_client.h>
+#include "../common/device_shards.h"
+#include "../common/log_store.h"
+#include "../common/access_log.h"
+#include "../common/metrics.h"
 
 const std::string MQTT_BROKER  = "tcp://localhost:1883";
-const std::string MQTT_TOPIC   = "/farm001/log";
+const std::string MQTT_TOPIC   = "/+/log";
+const std::string MQTT_LOG_SUFFIX = "/log";
 const std::string CLIENT_ID    = "farm_logger";
+const std::string LOG_STORE_DIR = "/home/tovarichkek/services/farm_logger/logs";  // Поиск: LOG_QUERY
+const std::string ERROR_LOG_FILE = "/var/log/farm_logger.log";  // Строки [ERROR] всех ферм
 const int QOS = 1;
+const int STATS_INTERVAL_SEC = 60;
+const int METRICS_PORT = 9101;  // Метрики: GET http://127.0.0.1:9101/metrics
 
 class LoggerCallback : public virtual mqtt::callback {
+    LogStoreWriter& store;
+    AccessLog& errors;
+
 public:
+    LoggerCallback(LogStoreWriter& s, AccessLog& e) : store(s), errors(e) {}
+
     void message_arrived(mqtt::const_message_ptr msg) override {
         try {
+            std::string device;
+            if(!device_from_topic(msg->get_topic(), MQTT_LOG_SUFFIX, device)) {
+                syslog(LOG_WARNING, "Unknown log topic: %s", msg->get_topic().c_str());
+                return;
+            }
             std::string payload = msg->get_payload();
-            // Записываем сырое сообщение в syslog
-            syslog(LOG_INFO, "%s", payload.c_str());
+            store.add_batch(device, payload);
+            // Ошибки ещё и в отдельный файл, всё остальное - только в хранилище
+            split_log_batch(payload, [this, &device](const std::string& line) {
+                LogRecord record = parse_log_line(line, 0);
+                if(record.level == LogLevel::Error) {
+                    errors.log("Device: " + device + " | " + (record.module.empty() ? "" : "[" + record.module + "] ") + record.text);
+                }
+            });
         }
         catch (const std::exception& e) {
             syslog(LOG_ERR, "Processing error: %s", e.what());
@@ -37,8 +63,16 @@ int main() {
     syslog(LOG_NOTICE, "Starting Farm Logger service");
 
     try {
+        LogStoreWriter store(LOG_STORE_DIR);
         mqtt::async_client client(MQTT_BROKER, CLIENT_ID);
-        LoggerCallback cb;
+        AccessLog errors(ERROR_LOG_FILE);
+        LoggerCallback cb(store, errors);
+        MetricsRegistry metrics;
+        metrics.add([&store, &errors](MetricsWriter& out) {
+            write_metrics(out, store);
+            write_metrics(out, errors);
+        });
+        MetricsServer metrics_server(metrics, METRICS_PORT);
         client.set_callback(cb);
 
         auto connOpts = mqtt::connect_options_builder()
@@ -51,7 +85,10 @@ int main() {
         syslog(LOG_INFO, "Subscribed to topic: %s", MQTT_TOPIC.c_str());
 
         while (true) {
-            std::this_thread::sleep_for(std::chrono::seconds(3600));
+            std::this_thread::sleep_for(std::chrono::seconds(STATS_INTERVAL_SEC));
+            std::ostringstream stats;
+            stats << "Log store: " << store.stats() << "; error log: " << errors.stats();
+            syslog(LOG_INFO, "%s", stats.str().c_str());
         }
     }
     catch (const mqtt::exception& exc) {
@@ -1 +1,2 @@
-g++ logger.cpp -o LOGGER     -lboost_system     -lboost_thread     -lpaho-mqttpp3     -lpaho-mqtt3as
+g++ -std=c++17 -O2 -pthread logger.cpp -o LOGGER     -lboost_system     -lboost_thread     -lpaho-mqttpp3     -lpaho-mqtt3as     -lzstd
+g++ -std=c++17 -O2 -pthread log_query.cpp -o LOG_QUERY -lzstd
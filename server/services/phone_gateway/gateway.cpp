@@ -0,0 +1,146 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "../common/async_server.h"
+#include "../common/push_hub.h"
+#include "../common/day_cache.h"
+#include "../common/phone_history.h"
+#include "../common/phone_publish.h"
+#include "../common/metrics.h"
+
+namespace asio = boost::asio;
+
+// Все сервисы телефона в одном процессе: история (logs.cpp и JSON reserve_logs.cpp),
+// конфиги (config.cpp) и команды (command.cpp). Один io_context принимает все порты,
+// запрос уходит обработчику своего порта; у процесса одно соединение с брокером и
+// один набор пулов соединений SQLite.
+
+const std::string DB_PATH = "/home/tovarichkek/services/data_server_farm/data.db";
+const std::string BLOCKS_DIR = "/home/tovarichkek/services/data_server_farm/blocks";
+const std::string DAY_CACHE_DIR = "/home/tovarichkek/services/data_server_farm/day_cache";
+const std::string MQTT_BROKER = "tcp://localhost:1883";
+const std::string MQTT_CLIENT_ID = "phone_gateway";
+const int HISTORY_PORT = 1488;
+const int CONFIG_PORT = 1489;
+const int COMMAND_PORT = 1490;
+const std::string CONFIG_TOPIC = "/farm001/config";
+const std::string COMMAND_TOPIC = "/farm001/command";
+const std::string HISTORY_LOG_FILE = "/var/log/data_to_phone.log";
+const std::string PUBLISH_LOG_FILE = "/var/log/phone_command.log";
+const size_t SHARD_COUNT = 4;  // Как в data_server_farm
+const size_t IO_THREADS = 1;       // Приём, чтение и отправка - асинхронно
+const size_t WORKER_THREADS = 4;   // Запросы к БД
+const size_t PUBLISH_THREADS = 2;  // Ожидание места в окне публикаций: не занимает потоки БД
+const size_t MAX_ACTIVE_REQUESTS = 32;
+const size_t MAX_QUEUED_REQUESTS = 256;
+const int READ_TIMEOUT_SEC = 10;
+const int WRITE_TIMEOUT_SEC = 30;
+const int WRITE_WAIT_BUDGET_SEC = 20;  // Поток пула ждёт медленного клиента не дольше, затем отключает
+const int STATS_INTERVAL_SEC = 60;
+const int METRICS_PORT = 9488;  // Метрики всех портов: GET http://127.0.0.1:9488/metrics
+
+struct Routes {
+    AsyncRequestServer& history;
+    AsyncRequestServer& config;
+    AsyncRequestServer& command;
+    HistoryLog& history_log;
+    PublishLog& publish_log;
+};
+
+void print_stats(asio::steady_timer& timer, Routes& routes, MqttPublisher& publisher, PushHub& hub, DayCache& days) {
+    timer.expires_after(std::chrono::seconds(STATS_INTERVAL_SEC));
+    timer.async_wait([&timer, &routes, &publisher, &hub, &days](const boost::system::error_code& ec) {
+        if(ec) {
+            return;
+        }
+        std::cout << "Requests " << HISTORY_PORT << ": " << routes.history.stats() << std::endl;
+        std::cout << "Requests " << CONFIG_PORT << ": " << routes.config.stats() << std::endl;
+        std::cout << "Requests " << COMMAND_PORT << ": " << routes.command.stats() << std::endl;
+        std::cout << "Publish: " << publisher.stats() << std::endl;
+        std::cout << "Access log " << HISTORY_LOG_FILE << ": " << routes.history_log.stats() << std::endl;
+        std::cout << "Access log " << PUBLISH_LOG_FILE << ": " << routes.publish_log.stats() << std::endl;
+        std::cout << "Push: " << hub.stats() << std::endl;
+        std::cout << "Day cache: " << days.stats() << std::endl;
+        print_stats(timer, routes, publisher, hub, days);
+    });
+}
+
+ServerOptions server_options(int port) {
+    ServerOptions options;
+    options.port = port;
+    options.max_active = MAX_ACTIVE_REQUESTS;
+    options.max_queued = MAX_QUEUED_REQUESTS;
+    options.read_timeout = std::chrono::seconds(READ_TIMEOUT_SEC);
+    options.write_timeout = std::chrono::seconds(WRITE_TIMEOUT_SEC);
+    options.write_wait_budget = std::chrono::seconds(WRITE_WAIT_BUDGET_SEC);
+    return options;
+}
+
+int main() {
+    try {
+        HistoryDatabase database(DB_PATH, SHARD_COUNT, BLOCKS_DIR);
+        HistoryLog history_log(HISTORY_LOG_FILE);
+        PushHub hub(PUSH_ENCODINGS, encode_push);
+        DayCache days(DAY_CACHE_DIR, BLOCKS_DIR, encode_push);
+        MqttPublisher publisher(MQTT_BROKER, MQTT_CLIENT_ID);
+        PublishLog publish_log(PUBLISH_LOG_FILE);
+
+        asio::io_context io_context;
+        asio::thread_pool workers(WORKER_THREADS);
+        asio::thread_pool publishers(PUBLISH_THREADS);
+
+        AsyncRequestServer history(io_context, workers, server_options(HISTORY_PORT),
+            [&database, &history_log, &hub, &days](const std::string& request, const std::string& ip, ResponseWriter& out) {
+                handle_phone_history(request, ip, out, database, history_log, hub, days);
+            });
+        AsyncRequestServer config(io_context, publishers, server_options(CONFIG_PORT),
+            [&publisher, &publish_log, &publishers](const std::string& request, const std::string& ip, ResponseWriter& out) {
+                handle_publish_request(request, ip, out, CONFIG_TOPIC, publisher, publish_log, publishers);
+            });
+        AsyncRequestServer command(io_context, publishers, server_options(COMMAND_PORT),
+            [&publisher, &publish_log, &publishers](const std::string& request, const std::string& ip, ResponseWriter& out) {
+                handle_publish_request(request, ip, out, COMMAND_TOPIC, publisher, publish_log, publishers);
+            });
+        Routes routes{history, config, command, history_log, publish_log};
+
+        MetricsRegistry metrics;
+        metrics.add([&routes, &publisher, &hub, &days](MetricsWriter& out) {
+            write_metrics(out, routes.history, HISTORY_PORT);
+            write_metrics(out, routes.config, CONFIG_PORT);
+            write_metrics(out, routes.command, COMMAND_PORT);
+            routes.history_log.write_metrics(out);
+            routes.publish_log.write_metrics(out);
+            write_metrics(out, publisher);
+            write_metrics(out, hub);
+            write_metrics(out, days);
+        });
+        MetricsServer metrics_server(metrics, METRICS_PORT);
+
+        asio::steady_timer stats_timer(io_context);
+        print_stats(stats_timer, routes, publisher, hub, days);
+
+        std::thread follower([&hub]() { follow_ring(hub); });
+        follower.detach();
+
+        std::cout << "Phone Gateway started on ports " << HISTORY_PORT << ", " << CONFIG_PORT
+                  << ", " << COMMAND_PORT << std::endl;
+
+        std::vector<std::thread> io_threads;
+        for(size_t i = 1; i < IO_THREADS; ++i) {
+            io_threads.emplace_back([&io_context]() { io_context.run(); });
+        }
+        io_context.run();
+        for(auto& t : io_threads) {
+            t.join();
+        }
+        workers.join();
+        publishers.join();
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Fatal error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
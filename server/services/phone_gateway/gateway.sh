@@ -0,0 +1 @@
+g++ -std=c++17 -pthread -o GATEWAY gateway.cpp -I/usr/include/boost -lboost_system -lboost_thread -lsqlite3 -llz4 -lzstd -lpaho-mqttpp3 -lpaho-mqtt3as